@@ -0,0 +1,609 @@
+/* bench.c
+ *
+ * This file is part of oku.
+ *
+ * Copyright (C) 2019 Ellis Rhys Thomas
+ *
+ * oku is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * oku is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+ * License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with oku.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS OR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* Description:
+
+   Benchmark of bitmap_copy() against the byte at a time loop it
+   replaced. Glyph sized and full page rectangles are copied at every
+   alignment from 0 to 7 and the result of each is checked pixel by
+   pixel.
+
+   Each bitmap_transform() of a full page is timed and checked in the
+   same way.
+
+   bitmap_blit() is checked pixel by pixel with every operation over
+   random sizes and origins, including negative ones, so rectangles
+   are clipped on every edge.
+
+   Given a font, a page of text is rendered with raster_render() in 1
+   to RASTER_THREADS bands on the 2.9" panel and on a 10.3" panel,
+   and each result compared with page_render().
+
+   The pagination index of a book of the same text is built one page
+   per pages_step(), as the reader does when idle, checking that no
+   step lays out more than one page.
+
+   Frames are sent to the ws29bw driver over the mock SPI backend,
+   which counts the traffic of a full frame, of a small change and of
+   a partial refresh of a page number sized rectangle, and models the
+   time it would take.
+
+   The mock then hangs refreshes until the controller has been reset
+   one to three times, checking each step of the driver's recovery
+   brings it back and shows the whole frame again, and that one more
+   reset than it has fails. A hung refresh must be reported by
+   epd_poll() without blocking and recovered by epd_wait().
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "src/bitmap.h"
+#include "src/page.h"
+#include "src/raster.h"
+#include "src/epd.h"
+#include "src/spi.h"
+#include "src/oku_types.h"
+
+#define PANEL_W 128		/* Waveshare 2.9" panel */
+#define PANEL_H 296
+#define ITERATIONS 20000
+#define BLIT_CASES 200000	/* Random bitmap_blit() checks */
+#define REPEATS 5
+#define LARGE_W 1404		/* Waveshare 10.3" panel */
+#define LARGE_H 1872
+
+/* Object: LOREM
+
+   Source of codepoints repeating text indefinitely. */
+typedef struct LOREM {
+    const char *text;
+    long        pos;
+} LOREM;
+
+/* Function: byte_copy()
+
+   Previous implementation of bitmap_copy(), two read modify writes
+   per byte and one byte written past each row. */
+void
+byte_copy(BITMAP *bmp, BITMAP *rectangle, coordinate xmin, coordinate ymin)
+{
+    byte *in = rectangle->buffer;
+    byte *out = bmp->buffer + ymin * bmp->pitch + xmin / 8;
+    byte misalignment = xmin % 8;
+    members written = 0;
+
+    while ( written < rectangle->length ) {
+	*out = (*in >> misalignment) |  (*out & ~(0xFF >> misalignment));
+	++out;
+	*out = (*in << (8 - misalignment)) | (*out & 0xFF >> misalignment);
+	++in;
+	++written;
+	if (written % rectangle->pitch == 0)
+	    out += bmp->pitch - rectangle->pitch;
+    }
+}
+
+/* Function: px()
+
+   Returns the pixel at x, y. */
+int
+px(BITMAP *bmp, coordinate x, coordinate y)
+{
+    return bmp->buffer[y * bmp->pitch + x / 8] >> (7 - x % 8) & 1;
+}
+
+/* Function: verify()
+
+   Returns non-zero if dest differs from before anywhere but the
+   rectangle at x, y, or the rectangle was not copied. */
+int
+verify(BITMAP *before, BITMAP *dest, BITMAP *rect, coordinate x, coordinate y)
+{
+    resolution rh = rect->length / rect->pitch;
+
+    for (coordinate j = 0; j < dest->length / dest->pitch; ++j)
+	for (coordinate i = 0; i < dest->pitch * 8; ++i) {
+	    int inside = i >= x && i < x + rect->width && i < dest->width
+		&& j >= y && j < y + rh;
+	    int want = inside ? px(rect, i - x, j - y) : px(before, i, j);
+	    if (px(dest, i, j) != want)
+		return 1;
+	}
+
+    return 0;
+}
+
+/* Function: seconds()
+
+   Monotonic time in seconds. */
+double
+seconds(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+/* Function: run()
+
+   Time both copies of rect into dest at each alignment, reporting
+   nanoseconds per copy. */
+int
+run(const char *name, BITMAP *dest, BITMAP *rect, int iterations)
+{
+    BITMAP *before = bitmap_create(dest->width, dest->length / dest->pitch);
+    int failed = 0;
+
+    printf("%-6s %3ux%-3zu  align  byte (ns)  word (ns)  speedup\n", name,
+	   rect->width, rect->length / rect->pitch);
+
+    for (coordinate align = 0; align < 8; ++align) {
+	/* Leave room for the byte loop's overrun. */
+	coordinate x = align + (rect->width + 8 < dest->width ? 8 : 0);
+	double t0, t, byte_ns, word_ns;
+
+	/* Best of several runs, to discount other load. */
+	byte_ns = word_ns = 1e9;
+	for (int rep = 0; rep < REPEATS; ++rep) {
+	    t0 = seconds();
+	    for (int i = 0; i < iterations; ++i)
+		byte_copy(dest, rect, x, 0);
+	    t = (seconds() - t0) / iterations * 1e9;
+	    byte_ns = t < byte_ns ? t : byte_ns;
+
+	    t0 = seconds();
+	    for (int i = 0; i < iterations; ++i)
+		bitmap_copy(dest, rect, x, 0);
+	    t = (seconds() - t0) / iterations * 1e9;
+	    word_ns = t < word_ns ? t : word_ns;
+	}
+
+	/* Check a single copy over a noisy page, then over the
+	   clipped right edge. */
+	for (members i = 0; i < dest->length; ++i)
+	    before->buffer[i] = dest->buffer[i] = rand();
+	bitmap_copy(dest, rect, x, 0);
+	failed |= verify(before, dest, rect, x, 0);
+	memcpy(dest->buffer, before->buffer, dest->length);
+	x = dest->width - rect->width / 2 - align;
+	bitmap_copy(dest, rect, x, 1);
+	failed |= verify(before, dest, rect, x, 1);
+
+	printf("%19u  %9.1f  %9.1f  %6.2fx\n", align, byte_ns, word_ns,
+	       byte_ns / word_ns);
+    }
+
+    bitmap_destroy(before);
+    return failed;
+}
+
+/* Function: blitted()
+
+   Returns pixel a of the destination combined with pixel b of the
+   rectangle by op. */
+int
+blitted(enum BLIT_OP op, int a, int b)
+{
+    switch (op) {
+    case BLIT_COPY:   return b;
+    case BLIT_OR:     return a | b;
+    case BLIT_AND:    return a & b;
+    case BLIT_XOR:    return a ^ b;
+    case BLIT_ANDNOT: return a & !b;
+    }
+    return -1;
+}
+
+/* Function: run_blit()
+
+   Blit noisy rectangles of random size onto noisy bitmaps at random
+   origins, from wholly off the left and top to wholly off the right
+   and bottom, with each operation. Every pixel of the destination is
+   checked, including the padding past its width, which must not
+   change. Returns non-zero if any case differs. */
+int
+run_blit(int cases)
+{
+    int bad = 0;
+
+    for (int c = 0; c < cases; ++c) {
+	resolution dw = 1 + rand() % 200, dh = 1 + rand() % 20;
+	resolution rw = 1 + rand() % 70, rh = 1 + rand() % 10;
+	BITMAP *dest = bitmap_create(dw, dh);
+	BITMAP *before = bitmap_create(dw, dh);
+	BITMAP *rect = bitmap_create(rw, rh);
+	int x = rand() % (int)(dw + rw) - (int)rw;
+	int y = rand() % (int)(dh + rh) - (int)rh;
+	enum BLIT_OP op = rand() % (BLIT_ANDNOT + 1);
+
+	for (members i = 0; i < dest->length; ++i)
+	    before->buffer[i] = dest->buffer[i] = rand();
+	for (members i = 0; i < rect->length; ++i)
+	    rect->buffer[i] = rand();
+
+	bitmap_blit(dest, rect, x, y, op);
+
+	for (int j = 0; j < (int)dh; ++j)
+	    for (int i = 0; i < (int)dest->pitch * 8; ++i) {
+		int a = px(before, i, j), want = a;
+		if (i < (int)dw && i >= x && i < x + (int)rw
+		    && j >= y && j < y + (int)rh)
+		    want = blitted(op, a, px(rect, i - x, j - y));
+		if (px(dest, i, j) != want) {
+		    ++bad;
+		    j = dh;
+		    break;
+		}
+	    }
+
+	bitmap_destroy(rect);
+	bitmap_destroy(before);
+	bitmap_destroy(dest);
+    }
+
+    printf("blit  %d random cases, %d differ\n", cases, bad);
+
+    return bad != 0;
+}
+
+/* Function: transformed()
+
+   Returns the pixel of src that transformation t moves to x, y of a
+   page w x h pixels after the transformation. */
+int
+transformed(BITMAP *src, enum TRANSFORM t, coordinate x, coordinate y,
+	    resolution w, resolution h)
+{
+    switch (t) {
+    case TRANSFORM_ROTATE_90:  return px(src, y, w - 1 - x);
+    case TRANSFORM_ROTATE_180: return px(src, w - 1 - x, h - 1 - y);
+    case TRANSFORM_ROTATE_270: return px(src, h - 1 - y, x);
+    case TRANSFORM_FLIP_H:     return px(src, w - 1 - x, y);
+    case TRANSFORM_FLIP_V:     return px(src, x, h - 1 - y);
+    }
+    return -1;
+}
+
+/* Function: run_transform()
+
+   Time every transformation of src, reporting microseconds per page,
+   and check each pixel of the result. */
+int
+run_transform(BITMAP *src, int iterations)
+{
+    const char *name[] = { "rotate 90", "rotate 180", "rotate 270",
+			   "flip h", "flip v" };
+    resolution sh = src->length / src->pitch;
+    int failed = 0;
+
+    printf("transform %3ux%-3u  (us)\n", src->width, sh);
+
+    for (enum TRANSFORM t = TRANSFORM_ROTATE_90; t <= TRANSFORM_FLIP_V; ++t) {
+	int turn = t == TRANSFORM_ROTATE_90 || t == TRANSFORM_ROTATE_270;
+	resolution w = turn ? sh : src->width;
+	resolution h = turn ? src->width : sh;
+	BITMAP *dest = bitmap_create(w, h);
+	double t0, us = 1e9;
+
+	for (int rep = 0; rep < REPEATS; ++rep) {
+	    t0 = seconds();
+	    for (int i = 0; i < iterations; ++i)
+		bitmap_transform(dest, src, t);
+	    double run = (seconds() - t0) / iterations * 1e6;
+	    us = run < us ? run : us;
+	}
+
+	for (coordinate y = 0; y < h; ++y)
+	    for (coordinate x = 0; x < w; ++x)
+		failed |= px(dest, x, y) != transformed(src, t, x, y, w, h);
+
+	printf("%-10s  %15.2f\n", name[t], us);
+	bitmap_destroy(dest);
+    }
+
+    return failed;
+}
+
+/* Function: lorem_source()
+
+   CP_SOURCE over a LOREM, never exhausted. */
+int
+lorem_source(void *ctx, codepoint *cp, long *offset)
+{
+    LOREM *l = ctx;
+
+    *offset = l->pos;
+    *cp = l->text[l->pos++ % strlen(l->text)];
+
+    return 0;
+}
+
+/* Function: run_bands()
+
+   Lay out one page of w x h pixels at size px, then time
+   raster_render() of it with each band count, reporting microseconds
+   per page and the speedup over one band. */
+int
+run_bands(char *font, resolution w, resolution h, unsigned size,
+	  int iterations)
+{
+    LOREM lorem = { "Lorem ipsum dolor sit amet, consectetur adipiscing "
+		    "elit, sed do eiusmod tempor incididunt ut labore et "
+		    "dolore magna aliqua. Ut enim ad minim veniam, quis "
+		    "nostrud exercitation ullamco laboris nisi ut aliquip "
+		    "ex ea commodo consequat.\n", 0 };
+    TEXT *text = text_start(font, size);
+    LAYOUT *lo = calloc(1, sizeof *lo);
+    PAGE *page = malloc(sizeof *page);
+    BITMAP *ref = bitmap_create(w, h);
+    BITMAP *bmp = bitmap_create(w, h);
+    double one = 0;
+    int failed = 0;
+
+    if (text == NULL) {
+	printf("bands: failed to open font %s\n", font);
+	return 1;
+    }
+
+    *lo = (LAYOUT){ .text = text, .width = w, .height = h,
+		    .margins = { 4, 4, 4, 4 }, .limit = -1 };
+    page_layout(lo, lorem_source, &lorem, page);
+    page_render(page, text, ref);
+
+    printf("bands %4ux%-4u %4zu glyphs  (us)  speedup\n", w, h,
+	   page->count);
+
+    for (unsigned n = 1; n <= RASTER_THREADS; ++n) {
+	RASTER *raster = raster_create(font, size, n);
+	double t0, us = 1e9;
+
+	for (int rep = 0; rep < REPEATS; ++rep) {
+	    t0 = seconds();
+	    for (int i = 0; i < iterations; ++i)
+		raster_render(raster, page, text, bmp);
+	    double run = (seconds() - t0) / iterations * 1e6;
+	    us = run < us ? run : us;
+	}
+	one = n == 1 ? us : one;
+
+	failed |= memcmp(bmp->buffer, ref->buffer, ref->length) != 0;
+
+	printf("%10u  %21.2f  %6.2fx\n", n, us, one / us);
+	raster_destroy(raster);
+    }
+
+    bitmap_destroy(bmp);
+    bitmap_destroy(ref);
+    free(page);
+    free(lo);
+    text_stop(text);
+
+    return failed;
+}
+
+/* Function: run_index()
+
+   Build the pagination index of a book of text at size px around an
+   anchor in its middle, one page per pages_step(), reporting the
+   longest step. Fails if a step lays out more than one page. */
+int
+run_index(char *font, resolution w, resolution h, unsigned size)
+{
+    const char *lorem = "Lorem ipsum dolor sit amet, consectetur "
+	"adipiscing elit, sed do eiusmod tempor incididunt ut labore et "
+	"dolore magna aliqua.\n";
+    TEXT *text = text_start(font, size);
+    FILE *book = tmpfile();
+    PAGES *pages = pages_create();
+    LAYOUT lo = { .text = text, .width = w, .height = h,
+		  .margins = { 4, 4, 4, 4 }, .limit = -1 };
+    double slowest = 0;
+    unsigned steps = 0;
+    int err = OK, failed = 0;
+
+    if (text == NULL || book == NULL) {
+	printf("index: failed to open font %s\n", font);
+	return 1;
+    }
+
+    for (int i = 0; i < 2000; ++i)
+	fputs(lorem, book);
+    pages_reflow(pages, ftell(book) / 2);
+
+    while (err == OK) {
+	members before = pages->head.count + pages->tail.count;
+	double t0 = seconds();
+	err = pages_step(pages, &lo, book, 1);
+	double run = seconds() - t0;
+	slowest = run > slowest ? run : slowest;
+	failed |= pages->head.count + pages->tail.count > before + 1;
+	++steps;
+    }
+    failed |= err > 0;
+
+    printf("index %ux%u  %zu + %zu pages  %u steps  slowest %.0f us\n",
+	   w, h, pages->head.count, pages->tail.count, steps,
+	   slowest * 1e6);
+
+    pages_destroy(pages);
+    fclose(book);
+    text_stop(text);
+
+    return failed;
+}
+
+/* Function: run_display()
+
+   Display a noisy frame, then the same frame with two bytes changed,
+   then a partial refresh of a 32 x 16 rectangle, reporting the SPI
+   traffic of each. */
+void
+run_display(void)
+{
+    EPD *epd = epd_create();
+    members len = (epd->width + 7) / 8 * epd->height;
+    byte *frame = malloc(len);
+    const char *name[] = { "full", "change", "region" };
+    SPI_STATS s;
+
+    for (members i = 0; i < len; ++i)
+	frame[i] = rand();
+
+    epd_on(epd);
+    printf("display %ux%u  writes  bytes  gpio  cmds  (ms)\n", epd->width,
+	   epd->height);
+
+    for (int i = 0; i < 3; ++i) {
+	if (i > 0) {
+	    frame[len / 3] ^= 0x18;
+	    frame[len / 2] ^= 0x81;
+	}
+	spi_stats(&s, 1);
+	if (i < 2)
+	    epd_display(epd, frame, len);
+	else
+	    epd_display_region(epd, frame, len, 0, 140, 32, 16);
+	spi_stats(&s, 1);
+	printf("%-12s  %6lu  %5lu  %4lu  %4lu  %6.3f\n", name[i], s.writes,
+	       s.bytes, s.gpio_writes, s.commands, s.seconds * 1e3);
+    }
+
+    epd_off(epd);
+    epd_destroy(epd);
+    free(frame);
+}
+
+/* Function: run_recover()
+
+   Hang the refresh of a small change to a frame until the controller
+   has had 1 to 4 resets, checking the whole frame is shown again
+   after recovery, see spi_mock_frame(). Then hang an asynchronous
+   refresh and poll it until the hang is reported, which must leave
+   recovery to epd_wait(). */
+int
+run_recover(void)
+{
+    EPD *epd = epd_create();
+    members len = (epd->width + 7) / 8 * epd->height;
+    byte *frame = malloc(len);
+    byte *change = malloc(len);
+    unsigned long full, changed;
+    double t0;
+    int err, failed = 0;
+
+    for (members i = 0; i < len; ++i)
+	frame[i] = rand();
+    memcpy(change, frame, len);
+    change[len / 2] ^= 0x81;
+
+    /* Hashes of each frame written whole */
+    epd_on(epd);
+    epd_display(epd, change, len);
+    full = spi_mock_frame();
+    epd_display(epd, frame, len);
+    epd_display(epd, change, len);
+    changed = spi_mock_frame();
+    failed |= full == changed;
+
+    printf("recover  resets  result  whole frame\n");
+    for (unsigned resets = 1; resets <= 4; ++resets) {
+	epd_display(epd, frame, len);
+	spi_mock_hang(resets);
+	err = epd_display(epd, change, len);
+	spi_mock_hang(0);
+	printf("%15u  %6d  %s\n", resets, err,
+	       spi_mock_frame() == full ? "yes" : "no");
+	if (resets < 4)
+	    failed |= err != OK || spi_mock_frame() != full;
+	else
+	    failed |= err != ERR_BUSY;
+    }
+
+    /* Taken as hung after 1.3 s */
+    epd_set_profile(epd, "ultra-fast");
+    epd_display(epd, frame, len);
+    spi_mock_hang(1);
+    epd_display_async(epd, change, len, NULL, NULL);
+    t0 = seconds();
+    do
+	err = epd_poll(epd);
+    while (err == WARN_PENDING);
+    printf("poll  %d after %.0f ms", err, (seconds() - t0) * 1e3);
+    failed |= err != ERR_BUSY || spi_mock_frame() != changed;
+    err = epd_wait(epd);
+    printf(", wait %d  whole frame %s\n", err,
+	   spi_mock_frame() == full ? "yes" : "no");
+    failed |= err != OK || spi_mock_frame() != full;
+
+    epd_off(epd);
+    epd_destroy(epd);
+    free(change);
+    free(frame);
+
+    return failed;
+}
+
+int
+main(int argc, char *argv[])
+{
+    int failed = 0;
+    BITMAP *page = bitmap_create(PANEL_W + 16, PANEL_H + 1);
+    BITMAP *glyph = bitmap_create(13, 17);
+    BITMAP *full = bitmap_create(PANEL_W - 8, PANEL_H);
+
+    srand(1);
+    for (members i = 0; i < glyph->length; ++i)
+	glyph->buffer[i] = rand();
+    for (members i = 0; i < full->length; ++i)
+	full->buffer[i] = rand();
+
+    failed |= run("glyph", page, glyph, ITERATIONS * 10);
+    failed |= run("page", page, full, ITERATIONS / 10);
+    failed |= run_transform(page, ITERATIONS / 10);
+    failed |= run_blit(BLIT_CASES);
+    if (argc > 1) {
+	failed |= run_bands(argv[1], PANEL_W, PANEL_H, 12, ITERATIONS / 10);
+	failed |= run_bands(argv[1], LARGE_W, LARGE_H, 36, ITERATIONS / 100);
+	failed |= run_index(argv[1], PANEL_W, PANEL_H, 12);
+    }
+    run_display();
+    failed |= run_recover();
+
+    printf(failed ? "FAILED: result differs from reference\n" : "OK\n");
+
+    bitmap_destroy(full);
+    bitmap_destroy(glyph);
+    bitmap_destroy(page);
+
+    return failed;
+}
@@ -0,0 +1,264 @@
+/* gpiotest.c
+ *
+ * This file is part of oku.
+ *
+ * Copyright (C) 2019 Ellis Rhys Thomas
+ *
+ * oku is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * oku is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+ * License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with oku.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS OR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+/* Description:
+
+   Test of spi_gpio_wait() in spi_wp.c on a simulated GPIO line,
+   without wiringPi or a GPIO chip.
+
+   spi_wp.c is built with SPI_GPIO_CHIP set to /dev/null and ioctl()
+   wrapped by the linker. A request for edge events is answered with
+   one end of a pipe, through which the test thread sends an event
+   for each edge, and the level of the line is read from a variable
+   the test thread sets. The wiringPi calls are defined here, so
+   digitalRead() reads the same variable when the request is
+   refused.
+
+   For each of the edge event and the polled line, the line falls
+   TRIALS times after a spurious event that leaves it high. Each wait
+   must return after the fall and not before, and the median time
+   from the fall to the return must be under LATENCY_MS. A wait on a
+   line that never falls must time out.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <linux/gpio.h>
+
+#include "src/spi.h"
+#include "src/oku_types.h"
+
+#define PIN_EVENTS 24		/* Line with edge events */
+#define PIN_POLLED 25		/* Line whose event request is refused */
+#define TRIALS 20
+#define LATENCY_MS 1.0		/* Longest median wake after an edge */
+#define SETTLE_US 5000		/* Least time before each simulated edge */
+#define TIMEOUT_MS 20
+
+int __real_ioctl(int fd, unsigned long request, ...);
+
+/* Object: LINE
+
+   Simulated GPIO line. */
+typedef struct LINE {
+    int        pin;
+    atomic_int level;		/* Level read by spi_wp.c */
+    int        events[2];	/* Pipe of edge events, or -1 */
+    unsigned   settle;		/* Time before each edge (us) */
+    double     fell;		/* Time of the falling edge */
+} LINE;
+
+static LINE lines[2] = {
+    { .pin = PIN_EVENTS, .level = 1, .events = { -1, -1 } },
+    { .pin = PIN_POLLED, .level = 1, .events = { -1, -1 } }
+};
+
+/* Function: seconds()
+
+   Monotonic time in seconds. */
+double
+seconds(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+/* Function: line_of()
+
+   The simulated line with event file descriptor fd, or pin if fd is
+   negative. */
+LINE *
+line_of(int fd, int pin)
+{
+    for (int i = 0; i < 2; ++i)
+	if (fd >= 0 ? lines[i].events[0] == fd : lines[i].pin == pin)
+	    return &lines[i];
+    return NULL;
+}
+
+/* Function: __wrap_ioctl()
+
+   GPIO character device requests on the simulated lines, any other
+   request is passed on. */
+int
+__wrap_ioctl(int fd, unsigned long request, ...)
+{
+    va_list ap;
+    va_start(ap, request);
+    void *arg = va_arg(ap, void *);
+    va_end(ap);
+
+    if (request == GPIO_GET_LINEEVENT_IOCTL) {
+	struct gpioevent_request *req = arg;
+	if (req->lineoffset != PIN_EVENTS)
+	    return -1;
+	LINE *l = line_of(-1, req->lineoffset);
+	if (pipe(l->events))
+	    return -1;
+	req->fd = l->events[0];
+	return 0;
+    }
+    if (request == GPIOHANDLE_GET_LINE_VALUES_IOCTL) {
+	LINE *l = line_of(fd, 0);
+	if (l == NULL)
+	    return -1;
+	((struct gpiohandle_data *)arg)->values[0] = atomic_load(&l->level);
+	return 0;
+    }
+
+    return __real_ioctl(fd, request, arg);
+}
+
+/* wiringPi, as used by spi_wp.c */
+int wiringPiSetupGpio(void) { return 0; }
+void pinMode(int pin, int mode) { (void)pin; (void)mode; }
+void digitalWrite(int pin, int value) { (void)pin; (void)value; }
+int digitalRead(int pin) { return atomic_load(&line_of(-1, pin)->level); }
+void delay(unsigned int ms) { usleep(ms * 1000); }
+void delayMicroseconds(unsigned int us) { usleep(us); }
+int wiringPiSPISetup(int channel, int speed)
+{
+    (void)channel;
+    (void)speed;
+    return -1;
+}
+
+/* Function: edge()
+
+   Test thread, sends an event that leaves the line high, then lowers
+   the line and sends the event of its fall. The time before each is
+   varied by the caller, so the edges do not fall in step with any
+   polling interval. */
+void *
+edge(void *arg)
+{
+    LINE *l = arg;
+    struct gpioevent_data event = { 0 };
+
+    usleep(l->settle);
+    event.id = GPIOEVENT_EVENT_RISING_EDGE;
+    if (l->events[1] >= 0 && write(l->events[1], &event, sizeof event) < 0)
+	perror("edge");
+
+    usleep(l->settle);
+    l->fell = seconds();
+    atomic_store(&l->level, 0);
+    event.id = GPIOEVENT_EVENT_FALLING_EDGE;
+    if (l->events[1] >= 0 && write(l->events[1], &event, sizeof event) < 0)
+	perror("edge");
+
+    return NULL;
+}
+
+/* Function: compare()
+
+   qsort() ordering of doubles. */
+int
+compare(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/* Function: run_edges()
+
+   Wait for the line to fall TRIALS times, reporting the median and
+   longest time from the fall to the return. Returns non-zero if a
+   wait failed, returned before the fall or the median is too long. */
+int
+run_edges(const char *name, LINE *l)
+{
+    double ms[TRIALS];
+    int failed = 0;
+
+    for (int i = 0; i < TRIALS; ++i) {
+	pthread_t t;
+	atomic_store(&l->level, 1);
+	l->fell   = 0;
+	l->settle = SETTLE_US + rand() % 1000;
+	pthread_create(&t, NULL, edge, l);
+
+	int err = spi_gpio_wait(l->pin, GPIO_LEVEL_LOW, 1000);
+	double woke = seconds();
+	pthread_join(t, NULL);
+
+	ms[i] = (woke - l->fell) * 1e3;
+	failed |= err != OK || woke < l->fell;
+    }
+
+    qsort(ms, TRIALS, sizeof *ms, compare);
+    failed |= ms[TRIALS / 2] >= LATENCY_MS;
+
+    printf("%-6s  %d falls  median %.3f ms  longest %.3f ms\n", name,
+	   TRIALS, ms[TRIALS / 2], ms[TRIALS - 1]);
+
+    return failed;
+}
+
+/* Function: run_timeout()
+
+   Wait for a line that stays high, which must time out. */
+int
+run_timeout(LINE *l)
+{
+    atomic_store(&l->level, 1);
+
+    double t0 = seconds();
+    int err = spi_gpio_wait(l->pin, GPIO_LEVEL_LOW, TIMEOUT_MS);
+    double ms = (seconds() - t0) * 1e3;
+
+    printf("timeout %d ms  returned %d after %.1f ms\n", TIMEOUT_MS, err, ms);
+
+    return err != ERR_BUSY || ms < TIMEOUT_MS;
+}
+
+int
+main(void)
+{
+    int failed = 0;
+
+    failed |= run_edges("events", &lines[0]);
+    failed |= lines[0].events[0] < 0; /* The event path was not taken */
+    failed |= run_edges("polled", &lines[1]);
+    failed |= run_timeout(&lines[0]);
+
+    printf(failed ? "FAILED: spi_gpio_wait() missed or was slow to wake\n"
+	   : "OK\n");
+
+    return failed;
+}
@@ -35,19 +35,71 @@
 
 #include <ert_log.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>		/* strcspn() */
+#include <sys/select.h>		/* select() */
+#include <unistd.h>		/* STDIN_FILENO, sysconf() */
 
 #include "spi.h"		/* GPIO and SPI communication */
 #include "epd.h"		/* Device specific commands */
 #include "bitmap.h"		/* Bitmap manipulation */
+#include "draw.h"		/* Lines and rectangles */
 #include "utf8.h"		/* Decode UTF-8 into unicode codepoints */
-#include "text.h"
+#include "text.h"		/* Glyph rendering */
+#include "page.h"		/* Layout and pagination */
+#include "search.h"		/* Full text search */
+#include "state.h"		/* Resume from snapshot */
+#include "batch.h"		/* Headless page export */
+#include "pipeline.h"		/* Read ahead of the display */
+#include "raster.h"		/* Band parallel rendering */
+#include "image.h"		/* Illustrations */
+#include "refresh.h"		/* Full and partial refreshes */
+#include "display.h"		/* Latest wins display queue */
+#include "oku_mem.h"		/* Memory allocation */
 
 #include "oku_types.h"		/* Type definitions */
 
 #define UNIFILL 5000		/*  to fill codepoint buffer */
+#define MARGIN 4		/* Initial page margins (px) */
+#define INDEX_STEP 1		/* Pages indexed per idle loop */
+#define QUERY_MAX 256		/* Longest search query (B) */
+#define IDLE_SLEEP 120		/* Idle time before display sleeps (s) */
+#define FULL_PARTIALS 10	/* Partial refreshes between full ones */
+#define FULL_SECONDS 600	/* Longest time between full refreshes (s) */
+#define BAND_PIXELS 1000000	/* Smallest page drawn in bands (px) */
+#ifndef RASTER_BANDS
+#define RASTER_BANDS 1		/* Most bands per page, see raster_threads() */
+#endif
 
 EPD *epd = NULL;
+TEXT *text = NULL;
+DISPLAY *display = NULL;	/* Display thread while it owns epd */
+
+/* Object: READER
+
+   Open book and the reading position within it. */
+typedef struct READER {
+    char   *path;		/* Path to book */
+    FILE   *book;		/* UTF-8 text being read */
+    SEARCH *search;		/* Full text index, built on first use */
+    STATE   state;		/* Snapshot of reading position */
+    LAYOUT  layout;		/* Current layout parameters */
+    PAGES  *pages;		/* Pagination index */
+    PAGE   *page;		/* Page on display */
+    BITMAP *bmp;		/* Page bitmap */
+    BITMAP *turned;		/* Device bitmap in landscape, or NULL */
+    PIPELINE *pipe;		/* Prepares the following pages */
+    RASTER *raster;		/* Draws the page on display */
+    REFRESH *refresh;		/* Chooses full or partial refreshes */
+    DISPLAY *display;		/* Refreshes the device in the background */
+    unsigned profile;		/* Index in profiles of waveform */
+    unsigned idle;		/* Idle time before sleeping (s), 0 never */
+    int     asleep;		/* Non-zero once the display sleeps */
+} READER;
+
+/* Full refresh waveforms, see epd_set_profile(). */
+const char *profiles[] = { "quality", "fast", "ultra-fast", "auto" };
 
 uint8_t binary_pattern[] = 
     { 0x00, 0x00, 0x01, 0x01, 0x02, 0x02, 0x03, 0x03,
@@ -58,17 +110,18 @@ uint8_t binary_pattern[] =
 
 /* Function: draw_lines()
 
-   Draws dotted lines to the device bitmap. */
+   Draws dotted lines to the device bitmap, a dot every 5 pixels
+   along every fifth row. */
 int
 draw_lines(struct BITMAP *bmp)
 {
-    for (coordinate x = 0; x < bmp->width; x += 5)
-    	for (coordinate y = 0; y < bmp->length / bmp->pitch ; y += 5) {
+    const PATTERN dots = { 0x80000000, 5 };
 
-    	    int err = bitmap_modify_px(bmp, x, y, SET_PIXEL_BLACK);
-	    if (err > 0)
-		return err;
-	}
+    for (coordinate y = 0; y < bmp->length / bmp->pitch; y += 5) {
+	int err = draw_hline(bmp, 0, y, bmp->width, SET_PIXEL_BLACK, &dots);
+	if (err > 0)
+	    return err;
+    }
 
     return OK;
 }
@@ -94,6 +147,388 @@ draw_binary_pattern(struct BITMAP *bmp)
     return err;
 }
 
+/* Function: snapshot()
+
+   Update the reader state snapshot from the page on display, font
+   and layout. */
+STATE *
+snapshot(READER *r)
+{
+    r->state.offset   = r->page->start;
+    r->state.fontsize = text->size;
+    r->state.width    = r->layout.width;
+    r->state.height   = r->layout.height;
+    r->state.margins  = r->layout.margins;
+
+    return &r->state;
+}
+
+/* Function: displayed()
+
+   Completion callback for the refresh started by present(). A page
+   replaced by a later one before it was shown is not an error. */
+void
+displayed(EPD *epd, int err, void *ctx)
+{
+    (void)epd;
+    (void)ctx;
+
+    if (err > 0 && err != ERR_CANCELLED)
+	log_err("Failed to refresh display");
+
+    return;
+}
+
+/* Function: present()
+
+   Send a rendered page, covering byte offsets start to end, to the
+   device and record it as the page on display. In landscape the page
+   is turned to fit the device first.
+
+   Returns once the page is queued, so the next page can be prepared
+   while the display updates. Pages turned faster than the display
+   refreshes replace one another in the queue, only the last being
+   shown. */
+int
+present(READER *r, BITMAP *bmp, long start, long end)
+{
+    int err = OK;
+
+    if (r->turned) {
+	err = bitmap_transform(r->turned, bmp, TRANSFORM_ROTATE_90);
+	if (err > 0)
+	    return err;
+	bmp = r->turned;
+    }
+
+    err = display_put(r->display, bmp->buffer, bmp->length, displayed, NULL);
+    if (err > 0)
+	return err;
+
+    r->page->start = start;
+    r->page->end   = end;
+
+    /* Failing to save only costs the reader their place. */
+    if (state_save(r->path, snapshot(r)) > 0)
+	log_err("Failed to save reader state");
+
+    return OK;
+}
+
+/* Function: show_page()
+
+   Lay out the page starting at byte offset start, render it and send
+   it to the device. A non negative limit ends the page early, used
+   for the page preceding a reflow anchor.
+
+   The pipeline is restarted from the end of the page before it is
+   displayed, so the following pages are prepared during the
+   refresh. */
+int
+show_page(READER *r, long start, long limit)
+{
+    int err = page_at(&r->layout, r->book, start, limit, r->page);
+    if (err > 0)
+	return err;
+
+    if (r->page->end > r->page->start
+	&& pipeline_start(r->pipe, r->page->end, text->size,
+			  r->layout.margins) > 0)
+	log_err("Failed to start page pipeline");
+
+    err = raster_render(r->raster, r->page, text, r->bmp);
+    if (err > 0)
+	return err;
+
+    return present(r, r->bmp, r->page->start, r->page->end);
+}
+
+/* Function: turn_page()
+
+   Move forward or back one page. Moving back extends the pagination
+   index as far as the current page if it is not yet known. */
+int
+turn_page(READER *r, int forward)
+{
+    int err = OK;
+    members n = 0;
+    long start = 0;
+
+    if (forward) {
+	if (r->page->end <= r->page->start)
+	    return OK;
+
+	/* Take the page prepared by the pipeline, laying it out here
+	   only if the pipeline has stopped. */
+	FRAME *frame = NULL;
+	err = pipeline_next(r->pipe, &frame);
+	if (err == WARN_EOF)
+	    return OK;
+	if (err != OK || frame->start != r->page->end)
+	    return show_page(r, r->page->end, -1);
+
+	err = present(r, frame->bmp, frame->start, frame->end);
+	pipeline_release(r->pipe, frame);
+	return err;
+    }
+
+    err = pages_find(r->pages, &r->layout, r->book, r->page->start, &n);
+    if (err > 0 || n == 0)
+	return err;
+    err = pages_offset(r->pages, n - 1, &start);
+    if (err > 0)
+	return err;
+
+    return show_page(r, start, r->page->start);
+}
+
+/* Function: goto_offset()
+
+   Display the page containing byte offset, laying it out exactly as
+   it was indexed. */
+int
+goto_offset(READER *r, long offset)
+{
+    members n = 0;
+    long start = 0, limit = -1;
+
+    int err = pages_find(r->pages, &r->layout, r->book, offset, &n);
+    if (err > 0)
+	return err;
+    err = pages_offset(r->pages, n, &start);
+    if (err > 0)
+	return err;
+    if (pages_offset(r->pages, n + 1, &limit) > 0)
+	limit = -1;
+
+    return show_page(r, start, limit);
+}
+
+/* Function: find_text()
+
+   Read a phrase from stdin and jump to its next occurrence after the
+   current page, wrapping to the start of the book. The index is
+   built, or loaded, on the first search. */
+int
+find_text(READER *r)
+{
+    char query[QUERY_MAX];
+    long hit = 0;
+    int err = OK;
+
+    if (fgets(query, sizeof query, stdin) == NULL)
+	return OK;
+    query[strcspn(query, "\n")] = '\0';
+
+    if (r->search == NULL) {
+	err = search_open(r->path, r->book, &r->search);
+	if (err > 0)
+	    return err;
+
+	size_t bytes = search_size(r->search);
+	long book = r->search->book_size ? r->search->book_size : 1;
+	log_info("Search index %zu B (%.2f x book), built in %.3f s "
+		 "(%.3f s/MB)", bytes, (double)bytes / book,
+		 r->search->build_time,
+		 r->search->build_time / (book / 1048576.0));
+    }
+
+    err = search_find(r->search, r->book, query, r->page->end, &hit);
+    if (err == ERR_NOT_FOUND)
+	err = search_find(r->search, r->book, query, 0, &hit);
+    if (err == ERR_NOT_FOUND || err == ERR_INPUT) {
+	log_info("Not found: %s", query);
+	return OK;
+    }
+    if (err > 0)
+	return err;
+
+    return goto_offset(r, hit);
+}
+
+/* Function: reflow()
+
+   Apply new font size and margins. Only the current page is laid out
+   before it is displayed, the pagination index is invalidated and
+   rebuilt from the current page while the reader is idle. */
+int
+reflow(READER *r, unsigned size, MARGINS margins)
+{
+    if (size < 4 || margins.left + margins.right >= r->layout.width
+	|| margins.top + margins.bottom >= r->layout.height)
+	return OK;		/* Ignore unusable settings */
+
+    int err = text_set_size(text, size);
+    if (err > 0)
+	return err;
+
+    r->layout.margins = margins;
+
+    err = pages_reflow(r->pages, r->page->start);
+    if (err > 0)
+	return err;
+
+    return show_page(r, r->page->start, -1);
+}
+
+/* Function: orient()
+
+   Lay out pages of width x height pixels. When they are wider than
+   the device, landscape, pages are turned a quarter clockwise as they
+   are displayed. */
+void
+orient(READER *r, resolution width, resolution height)
+{
+    bitmap_destroy(r->bmp);
+    r->bmp = bitmap_create(width, height);
+
+    if (r->turned)
+	bitmap_destroy(r->turned);
+    r->turned = width == epd->width ? NULL
+	: bitmap_create(epd->width, epd->height);
+
+    r->layout.width  = width;
+    r->layout.height = height;
+
+    if (pipeline_resize(r->pipe, width, height) > 0)
+	log_err("Failed to resize page pipeline");
+
+    return;
+}
+
+/* Function: rotate()
+
+   Switch between portrait and landscape, reflowing the book from the
+   current page as for a change of font size. */
+int
+rotate(READER *r)
+{
+    MARGINS m = r->layout.margins;
+    resolution width  = r->layout.height;
+    resolution height = r->layout.width;
+
+    if (m.left + m.right >= width || m.top + m.bottom >= height)
+	return OK;		/* Margins leave no room */
+
+    orient(r, width, height);
+
+    int err = pages_reflow(r->pages, r->page->start);
+    if (err > 0)
+	return err;
+
+    return show_page(r, r->page->start, -1);
+}
+
+/* Function: next_profile()
+
+   Switch to the next full refresh waveform, taking effect from the
+   next full refresh. */
+int
+next_profile(READER *r)
+{
+    r->profile = (r->profile + 1) % (sizeof profiles / sizeof *profiles);
+    log_info("Waveform: %s", profiles[r->profile]);
+
+    display_lock(r->display);
+    int err = epd_set_profile(epd, profiles[r->profile]);
+    display_unlock(r->display);
+
+    return err;
+}
+
+/* Function: input_pending()
+
+   Returns non-zero if a command can be read from stdin without
+   blocking, waiting up to timeout (ms) for one to arrive. */
+int
+input_pending(long timeout)
+{
+    fd_set fds;
+    struct timeval now = { timeout / 1000, timeout % 1000 * 1000 };
+
+    FD_ZERO(&fds);
+    FD_SET(STDIN_FILENO, &fds);
+
+    return select(STDIN_FILENO + 1, &fds, NULL, NULL, &now) > 0;
+}
+
+/* Function: read_loop()
+
+   Reads single character commands from stdin until 'q' or EOF:
+
+   n - next page      p - previous page
+   + - larger font    - - smaller font
+   m - wider margins  M - narrower margins
+   r - rotate between portrait and landscape
+   w - next full refresh waveform
+   / - search for the phrase on the rest of the line
+
+   While no command is waiting the pagination index is extended. Once
+   the index is complete the display is put to sleep if no command
+   arrives for the idle time, the next page shown waking it.
+
+   Stdin is unbuffered so that select() sees every waiting command. */
+int
+read_loop(READER *r)
+{
+    int err = OK;
+    int index_done = 0;
+
+    setvbuf(stdin, NULL, _IONBF, 0);
+
+    for (;;) {
+	if (!index_done && !input_pending(0)) {
+	    err = pages_step(r->pages, &r->layout, r->book, INDEX_STEP);
+	    if (err > 0) return err;
+	    index_done = (err == WARN_EOF);
+	    continue;
+	}
+
+	if (index_done && r->idle && !r->asleep
+	    && !input_pending(r->idle * 1000L)) {
+	    display_lock(r->display);
+	    if (epd_sleep(epd) > 0)
+		log_err("Failed to put display to sleep");
+	    refresh_reset(r->refresh);
+	    display_unlock(r->display);
+	    r->asleep = 1;
+	    continue;
+	}
+
+	int c = getchar();
+	r->asleep = 0;
+	MARGINS m = r->layout.margins;
+
+	switch (c) {
+	case EOF:
+	case 'q': return OK;
+	case 'n': err = turn_page(r, 1); break;
+	case 'p': err = turn_page(r, 0); break;
+	case '/': err = find_text(r); break;
+	case 'r': err = rotate(r); break;
+	case 'w': err = next_profile(r); break;
+	case '+': err = reflow(r, text->size + 1, m); break;
+	case '-': err = reflow(r, text->size - 1, m); break;
+	case 'm':
+	    m.top += 2; m.right += 2; m.bottom += 2; m.left += 2;
+	    err = reflow(r, text->size, m);
+	    break;
+	case 'M':
+	    if (m.left < 2 || m.top < 2) break;
+	    m.top -= 2; m.right -= 2; m.bottom -= 2; m.left -= 2;
+	    err = reflow(r, text->size, m);
+	    break;
+	default:
+	    continue;
+	}
+	if (err > 0)
+	    return err;
+
+	/* Layout parameters may have changed. */
+	index_done = 0;
+    }
+}
+
 int
 cleanup(EPD *epd, BITMAP *bmp)
 {
@@ -104,26 +539,147 @@ void
 die(int err, char *errstr)
 {
     log_err("%s", errstr);
-    glyph_stop_renderer();
+    text_stop(text);
+    /* Held until exit, the display thread may be using the device. */
+    if (display)
+	display_lock(display);
     epd_off(epd);
     exit(err);
     return;
 }
 
+/* Function: show_image()
+
+   Display the image at path, fitted to the device and centred on a
+   white page. */
+int
+show_image(const char *path)
+{
+    BITMAP *img = NULL;
+
+    epd = epd_create();
+    int err = epd_on(epd);
+    if (err > 0)
+	die(err, "Failed to start device.");
+
+    BITMAP *bmp = bitmap_create(epd->width, epd->height);
+
+    err = image_decode(path, epd->width, epd->height, &img);
+    if (err > 0) {
+	log_err("Failed to decode image");
+	goto out;
+    }
+
+    err = bitmap_blit(bmp, img, (epd->width - img->width) / 2,
+		      (epd->height - img->length / img->pitch) / 2, BLIT_COPY);
+    if (err <= 0)
+	err = epd_display(epd, bmp->buffer, bmp->length);
+    bitmap_destroy(img);
+
+ out:
+    cleanup(epd, bmp);
+    return err;
+}
+
+/* Function: raster_threads()
+
+   One band per online core, up to RASTER_BANDS, for pages of at
+   least BAND_PIXELS. Smaller pages are drawn in one band: on the 2.9"
+   panel every extra band made a page slower, 38 us serial against
+   48-57 us, the cost of waking the workers outweighing the drawing
+   shared out.
+
+   RASTER_BANDS is one unless set with BANDS in the Makefile. On a
+   single core host, a 1404x1872 page in 2, 3 and 4 bands ran at
+   0.97x, 0.84x and 0.60x the speed of one band. Bands stay off by
+   default until make bench shows a gain on a multi-core board. */
+unsigned
+raster_threads(resolution width, resolution height)
+{
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    long most  = RASTER_BANDS < RASTER_THREADS ? RASTER_BANDS : RASTER_THREADS;
+
+    if (cores < 2 || most < 2
+	|| (unsigned long)width * height < BAND_PIXELS)
+	return 1;
+
+    return cores < most ? cores : most;
+}
+
+/* Function: batch()
+
+   Render every page to PBM, or four level PGM if gray is non-zero,
+   without starting the device, only its dimensions are used. Reports
+   throughput in pages per second.
+
+   argv - <threads> <output> <textfile> <fontsize> <fontpath> */
+int
+batch(char *argv[], int gray)
+{
+    EPD *dims = epd_create();
+    BATCH job = { .threads  = atoi(argv[0]),
+		  .output   = argv[1],
+		  .textpath = argv[2],
+		  .fontsize = atoi(argv[3]),
+		  .fontpath = argv[4],
+		  .width    = dims->width,
+		  .height   = dims->height,
+		  .margins  = { MARGIN, MARGIN, MARGIN, MARGIN },
+		  .gray     = gray };
+    epd_destroy(dims);
+
+    int err = batch_render(&job);
+    if (err > 0) {
+	log_err("Batch render failed");
+	return err;
+    }
+
+    log_info("%zu pages, %u threads, %.3f s, %.1f pages/s", job.pages,
+	     job.threads, job.seconds,
+	     job.seconds > 0 ? job.pages / job.seconds : 0.0);
+
+    return OK;
+}
+
 int main(int argc, char *argv[])
 {
     enum OKU_ERRNO err = OK;
 
     /**** PROCESS ARGUEMENTS ****/
 
+    if ( argc == 7 && strcmp(argv[1], "-b") == 0 )
+	return batch(argv + 2, 0);
+    if ( argc == 7 && strcmp(argv[1], "-g") == 0 )
+	return batch(argv + 2, 1);
+    if ( argc == 3 && strcmp(argv[1], "-i") == 0 )
+	return show_image(argv[2]);
+
     if ( argc < 4 ) {
-	printf("%s <textfile> <fontsize> <fontpath>\n", argv[0]);
+	printf("%s <textfile> <fontsize> <fontpath> [sleep_s]\n", argv[0]);
+	printf("%s -b|-g <threads> <outdir|-> <textfile> <fontsize> <fontpath>\n",
+	       argv[0]);
+	printf("%s -i <image.pbm|pgm|png>\n", argv[0]);
 	return ERR_INPUT;
     }
 
     char     *textpath = argv[1];
     unsigned  fontsize = atoi(argv[2]);
     char     *fontpath = argv[3];
+    MARGINS   margins  = { MARGIN, MARGIN, MARGIN, MARGIN };
+    long      start    = 0;
+
+    /* Resume from the last page displayed, with the same settings.
+       A font size given that differs from the saved one wins, the
+       saved pages are then discarded. */
+    STATE saved = { 0 };
+    int resumed = state_load(textpath, &saved) == OK;
+    int resized = 0;
+    if (resumed) {
+	resized  = fontsize != 0 && fontsize != saved.fontsize;
+	fontsize = resized ? fontsize : saved.fontsize;
+	margins  = saved.margins;
+	start    = saved.offset;
+    }
 
     /**** DEVICE INITIALISATION ****/
     epd = epd_create();
@@ -142,33 +698,100 @@ int main(int argc, char *argv[])
     /* 	die(err, "Failed to draw pattern"); */
 
     /**** TEXT PROCESSING ****/
-    err = glyph_start_renderer(fontpath, fontsize);
-    if (err > 0)
-	die(err, "Failed to display bitmap");
+    text = text_start(fontpath, fontsize);
+    if (text == NULL)
+	die(ERR_RENDER, "Failed to start renderer");
 
     FILE *utf8 = fopen(textpath, "r");
     if (utf8 == NULL)
-	die(err, "Failed to open textfile");
-    
-    codepoint cp = 0;
-    err = utf8_ftocp(utf8, &cp);
+	die(ERR_IO, "Failed to open textfile");
+
+    READER reader = {
+	.path   = textpath,
+	.book   = utf8,
+	.layout = { .text    = text,
+		    .width   = epd->width,
+		    .height  = epd->height,
+		    .margins = margins,
+		    .limit   = -1 },
+	.pages  = pages_create(),
+	.page   = oku_alloc(sizeof *reader.page),
+	.bmp    = bmp,
+	.pipe   = pipeline_create(textpath, fontpath, fontsize,
+				  epd->width, epd->height),
+	.raster = raster_create(fontpath, fontsize,
+				raster_threads(epd->width, epd->height)),
+	.refresh = refresh_create(epd, (POLICY){
+		.partials = FULL_PARTIALS,
+		.pixels   = (members)epd->width * epd->height,
+		.seconds  = FULL_SECONDS }),
+	.idle   = argc > 4 ? (unsigned)atoi(argv[4]) : IDLE_SLEEP
+    };
+    if (reader.pipe == NULL)
+	die(ERR_RENDER, "Failed to start page pipeline");
+    if (reader.raster == NULL)
+	die(ERR_RENDER, "Failed to start page rasteriser");
+    reader.display = display_create(reader.refresh, bmp->length);
+    if (reader.display == NULL)
+	die(ERR_RENDER, "Failed to start display thread");
+    display = reader.display;
+
+    /* Resume in landscape if that is how the book was left. */
+    if (resumed && saved.width != epd->width
+	&& saved.width == epd->height && saved.height == epd->width)
+	orient(&reader, saved.width, saved.height);
+
+    err = state_identify(textpath, &reader.state);
     if (err > 0)
 	die(err, "Failed to read textfile");
-    
-x    /**** DISPLAY AND SHUTDOWN ****/
-    err = epd_display(epd, bmp->buffer, bmp->length);
+
+    /* The pagination cache is only usable with the same layout,
+       otherwise it is rebuilt around the resumed page. */
+    reader.page->start = start;
+    int indexed = resumed && !resized
+	&& state_load_pages(textpath, snapshot(&reader), reader.pages) == OK;
+    if (!indexed)
+	pages_reflow(reader.pages, start);
+
+    /**** DISPLAY AND SHUTDOWN ****/
+    err = indexed ? goto_offset(&reader, start) : show_page(&reader, start, -1);
     if (err > 0)
 	die(err, "Failed to display bitmap");
 
-    /* Clean up */
-    err = cleanup(epd, bmp);
+    err = read_loop(&reader);
+    if (err > 0)
+	die(err, "Failed to display bitmap");
 
+    if (state_save_pages(textpath, snapshot(&reader), reader.pages) > 0)
+	log_err("Failed to save pagination index");
+
+    /* The last page turned is shown before the device is released. */
+    log_info("%lu pages queued, %lu replaced before shown",
+	     reader.display->queued, reader.display->replaced);
+    display_destroy(reader.display);
+    display = NULL;
+
+    REFRESH_STATS rs;
+    refresh_stats(reader.refresh, &rs, 0);
+    log_info("%lu full refreshes (%lu after %u partials, %lu pixels, "
+	     "%lu timed) %.1f s, %lu partial %.1f s, %lu unchanged",
+	     rs.full, rs.rule[RULE_PARTIALS], FULL_PARTIALS,
+	     rs.rule[RULE_PIXELS], rs.rule[RULE_SECONDS], rs.full_s,
+	     rs.partial, rs.partial_s, rs.unchanged);
+
+    /* Clean up */
+    raster_destroy(reader.raster);
+    pipeline_destroy(reader.pipe);
+    fclose(utf8);
+    oku_free(reader.page);
+    pages_destroy(reader.pages);
+    if (reader.search)
+	search_destroy(reader.search);
+    text_stop(text);
+    if (reader.turned)
+	bitmap_destroy(reader.turned);
+    err = cleanup(epd, reader.bmp);
+    refresh_destroy(reader.refresh);
 
     return err;
 }
-
-    /* Draw some features to the device bitmap */
-//    err = draw_lines(bmp) || draw_binary_pattern(bmp);
-//    if (err > 0)
-//	die(err, "Failed to write to bitmap");
-    
@@ -0,0 +1,351 @@
+/* batch.c
+ *
+ * This file is part of oku.
+ *
+ * Copyright (C) 2019 Ellis Rhys Thomas
+ *
+ * oku is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * oku is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+ * License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with oku.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS OR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/***************/
+/* Description */
+/***************/
+
+/* Headless multi-threaded page export, see batch.h. */
+
+#define _POSIX_C_SOURCE 200809L	/* clock_gettime() */
+
+#include <stdio.h>		/* FILE*, snprintf() */
+#include <string.h>		/* strcmp() */
+#include <time.h>		/* clock_gettime() */
+#include <pthread.h>
+
+#include "batch.h"
+#include "page.h"
+#include "text.h"
+#include "bitmap.h"
+#include "graymap.h"
+#include "pbm.h"
+#include "oku_mem.h"
+#include "oku_types.h"
+
+#define PATH_MAX_LEN 4096	/* Longest output file path */
+
+/* Object: POOL
+
+   State shared between workers. Everything but the counters is
+   read-only once the workers start. */
+typedef struct POOL {
+    BATCH          *job;
+    PAGES          *pages;	/* Complete pagination index */
+    members         count;	/* Number of pages */
+    const TEXT     *shared;	/* Warm glyph cache */
+    FILE           *stream;	/* Concatenated output, or NULL */
+    pthread_mutex_t lock;	/* Guards the fields below */
+    pthread_cond_t  turn;	/* Signalled when written advances */
+    members         next;	/* Next page to claim */
+    members         written;	/* Pages written to stream */
+    int             err;	/* First error from any worker */
+} POOL;
+
+/************************/
+/* Forward Declarations */
+/************************/
+
+static int paginate(BATCH *job, TEXT *text, PAGES *pages, members *count);
+static int warm_gray(TEXT *text);
+static void *worker(void *arg);
+static int render_pages(POOL *pool, TEXT *text, FILE *book,
+			LAYOUT *lo, PAGE *page, BITMAP *bmp, GRAYMAP *gm);
+static int write_page(POOL *pool, members n, BITMAP *bmp, GRAYMAP *gm);
+static int write_image(FILE *f, BITMAP *bmp, GRAYMAP *gm);
+static double elapsed(struct timespec *since);
+
+/************************/
+/* Interface Definition */
+/************************/
+
+/* Function: batch_render()
+
+   [1] Pagination is serial, laying out pages in order. It also warms
+       the glyph cache that is then shared with the workers. Layout
+       only renders monochrome glyphs, so for gray output their gray
+       images are rendered into the cache too.
+
+   [2] Workers claim page numbers in order until none remain. */
+int
+batch_render(BATCH *job)
+{
+    pthread_t tid[BATCH_THREADS_MAX];
+    unsigned started = 0;
+    int err = OK;
+
+    if (job->threads == 0 || job->threads > BATCH_THREADS_MAX)
+	return ERR_INPUT;
+
+    TEXT *shared = text_start((char *)job->fontpath, job->fontsize);
+    if (shared == NULL)
+	return ERR_RENDER;
+
+    POOL pool = { .job = job, .pages = pages_create(), .shared = shared };
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_cond_init(&pool.turn, NULL);
+
+    err = paginate(job, shared, pool.pages, &pool.count); /* [1] */
+    if (err == OK && job->gray)
+	err = warm_gray(shared);
+    if (err > 0)
+	goto out;
+
+    if (strcmp(job->output, "-") == 0)
+	pool.stream = stdout;
+
+    struct timespec t0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    for (; started < job->threads; ++started) /* [2] */
+	if (pthread_create(&tid[started], NULL, worker, &pool)) {
+	    pthread_mutex_lock(&pool.lock);
+	    pool.err = ERR_MEM;
+	    pool.next = pool.count;
+	    pthread_mutex_unlock(&pool.lock);
+	    break;
+	}
+
+    for (unsigned i = 0; i < started; ++i)
+	pthread_join(tid[i], NULL);
+
+    job->seconds = elapsed(&t0);
+    job->pages   = pool.written;
+    err          = pool.err;
+
+    if (err == OK && pool.stream && fflush(pool.stream))
+	err = ERR_IO;
+ out:
+    pthread_cond_destroy(&pool.turn);
+    pthread_mutex_destroy(&pool.lock);
+    pages_destroy(pool.pages);
+    text_stop(shared);
+    return err;
+}
+
+/********************/
+/* Static Functions */
+/********************/
+
+/* Static Function: paginate()
+
+   Build the complete pagination index for the book. */
+static int
+paginate(BATCH *job, TEXT *text, PAGES *pages, members *count)
+{
+    LAYOUT *lo = oku_alloc(sizeof *lo);
+    *lo = (LAYOUT){ .text = text, .width = job->width,
+		    .height = job->height, .margins = job->margins,
+		    .limit = -1 };
+    int err = OK;
+
+    FILE *book = fopen(job->textpath, "r");
+    if (book == NULL) {
+	err = ERR_IO;
+	goto out;
+    }
+
+    while ((err = pages_step(pages, lo, book, 64)) == OK)
+	;
+    if (err == WARN_EOF)
+	err = OK;
+
+    *count = pages->head.count + pages->tail.count;
+    fclose(book);
+ out:
+    oku_free(lo);
+    return err;
+}
+
+/* Static Function: warm_gray()
+
+   Render the gray image of every glyph held in the cache of text. */
+static int
+warm_gray(TEXT *text)
+{
+    GLYPH *g = NULL;
+    int err = OK;
+
+    for (members i = 0; i < GLYPH_CACHE_SIZE && err == OK; ++i)
+	if (text->db[i].cached)
+	    err = text_glyph_gray(text, text->db[i].unicode, &g);
+
+    return err;
+}
+
+/* Static Function: worker()
+
+   Thread entry point. Allocates per thread layout state, renders
+   pages until none remain, then releases it. */
+static void *
+worker(void *arg)
+{
+    POOL *pool = arg;
+    BATCH *job = pool->job;
+    int err = ERR_RENDER;
+
+    TEXT   *text = text_start((char *)job->fontpath, job->fontsize);
+    FILE   *book = fopen(job->textpath, "r");
+    LAYOUT *lo   = oku_alloc(sizeof *lo);
+    PAGE   *page = oku_alloc(sizeof *page);
+    BITMAP *bmp  = bitmap_create(job->width, job->height);
+    GRAYMAP *gm  = job->gray ? graymap_create(job->width, job->height)
+			     : NULL;
+
+    if (text && book && bmp && (gm || !job->gray)) {
+	text->shared = pool->shared;
+	*lo = (LAYOUT){ .text = text, .width = job->width,
+			.height = job->height, .margins = job->margins,
+			.limit = -1 };
+	err = render_pages(pool, text, book, lo, page, bmp, gm);
+    }
+
+    if (err > 0) {
+	pthread_mutex_lock(&pool->lock);
+	if (pool->err == OK)
+	    pool->err = err;
+	pool->next = pool->count; /* stop other workers */
+	pthread_cond_broadcast(&pool->turn);
+	pthread_mutex_unlock(&pool->lock);
+    }
+
+    if (gm)   graymap_destroy(gm);
+    if (bmp)  bitmap_destroy(bmp);
+    if (book) fclose(book);
+    if (text) text_stop(text);
+    oku_free(page);
+    oku_free(lo);
+
+    return NULL;
+}
+
+/* Static Function: render_pages()
+
+   Claim the next page, lay it out between its indexed start and the
+   start of the following page, render and write it. Pages are
+   rendered into gm if it is not NULL, otherwise bmp. */
+static int
+render_pages(POOL *pool, TEXT *text, FILE *book,
+	     LAYOUT *lo, PAGE *page, BITMAP *bmp, GRAYMAP *gm)
+{
+    for (;;) {
+	long start = 0, limit = -1;
+
+	pthread_mutex_lock(&pool->lock);
+	members n = pool->next < pool->count ? pool->next++ : pool->count;
+	pthread_mutex_unlock(&pool->lock);
+	if (n == pool->count)
+	    return OK;
+
+	int err = pages_offset(pool->pages, n, &start);
+	if (err > 0)
+	    return err;
+	if (pages_offset(pool->pages, n + 1, &limit) > 0)
+	    limit = -1;
+
+	err = page_at(lo, book, start, limit, page);
+	if (err > 0)
+	    return err;
+	err = gm ? page_render_gray(page, text, gm)
+	    : page_render(page, text, bmp);
+	if (err > 0)
+	    return err;
+	err = write_page(pool, n, bmp, gm);
+	if (err > 0)
+	    return err;
+    }
+}
+
+/* Static Function: write_page()
+
+   Writes page n to its own file in the output directory, or waits
+   for its turn to append it to the output stream so that pages are
+   concatenated in order. */
+static int
+write_page(POOL *pool, members n, BITMAP *bmp, GRAYMAP *gm)
+{
+    int err = OK;
+
+    if (pool->stream == NULL) {
+	char path[PATH_MAX_LEN];
+	snprintf(path, sizeof path, "%s/page-%05zu.%s", pool->job->output, n,
+		 gm ? "pgm" : "pbm");
+
+	FILE *f = fopen(path, "wb");
+	if (f == NULL)
+	    return ERR_IO;
+	err = write_image(f, bmp, gm);
+	if (fclose(f) && err == OK)
+	    err = ERR_IO;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->written++;
+	pthread_mutex_unlock(&pool->lock);
+	return err;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->written != n && pool->err == OK)
+	pthread_cond_wait(&pool->turn, &pool->lock);
+
+    if (pool->err == OK) {
+	err = write_image(pool->stream, bmp, gm);
+	pool->written++;
+	pthread_cond_broadcast(&pool->turn);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return err;
+}
+
+/* Static Function: write_image()
+
+   Write gm as PGM if it is not NULL, otherwise bmp as PBM. */
+static int
+write_image(FILE *f, BITMAP *bmp, GRAYMAP *gm)
+{
+    if (gm)
+	return pgm_write(f, gm);
+
+    return pbm_write(f, bmp->buffer, bmp->length, bmp->width,
+		     bmp->length / bmp->pitch);
+}
+
+/* Static Function: elapsed()
+
+   Seconds of monotonic time since the given time. */
+static double
+elapsed(struct timespec *since)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (now.tv_sec - since->tv_sec)
+	+ (now.tv_nsec - since->tv_nsec) / 1e9;
+}
@@ -0,0 +1,80 @@
+/* batch.h
+ *
+ * This file is part of oku.
+ *
+ * Copyright (C) 2019 Ellis Rhys Thomas
+ *
+ * oku is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * oku is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+ * License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with oku.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS OR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/***************/
+/* Description */
+/***************/
+
+/* Headless batch rendering of every page of a book to PBM images.
+
+   The book is paginated once, then a pool of worker threads renders
+   the pages. Each worker has its own FreeType face, layout state,
+   book handle and bitmap, and consults a glyph cache warmed during
+   pagination that is shared read-only between them. Pages are written
+   as one PBM file each, or concatenated in page order on a single
+   stream. Pages rendered in four levels of gray are written as PGM
+   instead. */
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "oku_types.h"
+#include "page.h"
+
+#define BATCH_THREADS_MAX 64	/* Largest worker pool */
+
+/***********/
+/* Objects */
+/***********/
+
+/* Object: BATCH
+
+   Parameters of a batch render and, on return, its results. */
+typedef struct BATCH {
+    /* Parameters */
+    const char *textpath;	/* UTF-8 book */
+    const char *fontpath;	/* Font file */
+    unsigned    fontsize;	/* Font size (px) */
+    resolution  width;		/* Page width (px) */
+    resolution  height;		/* Page height (px) */
+    MARGINS     margins;	/* Page margins (px) */
+    unsigned    threads;	/* Worker threads, at least one */
+    const char *output;		/* Directory, or "-" for stdout */
+    int         gray;		/* Non-zero for four level PGM pages */
+    /* Results */
+    members     pages;		/* Pages rendered */
+    double      seconds;	/* Wall time rendering pages */
+} BATCH;
+
+/* Function: batch_render()
+
+   Paginate and render every page of the book described by job. */
+int batch_render(BATCH *job);
+
+#endif	/* BATCH_H */
@@ -48,18 +48,66 @@
 
 */
 
+#include <stdint.h>		/* uint64_t */
+#include <string.h>		/* memcpy(), memset() */
+#include <pthread.h>		/* pthread_once() */
+
 #include "bitmap.h"
+#include "mempool.h"
 #include "oku_types.h"
 #include "oku_mem.h"
 
 /* Determine minimum bytes required to hold pixel width resolution
    provided by W. */
-#define PITCH(W) ((unsigned)(W % 8 ? (W / 8) + 1 : W / 8))
+#define PITCH(W) ((unsigned)((W) % 8 ? ((W) / 8) + 1 : (W) / 8))
+
+/* Space taken by the object ahead of its buffer, a whole number of
+   cache lines so the buffer is aligned as the block is. */
+#define BITMAP_HEADER \
+    ((sizeof(BITMAP) + MEMPOOL_ALIGN - 1) / MEMPOOL_ALIGN * MEMPOOL_ALIGN)
+
+/* Unit of work when copying rows, pixels are held most significant
+   bit first, as they are in the buffer. */
+typedef uint64_t blit_word;
+#define WORD_BYTES (sizeof(blit_word))
+#define WORD_BITS (8 * WORD_BYTES)
+
+/* Object: BLIT_PLAN
+
+   Per row constants of a blit. */
+typedef struct BLIT_PLAN {
+    int       shift;		/* Right shift of source pixels (-7-7) */
+    members   words;		/* Output words per row */
+    members   last_bytes;	/* Bytes written of last word */
+    blit_word first_mask;	/* Rectangle pixels in first word */
+    blit_word last_mask;	/* Rectangle pixels in last word */
+    int       narrow;		/* Non-zero to use blit_narrow() */
+    members   back;		/* Bytes narrow word starts before row */
+} BLIT_PLAN;
+
+/* Object: BLIT_ROWS
+
+   Position of a blit in both buffers. */
+typedef struct BLIT_ROWS {
+    byte       *dest;		/* Start of row in destination */
+    const byte *src;		/* Start of row in source */
+    members     avail;		/* Source bytes left from src */
+    members     dest_pitch;
+    members     src_pitch;
+    resolution  height;		/* Rows to combine */
+} BLIT_ROWS;
+
+/* Pool used by bitmap_create(), created once by shared_create(). */
+static MEMPOOL *shared_pool = NULL;
+static pthread_once_t shared_once = PTHREAD_ONCE_INIT;
 
 /************************/
 /* Forward Declarations */
 /************************/
 
+/* Allocation */
+static void shared_create(void);
+
 /* Pixel operations */
 static void px_toggle(byte *contains_px, byte bitmask);
 static void px_unset(byte *contains_px, byte bitmask);
@@ -74,8 +122,32 @@ static byte x_to_bitmask(coordinate x);
 static int check_coordinates(resolution width, resolution height,
 			     coordinate x, coordinate y);
 static int check_bitmap(BITMAP *bmp);
-static int check_bitmaps_fit(BITMAP *bmp, BITMAP *rectangle,
-			     coordinate x, coordinate y);
+static resolution clip_span(coordinate origin, resolution length,
+			    resolution limit);
+
+/* Word operations */
+static blit_word load_word(const byte *src, members bytes);
+static void store_word(byte *dest, blit_word w, members bytes);
+static BLIT_PLAN blit_plan(unsigned dest_bit, unsigned src_bit,
+			   resolution width, members col, members pitch);
+static inline void blit_rows(BLIT_ROWS r, BLIT_PLAN p, enum BLIT_OP op);
+static inline void blit_row(byte *dest, const byte *src, members avail,
+			    const BLIT_PLAN *p, enum BLIT_OP op);
+static inline void blit_narrow(byte *dest, const byte *src, members avail,
+			       const BLIT_PLAN *p, enum BLIT_OP op);
+static inline blit_word blit_op(blit_word d, blit_word w, enum BLIT_OP op);
+
+/* Transformations */
+static uint64_t transpose8(uint64_t m);
+static inline uint64_t gather8(const byte *in, long step);
+static inline void scatter8(byte *out, long step, uint64_t m);
+static void rotate_blocks(BITMAP *dest, BITMAP *src, int clockwise);
+static void rotate_strip(byte *out, long out_step, const byte *in,
+			 long in_step, unsigned count, resolution width);
+static void flip_rows(BITMAP *dest, BITMAP *src, int mirror, int invert);
+static void copy_row(byte *dest, const byte *src, members pitch);
+static void mirror_row(byte *dest, const byte *src, members pitch,
+		       unsigned pad);
 /************************/
 /* Interface Definition */
 /************************/
@@ -87,24 +159,49 @@ static int check_bitmaps_fit(BITMAP *bmp, BITMAP *rectangle,
    bmp. Returns handle to bitmap object, or NULL with invalid
    arguements. Exits on memory error.
 
+   The shared pool is created by the first call from any thread.
+
    width  - pixel resolution (count).
    height - pixel resolution (count). */
 BITMAP *
 bitmap_create(resolution width, resolution height)
 {
-    if (width == 0 || height == 0)
+    pthread_once(&shared_once, shared_create);
+    if (shared_pool == NULL)
 	return NULL;
 
-    BITMAP *bmp = oku_alloc(sizeof *bmp); /* exit on failure */
+    return bitmap_create_in(shared_pool, width, height);
+}
+
+/* Function: bitmap_create_in()
+
+   The object is placed at the start of a single block from pool,
+   followed by the buffer at the next cache line. Blocks are reused so
+   both are cleared here.
+
+   pool   - pool to allocate from.
+   width  - pixel resolution (count).
+   height - pixel resolution (count). */
+BITMAP *
+bitmap_create_in(MEMPOOL *pool, resolution width, resolution height)
+{
+    if (pool == NULL || width == 0 || height == 0)
+	return NULL;
 
     /* When the pixel count is not a factor of 8, a partially filled
        byte with 'don't care' bits is required. */
-    bmp->pitch  = PITCH(width);
-    bmp->length = bmp->pitch * height;
-    bmp->width  = width;
+    members pitch  = PITCH(width);
+    members length = pitch * height;
+
+    /* Allocate memory for object and buffer (exits on failure). */
+    BITMAP *bmp = mempool_alloc(pool, BITMAP_HEADER + length);
 
-    /* Allocate memory for bitmap buffer (exits on failure). */
-    bmp->buffer = oku_arrayalloc(bmp->length, sizeof bmp->length);
+    *bmp = (BITMAP){ .buffer = (byte *)bmp + BITMAP_HEADER,
+		     .length = length,
+		     .pitch  = pitch,
+		     .width  = width,
+		     .pool   = pool };
+    memset(bmp->buffer, 0x00, length);
 
     return bmp;
 }
@@ -130,6 +227,7 @@ bitmap_ft(members length, members pitch, resolution width,
     out->length = length;
     out->pitch  = pitch;
     out->width  = width;
+    out->pool   = NULL;
 
     return OK;
 }
@@ -191,59 +289,123 @@ bitmap_clear(BITMAP *bmp)
     return OK;
 }
 
-/* Function: bitmap_copy()
-
-   Copy rectangle into bitmap buffer. It is likely that the two
-   buffers are not byte aligned.
+/* Function: bitmap_blit()
 
-   The x and y coordinates are used to determine rectangle's target
-   origin within bmp. The bits in input rectangle are then correctly
-   aligned and copied into the bitmap in two operations as shown
-   below.
+   Combine rectangle into bmp with the raster operation op. It is
+   likely that the two buffers are not byte aligned.
 
-    [1] Correct misalignment in input byte. Wipe bits to be replaced
-	in output and combine with OR.
+   The origin (x,y) of rectangle within bmp may lie outside bmp,
+   rectangle is clipped to all four edges. A rectangle entirely
+   outside bmp changes nothing.
 
-    [2] Retreive bits from input byte previously ignored. Wipe bits to
-	be repaced in next output byte and combine with OR.
+   [1] Clipping the left or top edge skips leading columns or rows of
+       rectangle. Columns skipped are a bit offset into the source
+       rows as well as a byte offset.
 
-    [3] One full byte of input copied, increment appropriately.
+   [2] Rows are combined a word at a time, see blit_row(). Each
+       operation is given its own copy of the row loop, so the choice
+       of operation is not made again for every word.
 
-    [4] preserve horizontal alignment, when the end of one row reached
-	in rectangle, also move to new line in bitmap.
+   Bits of bmp outside the rectangle, including those beyond the end
+   of each row, are left untouched.
 
    Returns:
    0 Success.
-   1 Critical bitmap buffer error, errno set to ECANCELED.
-   2 At least one coordinate out of range, errno set to EINVAL. */
+   1 Critical bitmap buffer error, errno set to ECANCELED. */
 int
-bitmap_copy(BITMAP *bmp, BITMAP *rectangle, coordinate xmin, coordinate ymin)
+bitmap_blit(BITMAP *bmp, BITMAP *rectangle, int x, int y, enum BLIT_OP op)
 {
     int err = OK;
 
     /* Validate inputs */
     err = check_bitmap(bmp) || check_bitmap(rectangle);
     if (err > 0) goto out;
-    err = check_bitmaps_fit(bmp, rectangle, xmin, ymin);
+    if (op > BLIT_ANDNOT) {
+	err = ERR_INPUT;
+	goto out;
+    }
+
+    /* Clip to destination */
+    int sx = x < 0 ? -x : 0;	/* [1] */
+    int sy = y < 0 ? -y : 0;
+    if (sx >= rectangle->width || sy >= bitmap_height(rectangle))
+	goto out;
+
+    resolution width  = clip_span(x + sx, rectangle->width - sx,
+				  bmp->width);
+    resolution height = clip_span(y + sy, bitmap_height(rectangle) - sy,
+				  bitmap_height(bmp));
+    if (width == 0 || height == 0)
+	goto out;
+
+    const byte *in = rectangle->buffer + xy_to_index(rectangle->pitch, sx, sy);
+    byte *out = bmp->buffer + xy_to_index(bmp->pitch, x + sx, y + sy);
+    members avail = rectangle->length - (in - rectangle->buffer);
+
+    BLIT_PLAN plan = blit_plan((x + sx) % 8, sx % 8, width, (x + sx) / 8,
+			       bmp->pitch);
+    BLIT_ROWS rows = { out, in, avail, bmp->pitch, rectangle->pitch, height };
+
+    /* [2] */
+    switch (op) {
+    case BLIT_COPY:   blit_rows(rows, plan, BLIT_COPY);   break;
+    case BLIT_OR:     blit_rows(rows, plan, BLIT_OR);     break;
+    case BLIT_AND:    blit_rows(rows, plan, BLIT_AND);    break;
+    case BLIT_XOR:    blit_rows(rows, plan, BLIT_XOR);    break;
+    case BLIT_ANDNOT: blit_rows(rows, plan, BLIT_ANDNOT); break;
+    }
+
+ out:
+    return err;
+}
+
+/* Function: bitmap_copy()
+
+   Copy rectangle into bitmap buffer, replacing the pixels beneath
+   it. The rectangle is clipped to the right and bottom edges of
+   bmp. */
+int
+bitmap_copy(BITMAP *bmp, BITMAP *rectangle, coordinate xmin, coordinate ymin)
+{
+    return bitmap_blit(bmp, rectangle, xmin, ymin, BLIT_COPY);
+}
+
+/* Function: bitmap_transform()
+
+   Rotations by 90 and 270 degrees turn each 8x8 block of pixels, 8
+   rows of one source byte column, into 8 bytes of one destination
+   byte column. The block is gathered into a word and transposed in
+   registers, see transpose8(), rather than moving pixels one at a
+   time. Flips and rotation by 180 degrees move whole rows, reversing
+   the bits of each if mirrored.
+
+   Returns ERR_UNINITIALISED if either bitmap has no buffer, or
+   ERR_INPUT if dest is src or has the wrong dimensions. */
+int
+bitmap_transform(BITMAP *dest, BITMAP *src, enum TRANSFORM t)
+{
+    int err = check_bitmap(dest);
+    if (err == OK)
+	err = check_bitmap(src);
     if (err > 0) goto out;
 
-    /* Determine the start of input rectangle and its origin in
-       output. */
-    byte *in = rectangle->buffer;
-    byte *out = bmp->buffer + xy_to_index(bmp->pitch, xmin, ymin);
-
-    byte misalignment = xmin % 8;
-    members written = 0;	          /* Bytes from input written to output */
-
-    while ( written < rectangle->length ) {
-	/* [1] - See function comments for process logic. */
-	*out = (*in >> misalignment) |  (*out & ~(0xFF >> misalignment));
-	++out;			             /* [2] */
-	*out = (*in << (8 - misalignment)) | (*out & 0xFF >> misalignment);
-	++in;			             /* [3] */
-	++written;
-	if (written % rectangle->pitch == 0) /* [4] */
-	    out += bmp->pitch - rectangle->pitch;
+    resolution width  = src->width;
+    resolution height = bitmap_height(src);
+    int turn = (t == TRANSFORM_ROTATE_90 || t == TRANSFORM_ROTATE_270);
+
+    if (t > TRANSFORM_FLIP_V || dest->buffer == src->buffer
+	|| dest->width != (turn ? height : width)
+	|| bitmap_height(dest) != (turn ? width : height)) {
+	err = ERR_INPUT;
+	goto out;
+    }
+
+    switch (t) {
+    case TRANSFORM_ROTATE_90:  rotate_blocks(dest, src, 1);    break;
+    case TRANSFORM_ROTATE_270: rotate_blocks(dest, src, 0);    break;
+    case TRANSFORM_ROTATE_180: flip_rows(dest, src, 1, 1);     break;
+    case TRANSFORM_FLIP_H:     flip_rows(dest, src, 1, 0);     break;
+    case TRANSFORM_FLIP_V:     flip_rows(dest, src, 0, 1);     break;
     }
 
  out:
@@ -252,17 +414,17 @@ bitmap_copy(BITMAP *bmp, BITMAP *rectangle, coordinate xmin, coordinate ymin)
 
 /* Function: bitmap_destroy()
 
-   Frees all memory associated with bitmap object. */
+   Frees all memory associated with bitmap object. Bitmaps assigned
+   with bitmap_ft() own no memory and may not be destroyed. */
 int
 bitmap_destroy(BITMAP *bmp)
 {
     if (bmp == NULL)
 	goto fail;
-    if (bmp->buffer == NULL)
+    if (bmp->buffer == NULL || bmp->pool == NULL)
 	goto fail;
 
-    oku_free(bmp->buffer);
-    oku_free(bmp);
+    mempool_free(bmp->pool, bmp, BITMAP_HEADER + bmp->length);
 
     return OK;
  fail:
@@ -273,6 +435,18 @@ bitmap_destroy(BITMAP *bmp)
 /* Static Functions */
 /********************/
 
+/* Static Function: shared_create()
+
+   Create the pool shared by all bitmaps made with bitmap_create(). It
+   lives for the life of the process. */
+static void
+shared_create(void)
+{
+    shared_pool = mempool_create(0);
+
+    return;
+}
+
 /* Static Function: bitmap_length()
 
    Returns the resolution of the bitmap in pixels.
@@ -311,7 +485,7 @@ px_toggle(byte *contains_px, byte bitmask)
 static void
 px_unset(byte *contains_px, byte bitmask)
 {
-    *contains_px &= !bitmask;
+    *contains_px &= ~bitmask;
     return;
 }
 
@@ -390,16 +564,431 @@ check_bitmap(BITMAP *bmp)
 	? ERR_UNINITIALISED : OK;
 }
 
-/* Static function: check_bitmaps_fit()
+/* Static function: clip_span()
 
-   Check that rectangle fits inside bmp considering the origin of
-   rectangle is the coordinates (x,y) within bmp. */
-static int
-check_bitmaps_fit(BITMAP *bmp, BITMAP *rectangle,
-		  coordinate x, coordinate y)
+   Returns the number of pixels of a span of length starting at origin
+   that lie before limit. */
+static resolution
+clip_span(coordinate origin, resolution length, resolution limit)
+{
+    if (origin >= limit)
+	return 0;
+
+    return length < limit - origin ? length : limit - origin;
+}
+
+/* Static Function: load_word()
+
+   Read up to one word of pixels from src, the first byte in the most
+   significant position. Missing trailing bytes are read as zero. A
+   whole word is a single unaligned load, partial words at the edge of
+   a row are assembled a byte at a time. */
+static blit_word
+load_word(const byte *src, members bytes)
+{
+    blit_word w = 0;
+
+    if (bytes == WORD_BYTES) {
+	memcpy(&w, src, WORD_BYTES);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	w = __builtin_bswap64(w);
+#endif
+	return w;
+    }
+
+    for (members i = 0; i < bytes; ++i)
+	w |= (blit_word)src[i] << (WORD_BITS - 8 * (i + 1));
+
+    return w;
+}
+
+/* Static Function: store_word()
+
+   Write the leading bytes of w to dest, the inverse of load_word(). */
+static void
+store_word(byte *dest, blit_word w, members bytes)
+{
+    if (bytes == WORD_BYTES) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	w = __builtin_bswap64(w);
+#endif
+	memcpy(dest, &w, WORD_BYTES);
+	return;
+    }
+
+    for (members i = 0; i < bytes; ++i)
+	dest[i] = w >> (WORD_BITS - 8 * (i + 1));
+
+    return;
+}
+
+/* Static Function: blit_plan()
+
+   Work out the word count and edge masks of a row operation once,
+   they are the same for every row of the rectangle. Pixels start
+   dest_bit bits into the first destination byte and src_bit bits into
+   the first source byte.
+
+   [1] Only the first and last output words are partially covered by
+       the rectangle.
+
+   [2] Bytes in the last word past the rectangle are never written,
+       they may belong to a row being drawn by another thread.
+
+   [3] Rows of at most one word in both buffers, such as those of
+       glyphs, are combined by blit_narrow() if the destination row,
+       col bytes in and pitch bytes long, holds a whole word around
+       them. */
+static BLIT_PLAN
+blit_plan(unsigned dest_bit, unsigned src_bit, resolution width,
+	  members col, members pitch)
+{
+    BLIT_PLAN p = { .shift = (int)dest_bit - (int)src_bit };
+    members dest_bytes = PITCH(dest_bit + width);
+
+    p.words = (dest_bytes + WORD_BYTES - 1) / WORD_BYTES;
+    p.first_mask = ~(blit_word)0 >> dest_bit; /* [1] */
+    p.last_mask  = ~(blit_word)0;
+
+    unsigned end = (dest_bit + width) % WORD_BITS;
+    if (end)
+	p.last_mask = ~(~(blit_word)0 >> end);
+    if (p.words == 1)
+	p.first_mask &= p.last_mask;
+
+    p.last_bytes = dest_bytes - (p.words - 1) * WORD_BYTES; /* [2] */
+
+    /* [3] */
+    p.narrow = p.words == 1 && pitch >= WORD_BYTES
+	&& PITCH(src_bit + width) <= WORD_BYTES;
+    if (p.narrow) {
+	p.back = col + WORD_BYTES > pitch ? col + WORD_BYTES - pitch : 0;
+	p.first_mask >>= 8 * p.back;
+    }
+
+    return p;
+}
+
+/* Static Function: blit_rows()
+
+   Combine each row of a blit using raster operation op. Inlined with
+   a constant op, see bitmap_blit(). */
+static inline __attribute__((always_inline)) void
+blit_rows(BLIT_ROWS r, BLIT_PLAN p, enum BLIT_OP op)
 {
-    return x + rectangle->width         > bmp->width
-	|| y + bitmap_height(rectangle) > bitmap_height(bmp)
-	? ERR_INPUT : OK;
+    for (resolution row = 0; row < r.height; ++row) {
+	if (p.narrow)
+	    blit_narrow(r.dest, r.src, r.avail, &p, op);
+	else
+	    blit_row(r.dest, r.src, r.avail, &p, op);
+	r.dest  += r.dest_pitch;
+	r.src   += r.src_pitch;
+	r.avail -= r.src_pitch;
+    }
+
+    return;
 }
 
+/* Static Function: blit_row()
+
+   Combine one row of pixels from src into the row dest as planned by
+   blit_plan().
+
+   [1] Equally aligned rows need no shifting.
+
+   [2] Source pixels start earlier in their byte than the destination
+       pixels. Word i of the output is the tail of source word i-1 and
+       the head of source word i, shifted right.
+
+   [3] Source pixels start later, after left clipping. Word i of the
+       output is the tail of source word i and the head of source word
+       i+1, shifted left. The word read ahead is kept for the next
+       iteration.
+
+   Whole words are read while avail, the bytes left in the source
+   buffer, allows, pixels beyond the row are masked off.
+
+   [4] A full word copy need not read the destination. */
+static inline __attribute__((always_inline)) void
+blit_row(byte *dest, const byte *src, members avail, const BLIT_PLAN *p,
+	 enum BLIT_OP op)
+{
+    blit_word carry = 0;
+    blit_word next = 0;
+    unsigned left = p->shift < 0 ? -p->shift : 0;
+
+    if (left)
+	next = load_word(src, avail < WORD_BYTES ? avail : WORD_BYTES);
+
+    for (members i = 0; i < p->words; ++i) {
+	members off = i * WORD_BYTES;
+	members ahead = off + (left ? WORD_BYTES : 0);
+	members have = ahead < avail ? avail - ahead : 0;
+	blit_word in = load_word(src + ahead,
+				 have < WORD_BYTES ? have : WORD_BYTES);
+	blit_word w = in;	/* [1] */
+
+	if (p->shift > 0) {	/* [2] */
+	    w = (in >> p->shift) | carry;
+	    carry = in << (WORD_BITS - p->shift);
+	} else if (left) {	/* [3] */
+	    w = (next << left) | (in >> (WORD_BITS - left));
+	    next = in;
+	}
+
+	blit_word mask = i == 0 ? p->first_mask
+	    : i == p->words - 1 ? p->last_mask : ~(blit_word)0;
+	members n = i == p->words - 1 ? p->last_bytes : WORD_BYTES;
+
+	if (op == BLIT_COPY && mask == ~(blit_word)0) { /* [4] */
+	    store_word(dest + off, w, n);
+	    continue;
+	}
+
+	blit_word d = load_word(dest + off, n);
+	w = blit_op(d, w, op);
+	store_word(dest + off, (w & mask) | (d & ~mask), n);
+    }
+
+    return;
+}
+
+/* Static Function: blit_narrow()
+
+   Combine a row of at most one word from src into dest as planned by
+   blit_plan(), with a single load and store of the destination.
+
+   [1] The word read and written starts back bytes before dest, if
+       need be, so that it does not run past the end of the
+       destination row. Destination bytes in the word outside the
+       rectangle are written back unchanged, they lie in the same row,
+       which no other thread draws.
+
+   [2] The source row fits in one word, so no pixels are carried from
+       a neighbouring word. */
+static inline __attribute__((always_inline)) void
+blit_narrow(byte *dest, const byte *src, members avail, const BLIT_PLAN *p,
+	    enum BLIT_OP op)
+{
+    byte *at = dest - p->back;	/* [1] */
+    blit_word in = load_word(src, avail < WORD_BYTES ? avail : WORD_BYTES);
+    blit_word w = p->shift >= 0 ? in >> p->shift : in << -p->shift; /* [2] */
+    blit_word d = load_word(at, WORD_BYTES);
+
+    w = blit_op(d, w >> 8 * p->back, op);
+    store_word(at, (w & p->first_mask) | (d & ~p->first_mask), WORD_BYTES);
+
+    return;
+}
+
+/* Static Function: blit_op()
+
+   Combine destination word d with source word w using op. */
+static inline __attribute__((always_inline)) blit_word
+blit_op(blit_word d, blit_word w, enum BLIT_OP op)
+{
+    switch (op) {
+    case BLIT_COPY:   break;
+    case BLIT_OR:     w = d | w;  break;
+    case BLIT_AND:    w = d & w;  break;
+    case BLIT_XOR:    w = d ^ w;  break;
+    case BLIT_ANDNOT: w = d & ~w; break;
+    }
+
+    return w;
+}
+
+/* Static Function: transpose8()
+
+   Transpose the 8x8 bit matrix held in m, one row per byte with the
+   first row in the most significant byte and the first column in the
+   most significant bit of each row. Bits either side of the diagonal
+   are exchanged in 2x2, then 4x4, then 8x8 blocks (Hacker's Delight,
+   7-3). */
+static uint64_t
+transpose8(uint64_t m)
+{
+    uint64_t t;
+
+    t = (m ^ (m >> 7))  & 0x00AA00AA00AA00AAULL;
+    m ^= t ^ (t << 7);
+    t = (m ^ (m >> 14)) & 0x0000CCCC0000CCCCULL;
+    m ^= t ^ (t << 14);
+    t = (m ^ (m >> 28)) & 0x00000000F0F0F0F0ULL;
+    m ^= t ^ (t << 28);
+
+    return m;
+}
+
+/* Static Function: gather8()
+
+   Returns the 8 bytes each step bytes apart from in, the first in the
+   most significant byte. */
+static inline uint64_t
+gather8(const byte *in, long step)
+{
+    return (uint64_t)in[0]        << 56 | (uint64_t)in[step]     << 48
+	 | (uint64_t)in[2 * step] << 40 | (uint64_t)in[3 * step] << 32
+	 | (uint64_t)in[4 * step] << 24 | (uint64_t)in[5 * step] << 16
+	 | (uint64_t)in[6 * step] << 8  | (uint64_t)in[7 * step];
+}
+
+/* Static Function: scatter8()
+
+   Store the bytes of m each step bytes apart from out, the most
+   significant first. */
+static inline void
+scatter8(byte *out, long step, uint64_t m)
+{
+    out[0]        = m >> 56;
+    out[step]     = m >> 48;
+    out[2 * step] = m >> 40;
+    out[3 * step] = m >> 32;
+    out[4 * step] = m >> 24;
+    out[5 * step] = m >> 16;
+    out[6 * step] = m >> 8;
+    out[7 * step] = m;
+
+    return;
+}
+
+/* Static Function: rotate_blocks()
+
+   Rotate src by 90 degrees into dest, clockwise or anticlockwise.
+
+   [1] Destination byte column j holds a strip of 8 source rows.
+       Rotating clockwise the rows are taken bottom up, so the first
+       pixel of the column is the last row. Either way any rows
+       missing from the final strip are the last in it, they become
+       the don't care bits at the end of each destination row.
+
+   [2] Source columns are written down the destination column when
+       rotating clockwise, up it from the bottom otherwise. */
+static void
+rotate_blocks(BITMAP *dest, BITMAP *src, int clockwise)
+{
+    resolution height = bitmap_height(src);
+    long src_step  = clockwise ? -(long)src->pitch : (long)src->pitch;
+    long dest_step = clockwise ? (long)dest->pitch : -(long)dest->pitch;
+    byte *out = dest->buffer;
+
+    if (!clockwise)		/* [2] */
+	out += (src->width - 1) * dest->pitch;
+
+    for (members j = 0; j < PITCH(height); ++j) {
+	unsigned count = height - 8 * j < 8 ? height - 8 * j : 8; /* [1] */
+	members y = clockwise ? height - 1 - 8 * j : 8 * j;
+	const byte *in = src->buffer + y * src->pitch;
+	rotate_strip(out + j, dest_step, in, src_step, count, src->width);
+    }
+
+    return;
+}
+
+/* Static Function: rotate_strip()
+
+   Rotate count rows of width pixels, the first at in and each
+   following row in_step bytes on, into a destination byte column
+   whose bytes are out_step apart. The strip is taken an 8x8 block at
+   a time, whole blocks being moved without any per byte tests.
+
+   [1] After transposing, each byte of the block is one source column
+       and so one destination row. Columns in the don't care bits of
+       the source are dropped. */
+static void
+rotate_strip(byte *out, long out_step, const byte *in, long in_step,
+	     unsigned count, resolution width)
+{
+    members whole = count == 8 ? width / 8 : 0;
+
+    for (members bx = 0; bx < whole; ++bx) {
+	scatter8(out, out_step, transpose8(gather8(in + bx, in_step)));
+	out += 8 * out_step;
+    }
+
+    for (members bx = whole; bx < PITCH(width); ++bx) {
+	uint64_t m = 0;
+	for (unsigned k = 0; k < 8; ++k)
+	    m = m << 8 | (k < count ? in[k * in_step + bx] : 0);
+
+	m = transpose8(m);
+
+	unsigned columns = width - 8 * bx < 8 ? width - 8 * bx : 8; /* [1] */
+	for (unsigned i = 0; i < columns; ++i)
+	    out[i * out_step] = m >> (56 - 8 * i);
+	out += columns * out_step;
+    }
+
+    return;
+}
+
+/* Static Function: flip_rows()
+
+   Copy each row of src into dest, mirroring the row left to right
+   and/or inverting the order of the rows. */
+static void
+flip_rows(BITMAP *dest, BITMAP *src, int mirror, int invert)
+{
+    resolution height = bitmap_height(src);
+    members pitch = PITCH(src->width);
+    unsigned pad = 8 * pitch - src->width;
+
+    for (resolution y = 0; y < height; ++y) {
+	const byte *in = src->buffer + y * src->pitch;
+	byte *out = dest->buffer + (invert ? height - 1 - y : y) * dest->pitch;
+	if (mirror)
+	    mirror_row(out, in, pitch, pad);
+	else
+	    copy_row(out, in, pitch);
+    }
+
+    return;
+}
+
+/* Static Function: copy_row()
+
+   Copy a row a word at a time. Rows are too short for memcpy() of a
+   variable length to be worth calling. */
+static void
+copy_row(byte *dest, const byte *src, members pitch)
+{
+    members i = 0;
+
+    for (; i + WORD_BYTES <= pitch; i += WORD_BYTES)
+	memcpy(dest + i, src + i, WORD_BYTES);
+    for (; i < pitch; ++i)
+	dest[i] = src[i];
+
+    return;
+}
+
+/* Static Function: mirror_row()
+
+   Write the pixels of a row of pitch bytes into dest in reverse
+   order. Reversing the bytes and the bits within them would place
+   the pad don't care bits first, so the reversed row is shifted left
+   by pad bits as it is written.
+
+   [1] Table of every byte with its bits reversed, each level of
+       macro reverses one pair of bits. */
+static void
+mirror_row(byte *dest, const byte *src, members pitch, unsigned pad)
+{
+#define R2(n) n, n + 2 * 64, n + 1 * 64, n + 3 * 64
+#define R4(n) R2(n), R2(n + 2 * 16), R2(n + 1 * 16), R2(n + 3 * 16)
+#define R6(n) R4(n), R4(n + 2 * 4), R4(n + 1 * 4), R4(n + 3 * 4)
+    static const byte reversed[256] = { R6(0), R6(2), R6(1), R6(3) }; /* [1] */
+#undef R6
+#undef R4
+#undef R2
+
+    unsigned pair = reversed[src[pitch - 1]];
+    for (members j = 0; j < pitch; ++j) {
+	pair <<= 8;
+	if (j + 1 < pitch)
+	    pair |= reversed[src[pitch - 2 - j]];
+	dest[j] = pair >> (8 - pad);
+    }
+
+    return;
+}
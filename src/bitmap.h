@@ -65,10 +65,31 @@ typedef struct BITMAP {
     members length;		/* Length of buffer (1D) in bytes */
     members pitch;		/* Number of bytes in the width */
     resolution width;		/* Pixel count in one row */
+    struct MEMPOOL *pool;		/* Pool holding bitmap, NULL if assigned */
 } BITMAP;
 
 enum SET_PIXEL_MODE { SET_PIXEL_BLACK, SET_PIXEL_WHITE, SET_PIXEL_TOGGLE };
 
+/* Raster operations combining a source rectangle (S) with the
+   destination (D), black pixels are 1:
+
+   BLIT_COPY   - D = S      replace
+   BLIT_OR     - D = D | S  draw black pixels of S, e.g. text
+   BLIT_AND    - D = D & S  mask D with S
+   BLIT_XOR    - D = D ^ S  invert D beneath black pixels of S
+   BLIT_ANDNOT - D = D & ~S erase D beneath black pixels of S */
+enum BLIT_OP { BLIT_COPY, BLIT_OR, BLIT_AND, BLIT_XOR, BLIT_ANDNOT };
+
+/* Whole bitmap transformations, rotations are clockwise:
+
+   TRANSFORM_ROTATE_90  - top row becomes the right hand column
+   TRANSFORM_ROTATE_180 - upside down
+   TRANSFORM_ROTATE_270 - top row becomes the left hand column
+   TRANSFORM_FLIP_H     - mirrored left to right
+   TRANSFORM_FLIP_V     - mirrored top to bottom */
+enum TRANSFORM { TRANSFORM_ROTATE_90, TRANSFORM_ROTATE_180,
+		 TRANSFORM_ROTATE_270, TRANSFORM_FLIP_H, TRANSFORM_FLIP_V };
+
 /**************************/
 /* Interface Deceleration */
 /**************************/
@@ -76,9 +97,16 @@ enum SET_PIXEL_MODE { SET_PIXEL_BLACK, SET_PIXEL_WHITE, SET_PIXEL_TOGGLE };
 /* Function: bitmap_create()
 
    Initialise bitmap object using electronic paper device
-   dimensions. Allocating memory for object and buffer. */
+   dimensions. The object and its buffer are allocated as one block
+   from a pool shared by all threads. */
 BITMAP *bitmap_create(resolution width, resolution height);
 
+/* Function: bitmap_create_in()
+
+   As bitmap_create(), allocating from pool. */
+BITMAP *bitmap_create_in(struct MEMPOOL *pool, resolution width,
+			 resolution height);
+
 /* Function: bitmap_assign()
 
    Define a bitmap structure from existing values. Memory cotrolled by
@@ -98,15 +126,32 @@ int bitmap_modify_px(BITMAP *bmp, coordinate x, coordinate y,
    Clear the bitmap by setting each pixel to white. */
 int bitmap_clear(BITMAP *bmp);
 
+/* Function: bitmap_blit()
+
+   Combine rectangle into bmp at (x,y) using the raster operation
+   op. The origin may lie outside bmp, the rectangle is clipped to its
+   edges. */
+int bitmap_blit(BITMAP *bmp, BITMAP *rectangle, int x, int y,
+		enum BLIT_OP op);
+
 /* Function: bitmap_copy()
 
-   Copy rectangle into bitmap buffer. */
+   Copy rectangle into bitmap buffer, clipped to its edges. */
 int bitmap_copy(BITMAP *bmp, BITMAP *rectangle,
 		coordinate xmin, coordinate ymin);
 
+/* Function: bitmap_transform()
+
+   Write src rotated or flipped by t into dest, which must be a
+   separate bitmap. Rotating by 90 or 270 degrees exchanges the width
+   and height, dest must be created with them exchanged. Returns
+   ERR_INPUT if dest is the wrong size. */
+int bitmap_transform(BITMAP *dest, BITMAP *src, enum TRANSFORM t);
+
 /* Function: bitmap_destroy()
 
-   Free all memory allocated for bitmap_destroy. */
+   Free all memory allocated for bitmap_destroy, returning it to the
+   pool it came from. */
 int bitmap_destroy(BITMAP *bmp);
 
 #endif	/* BITMAP_H */
@@ -0,0 +1,215 @@
+/* diff.c
+ *
+ * This file is part of oku.
+ *
+ * Copyright (C) 2019 Ellis Rhys Thomas
+ *
+ * oku is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * oku is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+ * License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with oku.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS OR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/***************/
+/* Description */
+/***************/
+
+/* Frame difference, see diff.h. */
+
+#include <stdint.h>		/* uint64_t */
+#include <string.h>		/* memcpy() */
+
+#ifdef __SSE2__
+#include <emmintrin.h>		/* _mm_cmpeq_epi8() etc. */
+#endif
+
+#include "diff.h"
+#include "oku_mem.h"
+#include "oku_types.h"
+
+/************************/
+/* Forward Declarations */
+/************************/
+
+static void diff_row(const byte *a, const byte *b, members len,
+		     DIFF_ROW *row);
+static int first_set_byte(uint64_t x);
+static int last_set_byte(uint64_t x);
+
+/************************/
+/* Interface Definition */
+/************************/
+
+/* Function: diff_create()
+
+   The per row results are allocated with the DIFF. */
+DIFF *
+diff_create(members pitch, resolution height)
+{
+    DIFF *diff = oku_alloc(sizeof *diff); /* exits on failure */
+
+    diff->pitch  = pitch;
+    diff->height = height;
+    diff->row    = oku_arrayalloc(height, sizeof *diff->row);
+
+    return diff;
+}
+
+/* Function: diff_frames()
+
+   Each row is compared in turn, the bounding box grows to cover
+   every changed row. */
+int
+diff_frames(DIFF *diff, const byte *prev, const byte *next)
+{
+    if (diff == NULL || prev == NULL || next == NULL)
+	return ERR_UNINITIALISED;
+
+    diff->rows       = 0;
+    diff->first_row  = diff->height;
+    diff->last_row   = 0;
+    diff->first_byte = diff->pitch;
+    diff->last_byte  = 0;
+
+    for (resolution y = 0; y < diff->height; ++y) {
+	DIFF_ROW *r = &diff->row[y];
+	members offset = (members)y * diff->pitch;
+
+	diff_row(prev + offset, next + offset, diff->pitch, r);
+	if (r->first > r->last)
+	    continue;
+
+	if (diff->rows++ == 0)
+	    diff->first_row = y;
+	diff->last_row = y;
+	if (r->first < diff->first_byte)
+	    diff->first_byte = r->first;
+	if (r->last > diff->last_byte)
+	    diff->last_byte = r->last;
+    }
+
+    diff->identical = diff->rows == 0;
+
+    return OK;
+}
+
+/* Function: diff_destroy()
+
+   Frees the per row results and the DIFF. */
+int
+diff_destroy(DIFF *diff)
+{
+    if (diff == NULL)
+	return ERR_UNINITIALISED;
+
+    oku_free(diff->row);
+    oku_free(diff);
+
+    return OK;
+}
+
+/********************/
+/* Static Functions */
+/********************/
+
+/* Static Function: diff_row()
+
+   Find the first and last differing bytes of two rows of len bytes.
+
+   [1] SSE2: a byte comparison of 16 bytes gives a 16 bit mask of
+       equal bytes, the lowest clear bit is the first differing byte
+       and the highest the last.
+
+   [2] Otherwise 8 bytes are XORed at a time, bytes of the result
+       that are non-zero differ.
+
+   [3] Remaining bytes are compared one at a time. */
+static void
+diff_row(const byte *a, const byte *b, members len, DIFF_ROW *row)
+{
+    members i = 0;
+
+    row->first = 1;
+    row->last  = 0;
+
+#ifdef __SSE2__
+    for (; i + 16 <= len; i += 16) { /* [1] */
+	__m128i x = _mm_loadu_si128((const __m128i *)(a + i));
+	__m128i y = _mm_loadu_si128((const __m128i *)(b + i));
+	unsigned differ = ~_mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) & 0xFFFF;
+
+	if (differ == 0)
+	    continue;
+	if (row->first > row->last)
+	    row->first = i + __builtin_ctz(differ);
+	row->last = i + 31 - __builtin_clz(differ);
+    }
+#endif
+
+    for (; i + 8 <= len; i += 8) { /* [2] */
+	uint64_t x, y;
+	memcpy(&x, a + i, 8);
+	memcpy(&y, b + i, 8);
+
+	uint64_t differ = x ^ y;
+	if (differ == 0)
+	    continue;
+	if (row->first > row->last)
+	    row->first = i + first_set_byte(differ);
+	row->last = i + last_set_byte(differ);
+    }
+
+    for (; i < len; ++i) {	/* [3] */
+	if (a[i] == b[i])
+	    continue;
+	if (row->first > row->last)
+	    row->first = i;
+	row->last = i;
+    }
+
+    return;
+}
+
+/* Static Function: first_set_byte()
+
+   Index in memory order of the first non-zero byte of x, which must
+   be non-zero and have been loaded from memory with memcpy(). */
+static int
+first_set_byte(uint64_t x)
+{
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    return __builtin_ctzll(x) / 8;
+#else
+    return __builtin_clzll(x) / 8;
+#endif
+}
+
+/* Static Function: last_set_byte()
+
+   Index in memory order of the last non-zero byte of x. */
+static int
+last_set_byte(uint64_t x)
+{
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    return 7 - __builtin_clzll(x) / 8;
+#else
+    return 7 - __builtin_ctzll(x) / 8;
+#endif
+}
@@ -0,0 +1,99 @@
+/* diff.h
+ *
+ * This file is part of oku.
+ *
+ * Copyright (C) 2019 Ellis Rhys Thomas
+ *
+ * oku is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * oku is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+ * License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with oku.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS OR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/***************/
+/* Description */
+/***************/
+
+/* Frame difference.
+
+   Compares the frame about to be displayed with the last frame
+   displayed, both in the packed layout described in bitmap.h, and
+   finds which rows changed and which bytes of each row. A display
+   driver uses this to send only changed rows to the device, or to
+   skip a refresh entirely when nothing changed.
+
+   Rows are compared 16 bytes at a time with SSE2 where available,
+   otherwise 8 bytes at a time in general purpose registers. */
+
+#ifndef DIFF_H
+#define DIFF_H
+
+#include "oku_types.h"
+
+/***********/
+/* Objects */
+/***********/
+
+/* Object: DIFF_ROW
+
+   Changed bytes of one row, first > last if the row is unchanged. */
+typedef struct DIFF_ROW {
+    members first;		/* First changed byte */
+    members last;		/* Last changed byte */
+} DIFF_ROW;
+
+/* Object: DIFF
+
+   Result of comparing two frames. Row and byte ranges are inclusive
+   and only meaningful when the frames are not identical. */
+typedef struct DIFF {
+    members    pitch;		/* Bytes in a row */
+    resolution height;		/* Rows in a frame */
+    int        identical;	/* Non-zero if nothing changed */
+    members    rows;		/* Count of changed rows */
+    resolution first_row;	/* Bounding box of changes */
+    resolution last_row;
+    members    first_byte;
+    members    last_byte;
+    DIFF_ROW  *row;		/* Changes in each row */
+} DIFF;
+
+/**************************/
+/* Interface Deceleration */
+/**************************/
+
+/* Function: diff_create()
+
+   Allocate a DIFF for frames of height rows of pitch bytes. Exits on
+   memory error. */
+DIFF *diff_create(members pitch, resolution height);
+
+/* Function: diff_frames()
+
+   Compare frame next with the previously displayed frame prev,
+   storing the changes in diff. */
+int diff_frames(DIFF *diff, const byte *prev, const byte *next);
+
+/* Function: diff_destroy()
+
+   Free all memory associated with diff. */
+int diff_destroy(DIFF *diff);
+
+#endif	/* DIFF_H */
@@ -0,0 +1,246 @@
+/* display.c
+ *
+ * This file is part of oku.
+ *
+ * Copyright (C) 2019 Ellis Rhys Thomas
+ *
+ * oku is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * oku is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+ * License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with oku.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS OR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+/***************/
+/* Description */
+/***************/
+
+/* Latest wins display queue, see display.h. */
+
+#include <pthread.h>
+#include <string.h>		/* memcpy() */
+
+#include "display.h"
+#include "oku_mem.h"
+#include "oku_types.h"
+
+/************************/
+/* Forward Declarations */
+/************************/
+
+static void *display_worker(void *arg);
+
+/************************/
+/* Interface Definition */
+/************************/
+
+/* Function: display_create()
+
+   Two frame buffers are kept, the one waiting and the one being
+   shown, so a frame can be queued while another is refreshed. */
+DISPLAY *
+display_create(REFRESH *refresh, size_t len)
+{
+    if (refresh == NULL || len == 0)
+	return NULL;
+
+    DISPLAY *d = oku_alloc(sizeof *d); /* zeroed, exits on failure */
+
+    d->refresh = refresh;
+    d->len     = len;
+    d->slot    = oku_arrayalloc(len, sizeof(byte));
+    d->shown   = oku_arrayalloc(len, sizeof(byte));
+
+    if (pthread_mutex_init(&d->device, NULL))
+	goto fail0;
+    if (pthread_mutex_init(&d->lock, NULL))
+	goto fail1;
+    if (pthread_cond_init(&d->wake, NULL))
+	goto fail2;
+    if (pthread_cond_init(&d->idle, NULL))
+	goto fail3;
+    if (pthread_create(&d->thread, NULL, display_worker, d))
+	goto fail4;
+
+    return d;
+ fail4:
+    pthread_cond_destroy(&d->idle);
+ fail3:
+    pthread_cond_destroy(&d->wake);
+ fail2:
+    pthread_mutex_destroy(&d->lock);
+ fail1:
+    pthread_mutex_destroy(&d->device);
+ fail0:
+    oku_free(d->shown);
+    oku_free(d->slot);
+    oku_free(d);
+    return NULL;
+}
+
+/* Function: display_put()
+
+   The frame replaced is reported outside the lock, so its callback
+   may itself queue a frame. */
+int
+display_put(DISPLAY *d, byte *bitmap, size_t len, EPD_DONE done, void *ctx)
+{
+    if (d == NULL)
+	return ERR_UNINITIALISED;
+    if (bitmap == NULL || len != d->len)
+	return ERR_INPUT;
+
+    pthread_mutex_lock(&d->lock);
+    EPD_DONE old_done = d->waiting ? d->done : NULL;
+    void *old_ctx = d->ctx;
+
+    if (d->waiting)
+	d->replaced++;
+    memcpy(d->slot, bitmap, len);
+    d->done    = done;
+    d->ctx     = ctx;
+    d->waiting = 1;
+    d->queued++;
+    pthread_cond_signal(&d->wake);
+    pthread_mutex_unlock(&d->lock);
+
+    if (old_done)
+	old_done(d->refresh->epd, ERR_CANCELLED, old_ctx);
+
+    return OK;
+}
+
+/* Function: display_flush() */
+int
+display_flush(DISPLAY *d)
+{
+    if (d == NULL)
+	return ERR_UNINITIALISED;
+
+    pthread_mutex_lock(&d->lock);
+    while (d->waiting || d->busy)
+	pthread_cond_wait(&d->idle, &d->lock);
+    pthread_mutex_unlock(&d->lock);
+
+    return OK;
+}
+
+/* Function: display_lock() */
+int
+display_lock(DISPLAY *d)
+{
+    if (d == NULL)
+	return ERR_UNINITIALISED;
+
+    pthread_mutex_lock(&d->device);
+
+    return OK;
+}
+
+/* Function: display_unlock() */
+int
+display_unlock(DISPLAY *d)
+{
+    if (d == NULL)
+	return ERR_UNINITIALISED;
+
+    pthread_mutex_unlock(&d->device);
+
+    return OK;
+}
+
+/* Function: display_destroy() */
+int
+display_destroy(DISPLAY *d)
+{
+    if (d == NULL)
+	return ERR_UNINITIALISED;
+
+    pthread_mutex_lock(&d->lock);
+    d->quit = 1;
+    pthread_cond_signal(&d->wake);
+    pthread_mutex_unlock(&d->lock);
+    pthread_join(d->thread, NULL);
+
+    pthread_cond_destroy(&d->idle);
+    pthread_cond_destroy(&d->wake);
+    pthread_mutex_destroy(&d->lock);
+    pthread_mutex_destroy(&d->device);
+    oku_free(d->shown);
+    oku_free(d->slot);
+    oku_free(d);
+
+    return OK;
+}
+
+/********************/
+/* Static Functions */
+/********************/
+
+/* Static Function: display_worker()
+
+   [1] The waiting frame is swapped into shown, leaving the slot free
+       for the next while this one is refreshed.
+
+   [2] The refresh is waited for with the device held, so a frame
+       queued meanwhile waits in the slot and is replaced by any newer
+       one.
+
+   [3] Once asked to quit, a frame still waiting is shown first. */
+static void *
+display_worker(void *arg)
+{
+    DISPLAY *d = arg;
+
+    pthread_mutex_lock(&d->lock);
+    for (;;) {
+	while (!d->waiting && !d->quit)
+	    pthread_cond_wait(&d->wake, &d->lock);
+	/* [3] */
+	if (!d->waiting)
+	    break;
+
+	/* [1] */
+	byte *frame = d->slot;
+	d->slot    = d->shown;
+	d->shown   = frame;
+	d->waiting = 0;
+	d->busy    = 1;
+	EPD_DONE done = d->done;
+	void *ctx = d->ctx;
+	pthread_mutex_unlock(&d->lock);
+
+	/* [2] */
+	pthread_mutex_lock(&d->device);
+	int err = refresh_display(d->refresh, frame, d->len, done, ctx);
+	if (err == WARN_PENDING)
+	    epd_wait(d->refresh->epd);
+	else if (err > 0 && done)
+	    done(d->refresh->epd, err, ctx);
+	pthread_mutex_unlock(&d->device);
+
+	pthread_mutex_lock(&d->lock);
+	d->busy = 0;
+	pthread_cond_broadcast(&d->idle);
+    }
+    pthread_mutex_unlock(&d->lock);
+
+    return NULL;
+}
@@ -0,0 +1,123 @@
+/* display.h
+ *
+ * This file is part of oku.
+ *
+ * Copyright (C) 2019 Ellis Rhys Thomas
+ *
+ * oku is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * oku is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+ * License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with oku.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS OR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/***************/
+/* Description */
+/***************/
+
+/* Latest wins display queue.
+
+   Frames are handed to a display thread, which shows them through a
+   refresh scheduler (see refresh.h) while the caller prepares the
+   next. The queue holds at most one frame waiting for the panel. A
+   newer frame replaces it, so pages turned faster than the panel
+   refreshes are skipped and only the last is shown.
+
+   While the queue exists the thread owns the device. Any other call
+   on it must be made between display_lock() and display_unlock(). */
+
+#ifndef DISPLAY_H
+#define DISPLAY_H
+
+#include <pthread.h>
+
+#include "oku_types.h"
+#include "epd.h"
+#include "refresh.h"
+
+/***********/
+/* Objects */
+/***********/
+
+/* Object: DISPLAY
+
+   Display thread and the frame waiting for it. */
+typedef struct DISPLAY {
+    REFRESH        *refresh;	/* Shows frames on the device */
+    pthread_t       thread;	/* Display thread */
+    pthread_mutex_t device;	/* Held while the device is in use */
+    pthread_mutex_t lock;	/* Guards the fields below */
+    pthread_cond_t  wake;	/* Signalled when a frame is queued */
+    pthread_cond_t  idle;	/* Signalled when a frame is shown */
+    byte           *slot;	/* Frame waiting for the panel */
+    byte           *shown;	/* Frame being shown */
+    size_t          len;	/* Length of a frame (B) */
+    int             waiting;	/* Non-zero while slot holds a frame */
+    int             busy;	/* Non-zero while shown is refreshed */
+    int             quit;	/* Set to stop the thread */
+    EPD_DONE        done;	/* Callback of frame in slot */
+    void           *ctx;
+    /* Counters */
+    unsigned long   queued;	/* Frames put */
+    unsigned long   replaced;	/* Frames replaced before shown */
+} DISPLAY;
+
+/**************************/
+/* Interface Deceleration */
+/**************************/
+
+/* Function: display_create()
+
+   Start a display thread showing frames of len bytes through
+   refresh. Returns NULL on failure. Exits on memory error. */
+DISPLAY *display_create(REFRESH *refresh, size_t len);
+
+/* Function: display_put()
+
+   Queue a copy of bitmap to be shown as soon as the panel is free,
+   replacing any frame still waiting. done, which may be NULL, is
+   called from the display thread with the result, or with
+   ERR_CANCELLED if the frame was replaced. */
+int display_put(DISPLAY *d, byte *bitmap, size_t len, EPD_DONE done,
+		void *ctx);
+
+/* Function: display_flush()
+
+   Wait until every frame queued has been shown. */
+int display_flush(DISPLAY *d);
+
+/* Function: display_lock()
+
+   Wait for the frame being refreshed, if any, and take the device
+   from the display thread. A waiting frame is held until
+   display_unlock(). */
+int display_lock(DISPLAY *d);
+
+/* Function: display_unlock()
+
+   Return the device to the display thread. */
+int display_unlock(DISPLAY *d);
+
+/* Function: display_destroy()
+
+   Show any waiting frame, stop the thread and free all memory
+   associated with d. The scheduler and device are not touched. */
+int display_destroy(DISPLAY *d);
+
+#endif	/* DISPLAY_H */
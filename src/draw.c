@@ -0,0 +1,583 @@
+/* draw.c
+ *
+ * This file is part of oku.
+ *
+ * Copyright (C) 2019 Ellis Rhys Thomas
+ *
+ * oku is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * oku is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+ * License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with oku.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS OR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/***************/
+/* Description */
+/***************/
+
+/* Drawing primitives, see draw.h. */
+
+#include <stdint.h>		/* uint32_t, int64_t */
+#include <limits.h>		/* INT_MAX */
+#include <string.h>		/* memset() */
+
+#include "draw.h"
+#include "bitmap.h"
+#include "oku_types.h"
+
+const PATTERN PATTERN_DOTTED = { 0x80000000, 2 };
+const PATTERN PATTERN_DASHED = { 0xF0000000, 8 };
+
+/* Object: STREAM
+
+   Pattern pixels queued for drawing a byte at a time, the next pixel
+   is bit count - 1 of bits. */
+typedef struct STREAM {
+    const PATTERN *pattern;
+    uint64_t       bits;
+    unsigned       count;
+} STREAM;
+
+/* Object: CLIP
+
+   Bitmap dimensions, found once per call. */
+typedef struct CLIP {
+    int width;
+    int height;
+} CLIP;
+
+/* Object: LINE
+
+   A line as steps along its major axis, each step moving the minor
+   axis by dminor / dmajor of a pixel. */
+typedef struct LINE {
+    int64_t  x0, y0;
+    int      sx, sy;		/* Direction of each axis, +1 or -1 */
+    uint64_t dx, dy;		/* Extent of each axis */
+    int      xmajor;		/* Non-zero if dx >= dy */
+} LINE;
+
+/************************/
+/* Forward Declarations */
+/************************/
+
+static int clip_bitmap(BITMAP *bmp, CLIP *clip);
+static int check_pattern(const PATTERN *pattern);
+static int clip_range(int *start, int *length, int limit);
+static int line_clip(const LINE *l, CLIP *c, uint64_t *first,
+		     uint64_t *last);
+static void axis_range(int64_t start, int sign, int limit, int64_t *lo,
+		       int64_t *hi);
+static uint64_t line_minor(const LINE *l, uint64_t step);
+static uint64_t line_first(const LINE *l, uint64_t minor);
+static void line_point(const LINE *l, uint64_t step, int64_t *x,
+		       int64_t *y, int64_t *e);
+static void span(BITMAP *bmp, int x, int y, int length,
+		 enum SET_PIXEL_MODE mode, const PATTERN *pattern,
+		 unsigned phase);
+static void stream_start(STREAM *st, const PATTERN *pattern,
+			 unsigned phase);
+static byte stream_byte(STREAM *st);
+static int pattern_px(const PATTERN *pattern, unsigned phase);
+static void apply(byte *b, byte mask, enum SET_PIXEL_MODE mode);
+
+/************************/
+/* Interface Definition */
+/************************/
+
+/* Function: draw_hline()
+
+   The pattern starts at x, so clipping the left end advances it. */
+int
+draw_hline(BITMAP *bmp, int x, int y, int length,
+	   enum SET_PIXEL_MODE mode, const PATTERN *pattern)
+{
+    CLIP c;
+    int err = clip_bitmap(bmp, &c);
+    if (err == OK)
+	err = check_pattern(pattern);
+    if (err > 0)
+	return err;
+
+    int x0 = x;
+    if (y < 0 || y >= c.height || !clip_range(&x, &length, c.width))
+	return OK;
+
+    span(bmp, x, y, length, mode, pattern, x - x0);
+
+    return OK;
+}
+
+/* Function: draw_vline()
+
+   One bit per row, stepping through the buffer by the pitch. */
+int
+draw_vline(BITMAP *bmp, int x, int y, int length,
+	   enum SET_PIXEL_MODE mode, const PATTERN *pattern)
+{
+    CLIP c;
+    int err = clip_bitmap(bmp, &c);
+    if (err == OK)
+	err = check_pattern(pattern);
+    if (err > 0)
+	return err;
+
+    int y0 = y;
+    if (x < 0 || x >= c.width || !clip_range(&y, &length, c.height))
+	return OK;
+
+    byte *b = bmp->buffer + (members)y * bmp->pitch + x / 8;
+    byte mask = 0x80 >> (x % 8);
+
+    for (int i = 0; i < length; ++i, b += bmp->pitch)
+	if (pattern_px(pattern, y - y0 + i))
+	    apply(b, mask, mode);
+
+    return OK;
+}
+
+/* Function: draw_line()
+
+   Bresenham's algorithm, stepping one pixel along the major axis and
+   accumulating the error along the minor axis. Lines parallel to an
+   axis are drawn as spans.
+
+   [1] The steps that fall within the bitmap are found first and the
+       walk starts at the first of them, with the error and pattern
+       phase it would have had there, so only visible pixels are
+       visited however far the ends lie outside. */
+int
+draw_line(BITMAP *bmp, int x0, int y0, int x1, int y1,
+	  enum SET_PIXEL_MODE mode, const PATTERN *pattern)
+{
+    CLIP c;
+    int err = clip_bitmap(bmp, &c);
+    if (err == OK)
+	err = check_pattern(pattern);
+    if (err > 0)
+	return err;
+
+    if (y0 == y1 && x0 <= x1 && (int64_t)x1 - x0 < INT_MAX)
+	return draw_hline(bmp, x0, y0, x1 - x0 + 1, mode, pattern);
+    if (x0 == x1 && y0 <= y1 && (int64_t)y1 - y0 < INT_MAX)
+	return draw_vline(bmp, x0, y0, y1 - y0 + 1, mode, pattern);
+
+    LINE l = { .x0 = x0, .y0 = y0,
+	       .sx = x0 < x1 ? 1 : -1, .sy = y0 < y1 ? 1 : -1,
+	       .dx = x0 < x1 ? (int64_t)x1 - x0 : (int64_t)x0 - x1,
+	       .dy = y0 < y1 ? (int64_t)y1 - y0 : (int64_t)y0 - y1 };
+    l.xmajor = l.dx >= l.dy;
+
+    uint64_t first, last;	/* [1] */
+    if (!line_clip(&l, &c, &first, &last))
+	return OK;
+
+    int64_t x, y, e;
+    line_point(&l, first, &x, &y, &e);
+
+    int64_t dx = l.dx, dy = -(int64_t)l.dy;
+    for (uint64_t i = first;; ++i) {
+	if (pattern_px(pattern, i))
+	    apply(bmp->buffer + (members)y * bmp->pitch + x / 8,
+		  0x80 >> (x % 8), mode);
+
+	if (i == last)
+	    break;
+	int64_t e2 = 2 * e;
+	if (e2 >= dy) { e += dy; x += l.sx; }
+	if (e2 <= dx) { e += dx; y += l.sy; }
+    }
+
+    return OK;
+}
+
+/* Function: draw_rect()
+
+   Four lines, the vertical sides omit the corners so that toggling
+   inverts each pixel of the outline once. */
+int
+draw_rect(BITMAP *bmp, int x, int y, int width, int height,
+	  enum SET_PIXEL_MODE mode, const PATTERN *pattern)
+{
+    int err = OK;
+
+    if (width <= 0 || height <= 0)
+	return OK;
+
+    err = draw_hline(bmp, x, y, width, mode, pattern);
+    if (err > 0 || height == 1)
+	return err;
+    err = draw_hline(bmp, x, y + height - 1, width, mode, pattern);
+    if (err > 0 || height == 2)
+	return err;
+    err = draw_vline(bmp, x, y + 1, height - 2, mode, pattern);
+    if (err > 0 || width == 1)
+	return err;
+
+    return draw_vline(bmp, x + width - 1, y + 1, height - 2, mode, pattern);
+}
+
+/* Function: draw_fill()
+
+   A solid span per row, clipped once. */
+int
+draw_fill(BITMAP *bmp, int x, int y, int width, int height,
+	  enum SET_PIXEL_MODE mode)
+{
+    CLIP c;
+    int err = clip_bitmap(bmp, &c);
+    if (err > 0)
+	return err;
+
+    if (!clip_range(&x, &width, c.width) || !clip_range(&y, &height, c.height))
+	return OK;
+
+    for (int row = y; row < y + height; ++row)
+	span(bmp, x, row, width, mode, NULL, 0);
+
+    return OK;
+}
+
+/* Function: draw_progress()
+
+   The bar is cleared inside a one pixel outline, leaving a one pixel
+   gap around the filled part. */
+int
+draw_progress(BITMAP *bmp, int x, int y, int width, int height,
+	      long done, long total)
+{
+    if (width < 5 || height < 5 || total <= 0)
+	return ERR_INPUT;
+
+    done = done < 0 ? 0 : done > total ? total : done;
+
+    int err = draw_rect(bmp, x, y, width, height, SET_PIXEL_BLACK, NULL);
+    if (err > 0)
+	return err;
+    err = draw_fill(bmp, x + 1, y + 1, width - 2, height - 2,
+		    SET_PIXEL_WHITE);
+    if (err > 0)
+	return err;
+
+    int filled = (width - 4) * done / total;
+
+    return draw_fill(bmp, x + 2, y + 2, filled, height - 4, SET_PIXEL_BLACK);
+}
+
+/********************/
+/* Static Functions */
+/********************/
+
+/* Static Function: clip_bitmap()
+
+   Check bmp once and find its dimensions. */
+static int
+clip_bitmap(BITMAP *bmp, CLIP *clip)
+{
+    if (bmp == NULL || bmp->buffer == NULL || bmp->pitch == 0
+	|| bmp->width == 0)
+	return ERR_UNINITIALISED;
+
+    clip->width  = bmp->width;
+    clip->height = bmp->length / bmp->pitch;
+
+    return OK;
+}
+
+/* Static Function: check_pattern()
+
+   A pattern repeats within its 32 bits, longer patterns are rejected
+   with ERR_INPUT. No pattern is a solid line. */
+static int
+check_pattern(const PATTERN *pattern)
+{
+    return pattern && pattern->length > 32 ? ERR_INPUT : OK;
+}
+
+/* Static Function: clip_range()
+
+   Clip the run of length from start to [0, limit). Returns zero if
+   nothing is left. */
+static int
+clip_range(int *start, int *length, int limit)
+{
+    if (*start < 0) {
+	*length += *start;
+	*start = 0;
+    }
+    if (*length > limit - *start)
+	*length = limit - *start;
+
+    return *length > 0;
+}
+
+/* Static Function: line_clip()
+
+   Finds the first and last step of l within the bitmap. Returns zero
+   if there are none.
+
+   [1] The major axis moves one pixel per step, so its range of steps
+       follows directly.
+
+   [2] The minor axis never moves backwards, so the steps where it is
+       in range are found by searching for the first step reaching
+       each end of that range. */
+static int
+line_clip(const LINE *l, CLIP *c, uint64_t *first, uint64_t *last)
+{
+    uint64_t steps = l->xmajor ? l->dx : l->dy;
+    int64_t lo, hi, mlo, mhi;
+
+    /* [1] */
+    if (l->xmajor)
+	axis_range(l->x0, l->sx, c->width, &lo, &hi);
+    else
+	axis_range(l->y0, l->sy, c->height, &lo, &hi);
+    lo = lo > 0 ? lo : 0;
+    hi = hi < (int64_t)steps ? hi : (int64_t)steps;
+
+    /* [2] */
+    if (l->xmajor)
+	axis_range(l->y0, l->sy, c->height, &mlo, &mhi);
+    else
+	axis_range(l->x0, l->sx, c->width, &mlo, &mhi);
+    if (lo > hi || mhi < 0)
+	return 0;
+
+    uint64_t from = line_first(l, mlo > 0 ? mlo : 0);
+    uint64_t to   = line_first(l, mhi + 1) - 1;
+    *first = from > (uint64_t)lo ? from : (uint64_t)lo;
+    *last  = to < (uint64_t)hi ? to : (uint64_t)hi;
+
+    return from <= to && *first <= *last;
+}
+
+/* Static Function: axis_range()
+
+   The range of k for which start + sign * k lies within 0 to limit
+   - 1. */
+static void
+axis_range(int64_t start, int sign, int limit, int64_t *lo, int64_t *hi)
+{
+    if (sign > 0) {
+	*lo = -start;
+	*hi = limit - 1 - start;
+    } else {
+	*lo = start - (limit - 1);
+	*hi = start;
+    }
+
+    return;
+}
+
+/* Static Function: line_minor()
+
+   Pixels moved along the minor axis after step steps, which is
+   dminor * step / dmajor rounded half up, as the walk in draw_line()
+   rounds. The product fits 64 bits as both factors are below 2^32,
+   doubling only the remainder avoids overflow. */
+static uint64_t
+line_minor(const LINE *l, uint64_t step)
+{
+    uint64_t major = l->xmajor ? l->dx : l->dy;
+    uint64_t minor = l->xmajor ? l->dy : l->dx;
+    if (major == 0)
+	return 0;
+
+    uint64_t p = step * minor;
+
+    return p / major + (2 * (p % major) >= major);
+}
+
+/* Static Function: line_first()
+
+   First step at which the minor axis has moved minor pixels, or one
+   past the last step if it never does. */
+static uint64_t
+line_first(const LINE *l, uint64_t minor)
+{
+    uint64_t lo = 0, hi = (l->xmajor ? l->dx : l->dy) + 1;
+
+    while (lo < hi) {
+	uint64_t mid = lo + (hi - lo) / 2;
+	if (line_minor(l, mid) >= minor)
+	    hi = mid;
+	else
+	    lo = mid + 1;
+    }
+
+    return lo;
+}
+
+/* Static Function: line_point()
+
+   Position and error of the walk in draw_line() after step steps.
+   The error is dx - dy + ny * dx - nx * dy for nx and ny pixels
+   moved, written in terms of the remainder of line_minor() so that
+   no term exceeds the line's extent. */
+static void
+line_point(const LINE *l, uint64_t step, int64_t *x, int64_t *y,
+	   int64_t *e)
+{
+    int64_t dx = l->dx, dy = l->dy;
+    uint64_t major = l->xmajor ? l->dx : l->dy;
+    uint64_t minor = line_minor(l, step);
+    int64_t r = 0, up = 0;
+
+    if (major > 0) {
+	uint64_t p = step * (l->xmajor ? l->dy : l->dx);
+	r  = p % major;
+	up = 2 * (uint64_t)r >= major;
+    }
+
+    if (l->xmajor) {
+	*x = l->x0 + l->sx * (int64_t)step;
+	*y = l->y0 + l->sy * (int64_t)minor;
+	*e = dx - dy + up * dx - r;
+    } else {
+	*x = l->x0 + l->sx * (int64_t)minor;
+	*y = l->y0 + l->sy * (int64_t)step;
+	*e = dx - dy + r - up * dy;
+    }
+
+    return;
+}
+
+/* Static Function: span()
+
+   Apply mode to length pixels of row y from x, already clipped.
+
+   [1] Pixels before x in the first byte and after the span in the
+       last byte are masked off.
+
+   [2] Solid bytes wholly inside the span are set or cleared with
+       memset(), toggled a byte at a time.
+
+   [3] Patterned bytes take the next 8 pixels of the pattern, phase
+       is the pattern position of pixel x. */
+static void
+span(BITMAP *bmp, int x, int y, int length, enum SET_PIXEL_MODE mode,
+     const PATTERN *pattern, unsigned phase)
+{
+    byte *b = bmp->buffer + (members)y * bmp->pitch + x / 8;
+    int first = x % 8;
+    int end = first + length;	/* Bits from start of first byte */
+    byte head = 0xFF >> first;	/* [1] */
+    byte tail = end % 8 ? (byte)(0xFF << (8 - end % 8)) : 0xFF;
+
+    if (pattern && pattern->length) { /* [3] */
+	unsigned len = pattern->length;
+	STREAM st;
+	stream_start(&st, pattern, (phase % len + 8 * len - first) % len);
+	for (int bit = 0; bit < end; bit += 8, ++b) {
+	    byte mask = stream_byte(&st);
+	    if (bit == 0)
+		mask &= head;
+	    if (bit + 8 >= end)
+		mask &= tail;
+	    apply(b, mask, mode);
+	}
+	return;
+    }
+
+    if (end <= 8) {
+	apply(b, head & tail, mode);
+	return;
+    }
+
+    apply(b++, head, mode);
+    members whole = end / 8 - 1;
+
+    switch (mode) {		/* [2] */
+    case SET_PIXEL_BLACK: memset(b, 0xFF, whole); break;
+    case SET_PIXEL_WHITE: memset(b, 0x00, whole); break;
+    case SET_PIXEL_TOGGLE:
+	for (members i = 0; i < whole; ++i)
+	    b[i] ^= 0xFF;
+	break;
+    }
+    b += whole;
+
+    if (end % 8)
+	apply(b, tail, mode);
+
+    return;
+}
+
+/* Static Function: stream_start()
+
+   Queue the pixels of pattern from position phase to the end of one
+   repeat. */
+static void
+stream_start(STREAM *st, const PATTERN *pattern, unsigned phase)
+{
+    unsigned len = pattern->length;
+
+    st->pattern = pattern;
+    st->count   = len - phase;
+    st->bits    = (pattern->bits >> (32 - len))
+	& (((uint64_t)1 << st->count) - 1);
+
+    return;
+}
+
+/* Static Function: stream_byte()
+
+   Next eight pixels of the pattern, MSB first. Whole repeats are
+   appended as the queue runs low, at most 7 + 32 bits are held. */
+static byte
+stream_byte(STREAM *st)
+{
+    unsigned len = st->pattern->length;
+
+    while (st->count < 8) {
+	st->bits = st->bits << len | st->pattern->bits >> (32 - len);
+	st->count += len;
+    }
+    st->count -= 8;
+
+    return st->bits >> st->count;
+}
+
+/* Static Function: pattern_px()
+
+   Non-zero if the pixel at position phase of pattern is drawn. */
+static int
+pattern_px(const PATTERN *pattern, unsigned phase)
+{
+    if (pattern == NULL || pattern->length == 0)
+	return 1;
+
+    return pattern->bits >> (31 - phase % pattern->length) & 1;
+}
+
+/* Static Function: apply()
+
+   Set, clear or toggle the bits of mask in b. */
+static void
+apply(byte *b, byte mask, enum SET_PIXEL_MODE mode)
+{
+    switch (mode) {
+    case SET_PIXEL_BLACK:  *b |= mask;  break;
+    case SET_PIXEL_WHITE:  *b &= ~mask; break;
+    case SET_PIXEL_TOGGLE: *b ^= mask;  break;
+    }
+
+    return;
+}
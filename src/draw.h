@@ -0,0 +1,115 @@
+/* draw.h
+ *
+ * This file is part of oku.
+ *
+ * Copyright (C) 2019 Ellis Rhys Thomas
+ *
+ * oku is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * oku is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+ * License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with oku.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS OR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/***************/
+/* Description */
+/***************/
+
+/* Drawing primitives for user interface chrome: underlines, rules,
+   progress bars and selection boxes.
+
+   Each call checks the bitmap and clips the shape to it once, then
+   writes whole bytes of a row at a time with masks at either end,
+   unlike bitmap_modify_px() which validates every pixel. Coordinates
+   are signed so shapes may extend beyond the bitmap.
+
+   Lines may be dotted or dashed with a PATTERN, a run of up to 32
+   pixels repeated along the line. A NULL pattern is a solid line, a
+   longer one is rejected with ERR_INPUT. */
+
+#ifndef DRAW_H
+#define DRAW_H
+
+#include <stdint.h>		/* uint32_t */
+
+#include "oku_types.h"
+#include "bitmap.h"
+
+/***********/
+/* Objects */
+/***********/
+
+/* Object: PATTERN
+
+   Repeating line pattern, the first pixel is the most significant
+   bit of bits and a set bit is drawn. */
+typedef struct PATTERN {
+    uint32_t bits;		/* Pixels drawn, MSB first */
+    unsigned length;		/* Pixels in one repeat (1-32), 0 solid */
+} PATTERN;
+
+extern const PATTERN PATTERN_DOTTED; /* 1 on, 1 off */
+extern const PATTERN PATTERN_DASHED; /* 4 on, 4 off */
+
+/**************************/
+/* Interface Deceleration */
+/**************************/
+
+/* Function: draw_hline()
+
+   Horizontal line of length pixels rightwards from (x,y). */
+int draw_hline(BITMAP *bmp, int x, int y, int length,
+	       enum SET_PIXEL_MODE mode, const PATTERN *pattern);
+
+/* Function: draw_vline()
+
+   Vertical line of length pixels downwards from (x,y). */
+int draw_vline(BITMAP *bmp, int x, int y, int length,
+	       enum SET_PIXEL_MODE mode, const PATTERN *pattern);
+
+/* Function: draw_line()
+
+   Line from (x0,y0) to (x1,y1) inclusive. The time taken depends
+   only on the part that lies within the bitmap. */
+int draw_line(BITMAP *bmp, int x0, int y0, int x1, int y1,
+	      enum SET_PIXEL_MODE mode, const PATTERN *pattern);
+
+/* Function: draw_rect()
+
+   Outline of the rectangle width x height pixels with its upper left
+   corner at (x,y). */
+int draw_rect(BITMAP *bmp, int x, int y, int width, int height,
+	      enum SET_PIXEL_MODE mode, const PATTERN *pattern);
+
+/* Function: draw_fill()
+
+   Fill the rectangle width x height pixels with its upper left corner
+   at (x,y). SET_PIXEL_TOGGLE inverts it, e.g. to highlight a
+   selection. */
+int draw_fill(BITMAP *bmp, int x, int y, int width, int height,
+	      enum SET_PIXEL_MODE mode);
+
+/* Function: draw_progress()
+
+   Progress bar, an outline filled from the left in proportion to
+   done out of total. */
+int draw_progress(BITMAP *bmp, int x, int y, int width, int height,
+		  long done, long total);
+
+#endif	/* DRAW_H */
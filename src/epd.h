@@ -59,8 +59,15 @@ typedef struct EPD {
     unsigned int reset_delay;	/* GPIO reset pin hold time (ms) */
     int busy_delay;		/* GPIO reset pin hold time (ms) */
     FILE *stream;		/* Implementation specific handle */
+    struct EPD_STATE *state;	/* Implementation private state */
 } EPD;
 
+/* Callback: EPD_DONE
+
+   Called once a refresh started by epd_display_async() is complete,
+   with the result err and the ctx it was started with. */
+typedef void (*EPD_DONE)(EPD *epd, int err, void *ctx);
+
 /*************/
 /* Interface */
 /*************/
@@ -99,13 +106,99 @@ int epd_on(EPD *epd);
    to fill out the last byte in the row if the width is not a factor
    of 8.  Each bit represents a pixel: 1 is black, 0 is white.
 
-   len - 1 dimensional length of bitmap in bytes. */
+   len - 1 dimensional length of bitmap in bytes.
+
+   Implementations compare bitmap with the last frame displayed and
+   skip the refresh if nothing has changed, see diff.h. */
 int epd_display(EPD *epd, byte *bitmap, size_t len);
 
+/* Function: epd_display_async()
+
+   As epd_display(), except it returns WARN_PENDING as soon as the
+   frame has been sent and the refresh started, leaving the caller to
+   prepare the next frame while the display updates. The bitmap may be
+   reused once it returns. A refresh still in progress is waited for
+   first.
+
+   done - Called with the result once the refresh is complete, from
+   within epd_poll(), epd_wait() or any later call on the handle. May
+   be NULL. An unchanged frame returns OK, calling done at once. */
+int epd_display_async(EPD *epd, byte *bitmap, size_t len, EPD_DONE done,
+		      void *ctx);
+
+/* Function: epd_poll()
+
+   Returns WARN_PENDING while a refresh is in progress, without
+   blocking, otherwise completes it and returns its result. A device
+   that has stopped responding returns ERR_BUSY, leaving the refresh
+   pending for epd_wait() to recover. */
+int epd_poll(EPD *epd);
+
+/* Function: epd_wait()
+
+   Blocks until any refresh in progress is complete, returning its
+   result. Implementations reset a device that stops responding and
+   refresh the frame again, returning ERR_BUSY only if it cannot be
+   brought back. */
+int epd_wait(EPD *epd);
+
+/* Function: epd_display_region()
+
+   As epd_display(), except only the rectangle width x height pixels
+   with top left corner x, y of bitmap is sent and refreshed, using
+   the device's partial update waveform where it has one. Partial
+   refreshes are quicker and do not flash the screen, suiting small
+   changes such as page numbers, progress bars and menus, but leave
+   ghosting behind. A full epd_display() clears it.
+
+   bitmap - A whole frame as for epd_display(), pixels outside the
+   rectangle are not sent.
+
+   len - 1 dimensional length of bitmap in bytes. */
+int epd_display_region(EPD *epd, byte *bitmap, size_t len, coordinate x,
+		       coordinate y, resolution width, resolution height);
+
+/* Function: epd_set_profile()
+
+   Choose the waveform of full refreshes by name, trading image
+   quality for speed:
+
+   "quality"    - Cleanest image, the default.
+   "fast"       - Shorter waveform, some ghosting.
+   "ultra-fast" - Shortest waveform, most ghosting.
+   "auto"       - The fastest profile suited to the temperature given
+                  to epd_set_temperature(), "quality" until it is.
+
+   Takes effect from the next full refresh, the device only being
+   reprogrammed if the waveform changes. Returns ERR_INPUT for an
+   unknown name. */
+int epd_set_profile(EPD *epd, const char *name);
+
+/* Function: epd_set_temperature()
+
+   Tell the device the ambient temperature in degrees Celsius. Panels
+   respond slower in the cold, so "auto" picks slower waveforms. */
+int epd_set_temperature(EPD *epd, int celsius);
+
+/* Function: epd_sleep()
+
+   Put device into its lowest power state once any refresh in progress
+   is complete, keeping the handle open. The image stays on the
+   screen. Does nothing if the device is already asleep. */
+int epd_sleep(EPD *epd);
+
+/* Function: epd_wake()
+
+   Wake device from epd_sleep() with the shortest sequence that leaves
+   it ready to display, which is much quicker than epd_on(). Displaying
+   a frame on a sleeping device wakes it first. */
+int epd_wake(EPD *epd);
+
 /* Function: epd_reset()
 
    Resets the device screen to a white background. The device remains
-   active as if epd_on() has been run. */
+   active as if epd_on() has been run. A refresh in progress may be
+   abandoned, reporting ERR_CANCELLED to its callback. */
 int epd_reset(EPD *epd);
 
 /* Function: epd_off()
@@ -35,8 +35,13 @@
  */
 
 #include <stdio.h>		/* FILE* */
+#include <string.h>		/* memcpy(), strcmp() */
+#include <limits.h>		/* INT_MIN */
+#include <time.h>		/* clock_gettime(), nanosleep() */
 
 #include "epd.h"
+#include "pbm.h"
+#include "diff.h"
 #include "oku_types.h"
 #include "oku_mem.h"
 
@@ -47,7 +52,41 @@
 #define FILENAME "./display.pbm" /* PBM file path */
 #define WIDTH  128		 /* Display width (px) */
 #define HEIGHT 296		 /* Display height (px) */
-#define STR_LEN 6		 /* Number of characters in width+height */
+#define PARTIAL_S 0.3		 /* Modelled partial refresh time (s) */
+
+#define ARRSIZE(X) (sizeof(X)/sizeof(X[0]))
+
+/* Object: PROFILE
+
+   Named full refresh, see epd_set_profile(), and the time it is
+   modelled to take. Chosen automatically at min_celsius or above. */
+struct PROFILE {
+    const char *name;
+    double      seconds;
+    int         min_celsius;
+};
+
+static const struct PROFILE profiles[] =
+    { { "quality",    2.0, INT_MIN },
+      { "fast",       1.0, 10 },
+      { "ultra-fast", 0.5, 20 } };
+
+/* Object: EPD_STATE
+
+   Copy of the frame in the file, and where its raster starts. */
+struct EPD_STATE {
+    byte *last;			/* Frame in file */
+    int   valid;		/* Non-zero once a frame is written */
+    DIFF *diff;			/* Changes between frames */
+    long  raster;		/* File offset of raster */
+    int   pending;		/* Non-zero until polled */
+    EPD_DONE done;		/* Called on completion, or NULL */
+    void *ctx;			/* Passed to done */
+    double ready;		/* When the refresh completes (s) */
+    const struct PROFILE *profile; /* Chosen profile, NULL for auto */
+    int   celsius;		/* Ambient temperature */
+    int   celsius_known;	/* Non-zero once celsius is set */
+};
 
 /************************/
 /* Forward Declarations */
@@ -55,8 +94,12 @@
 static int file_open(const char *filename, EPD *epd);
 static int file_close(EPD *epd);
 static int file_check(FILE *pbm);
-static int file_write_headers(FILE *pbm);
-static int file_write_bitmap(byte *bitmap, members len, FILE *pbm);
+static const struct PROFILE *full_profile(struct EPD_STATE *st);
+static double seconds(void);
+static void sleep_until(double t);
+static int file_write(EPD *epd, byte *bitmap, resolution first,
+		      resolution last, members first_byte,
+		      members last_byte);
 
 /*************/
 /* Interface */
@@ -78,6 +121,13 @@ epd_create(void)
     epd->width  = WIDTH;
     epd->height = HEIGHT;
 
+    /* Frame in file */
+    members pitch = (WIDTH + 7) / 8;
+    epd->state = oku_alloc(sizeof *epd->state);
+    epd->state->last = oku_arrayalloc(pitch * HEIGHT, sizeof(byte));
+    epd->state->diff = diff_create(pitch, HEIGHT);
+    epd->state->profile = &profiles[0];
+
     return epd;
 }
 
@@ -92,28 +142,209 @@ epd_on(EPD *epd)
     if (err > 0)
 	return err;
 
-    err = file_write_headers(epd->stream);
+    err = pbm_write_headers(epd->stream, epd->width, epd->height);
     if (err > 0) {
 	file_close(epd);
 	return err;
     }
 
+    epd->state->raster = ftell(epd->stream);
+    epd->state->valid = 0;
+
     return OK;
 }
  
 /* Function: epd_display()
 
-   Writes binary image data to file.
+   Writes the frame and completes at once. */
+int
+epd_display(EPD *epd, byte *bitmap, members len)
+{
+    int err = epd_display_async(epd, bitmap, len, NULL, NULL);
+
+    return err == WARN_PENDING ? epd_wait(epd) : err;
+}
+
+/* Function: epd_display_async()
+
+   Replaces the image in the file with the binary image data, so the
+   file always holds the last frame displayed. Only the band of rows
+   that changed since the last frame is rewritten, nothing is written
+   if the frame is unchanged.
+
+   The file is written before returning, the refresh is then modelled
+   as taking the time of the profile in use.
 
    bitmap - Pointer to bitmap buffer.
    len - Length of bitmap in buffer in bytes. */
 int
-epd_display(EPD *epd __attribute__((unused)), byte *bitmap, members len)
+epd_display_async(EPD *epd, byte *bitmap, members len, EPD_DONE done,
+		  void *ctx)
 {
-    if (len == 0 || bitmap == NULL)
+    struct EPD_STATE *st = epd->state;
+    members pitch = (epd->width + 7) / 8;
+    resolution first = 0, last = epd->height - 1;
+
+    if (len != pitch * epd->height || bitmap == NULL)
 	return ERR_INPUT;
 
-    return file_write_bitmap(bitmap, len, epd->stream);
+    epd_wait(epd);
+
+    int err = file_check(epd->stream);
+    if (err > 0)
+	return err;
+
+    if (st->valid) {
+	diff_frames(st->diff, st->last, bitmap);
+	if (st->diff->identical) {
+	    if (done)
+		done(epd, OK, ctx);
+	    return OK;
+	}
+	first = st->diff->first_row;
+	last  = st->diff->last_row;
+    }
+
+    err = file_write(epd, bitmap, first, last, 0, pitch - 1);
+    if (err > 0)
+	return err;
+
+    st->valid   = 1;
+    st->pending = 1;
+    st->ready   = seconds() + full_profile(st)->seconds;
+    st->done    = done;
+    st->ctx     = ctx;
+
+    return WARN_PENDING;
+}
+
+/* Function: epd_poll()
+
+   The file was written when the refresh started, so it is complete
+   once its modelled time has passed. */
+int
+epd_poll(EPD *epd)
+{
+    struct EPD_STATE *st = epd->state;
+    EPD_DONE done = st->done;
+
+    if (!st->pending)
+	return OK;
+    if (seconds() < st->ready)
+	return WARN_PENDING;
+
+    st->pending = 0;
+    st->done    = NULL;
+    if (done)
+	done(epd, OK, st->ctx);
+
+    return OK;
+}
+
+/* Function: epd_wait()
+
+   Sleeps out the modelled time of the refresh. */
+int
+epd_wait(EPD *epd)
+{
+    if (epd->state->pending)
+	sleep_until(epd->state->ready);
+
+    return epd_poll(epd);
+}
+
+/* Function: epd_display_region()
+
+   Rewrites only the bytes of the file covering the rectangle, clipped
+   to the display, row by row, and sleeps for the modelled time of a
+   partial refresh. The whole frame is written while the file holds
+   none, as the device would show whatever its RAM held. */
+int
+epd_display_region(EPD *epd, byte *bitmap, members len, coordinate x,
+		   coordinate y, resolution width, resolution height)
+{
+    members pitch = (epd->width + 7) / 8;
+
+    if (len != pitch * epd->height || bitmap == NULL)
+	return ERR_INPUT;
+
+    epd_wait(epd);
+    if (!epd->state->valid)
+	return epd_display(epd, bitmap, len);
+    if (x >= epd->width || y >= epd->height || width == 0 || height == 0)
+	return OK;
+
+    int err = file_check(epd->stream);
+    if (err > 0)
+	return err;
+
+    resolution last = y + height > epd->height ? epd->height - 1
+	: y + height - 1;
+    members last_byte = (x + width > epd->width ? epd->width - 1
+			 : x + width - 1) / 8;
+
+    err = file_write(epd, bitmap, y, last, x / 8, last_byte);
+    if (err > 0)
+	return err;
+
+    sleep_until(seconds() + PARTIAL_S);
+
+    return OK;
+}
+
+/* Function: epd_set_profile()
+
+   Selects the modelled time of the next full refresh. */
+int
+epd_set_profile(EPD *epd, const char *name)
+{
+    if (name == NULL)
+	return ERR_INPUT;
+
+    if (strcmp(name, "auto") == 0) {
+	epd->state->profile = NULL;
+	return OK;
+    }
+
+    for (members i = 0; i < ARRSIZE(profiles); ++i)
+	if (strcmp(name, profiles[i].name) == 0) {
+	    epd->state->profile = &profiles[i];
+	    return OK;
+	}
+
+    return ERR_INPUT;
+}
+
+/* Function: epd_set_temperature() */
+int
+epd_set_temperature(EPD *epd, int celsius)
+{
+    epd->state->celsius = celsius;
+    epd->state->celsius_known = 1;
+
+    return OK;
+}
+
+/* Function: epd_sleep()
+
+   Completes any refresh and flushes the file, there is no power to
+   save. */
+int
+epd_sleep(EPD *epd)
+{
+    epd_wait(epd);
+
+    return file_check(epd->stream) || fflush(epd->stream) ? ERR_IO : OK;
+}
+
+/* Function: epd_wake()
+
+   The file is always ready. */
+int
+epd_wake(EPD *epd)
+{
+    (void)epd;
+    return OK;
 }
 
 /* Function: epd_reset()
@@ -130,6 +361,8 @@ epd_reset(EPD *epd)
 int
 epd_off(EPD *epd)
 {
+    epd_wait(epd);
+
     return file_close(epd);
 }
 
@@ -139,6 +372,9 @@ epd_destroy(EPD *epd)
     if (epd == NULL)
 	return ERR_UNINITIALISED;
 
+    diff_destroy(epd->state->diff);
+    oku_free(epd->state->last);
+    oku_free(epd->state);
     oku_free(epd);
 
     return OK;
@@ -180,56 +416,89 @@ file_close(struct EPD *epd)
     return err;
 }
 
-/* Static function: write_headers
+/* Static function: file_write()
 
-   Writes PBM headers to file.
+   Writes bytes first_byte to last_byte of rows first to last of
+   bitmap over the same bytes of the raster in the file and of the
+   copy of it kept. Whole rows are written in one go. */
+static int
+file_write(EPD *epd, byte *bitmap, resolution first, resolution last,
+	   members first_byte, members last_byte)
+{
+    struct EPD_STATE *st = epd->state;
+    members pitch = (epd->width + 7) / 8;
+    members width = last_byte - first_byte + 1;
+    resolution rows = width == pitch ? 1 : last - first + 1;
+    members span = width == pitch ? (last - first + 1) * pitch : width;
+
+    for (resolution r = 0; r < rows; ++r) {
+	members offset = (first + r) * pitch + first_byte;
+
+	if (fseek(epd->stream, st->raster + offset, SEEK_SET))
+	    return ERR_IO;
+	int err = pbm_write_bitmap(epd->stream, bitmap + offset, span);
+	if (err > 0)
+	    return err;
+
+	memcpy(st->last + offset, bitmap + offset, span);
+    }
 
-   PBM starts with the two characters "P4", followed by whitespace
-   (blanks, TABs, CRs, LFs).
+    return fflush(epd->stream) ? ERR_IO : OK;
+}
+
+/* Static function: file_check()
 
-   The width in pixels of the image, formatted as ASCII characters
-   in decimal, followed by whitespace.
-      
-   The height in pixels of the image, again in ASCII decimal, followed
-   by whitespace character (usually a newline). */
+   Check file pointer is not NULL. */
 static int
-file_write_headers(FILE *pbm)
+file_check(FILE *pbm)
 {
-    /* Length of the string written is checked against return value of
-       fprintf(). 5 characters, plus the device dimensions are used
-       including the newline. */
-    int len = 5 + STR_LEN;
-    return fprintf(pbm, "P4 %d %d\n", WIDTH, HEIGHT) != len
-	? ERR_PARTIAL_WRITE : OK;
+    return pbm == NULL ? ERR_UNINITIALISED : OK;
 }
 
-/* Static function: write bitmap
+/* Static function: full_profile
 
-   Writes binary bitmap in format required by PBM files:
+   The chosen profile, or with auto, the fastest profile suited to the
+   temperature. */
+static const struct PROFILE *
+full_profile(struct EPD_STATE *st)
+{
+    const struct PROFILE *pick = &profiles[0];
 
-   A raster of Height rows, in order from top to bottom.
+    if (st->profile)
+	return st->profile;
 
-   Each row is Width bits, packed 8 to a byte, with don't care bits to
-   fill out the last byte in the row.
+    for (members i = 0; st->celsius_known && i < ARRSIZE(profiles); ++i)
+	if (st->celsius >= profiles[i].min_celsius)
+	    pick = &profiles[i];
 
-   Each bit represents a pixel: 1 is black, 0 is white.
+    return pick;
+}
 
-   The order of the pixels is left to right. The order of their
-   storage within each file byte is most significant bit to least
-   significant bit. The order of the file bytes is from the beginning
-   of the file toward the end of the file. */
-static int
-file_write_bitmap(byte *bitmap, members len, FILE *pbm)
+/* Static function: seconds
+
+   Monotonic time in seconds. */
+static double
+seconds(void)
 {
-    return fwrite(bitmap, sizeof *bitmap, len, pbm) < len
-	? ERR_PARTIAL_WRITE : OK;
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
 }
 
-/* Static function: file_check()
+/* Static function: sleep_until
 
-   Check file pointer is not NULL. */
-static int
-file_check(FILE *pbm)
+   Sleep until monotonic time t (s). */
+static void
+sleep_until(double t)
 {
-    return pbm == NULL ? ERR_UNINITIALISED : OK;
+    double left = t - seconds();
+
+    if (left <= 0)
+	return;
+
+    struct timespec ts = { .tv_sec  = (time_t)left,
+			   .tv_nsec = (long)(left * 1e9) % 1000000000 };
+    nanosleep(&ts, NULL);
+
+    return;
 }
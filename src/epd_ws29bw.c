@@ -49,8 +49,13 @@
    must be inverted.
  */
 
+#include <limits.h>		/* INT_MIN */
+#include <string.h>		/* memcpy(), memcmp(), strcmp() */
+#include <time.h>		/* clock_gettime() */
+
 #include "epd.h"
 #include "spi.h"
+#include "diff.h"
 #include "oku_types.h"
 #include "oku_mem.h"
 
@@ -64,6 +69,9 @@
 #define SPI_CLK_HZ 32000000	/* SPI clock speed */
 #define RESET_DELAY 200		/* GPIO reset pin hold time (ms) */
 #define BUSY_DELAY 300		/* GPIO reset pin hold time (ms) */
+#define WAKE_DELAY 10		/* Reset pulse leaving deep sleep (ms) */
+#define PARTIAL_MS 300		/* Partial refresh time (ms) */
+#define HANG_FACTOR 2		/* Refresh times BUSY is high in a hang */
 
 /****************************/
 /* CPP Function like macros */
@@ -118,18 +126,102 @@ byte lut_full_update[] =
       0x00, 0x00, 0x00, 0x00, 0xF8, 0xB4, 0x13, 0x51,
       0x35, 0x51, 0x51, 0x19, 0x01, 0x00 };
 
-/* Partial updates not currently implemented */
-// const byte lut_partial_update[] =
-//	{ 0x10, 0x18, 0x18, 0x08, 0x18, 0x18, 0x08, 0x00,
-//	  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-//	  0x00, 0x00, 0x00, 0x00, 0x13, 0x14, 0x44, 0x12,
-//	  0x00, 0x00, 0x00, 0x00, 0x00, 0x00 };
+/* 30B LUTs for quicker full screen updates. The voltage sequence is
+   that of lut_full_update with its phase lengths, the four bit
+   counts of frames in the last 10 bytes, halved and quartered rounding
+   up */
+byte lut_fast_update[] =
+    { 0x02, 0x02, 0x01, 0x11, 0x12, 0x12, 0x22, 0x22,
+      0x66, 0x69, 0x69, 0x59, 0x58, 0x99, 0x99, 0x88,
+      0x00, 0x00, 0x00, 0x00, 0x84, 0x62, 0x12, 0x31,
+      0x23, 0x31, 0x31, 0x15, 0x01, 0x00 };
+
+byte lut_ultra_fast_update[] =
+    { 0x02, 0x02, 0x01, 0x11, 0x12, 0x12, 0x22, 0x22,
+      0x66, 0x69, 0x69, 0x59, 0x58, 0x99, 0x99, 0x88,
+      0x00, 0x00, 0x00, 0x00, 0x42, 0x31, 0x11, 0x21,
+      0x12, 0x21, 0x21, 0x13, 0x01, 0x00 };
+
+/* 30B Look up table (LUT) for partial update, pixels are driven only
+   from their old to their new colour so the rest of the screen does
+   not flash */
+byte lut_partial_update[] =
+    { 0x10, 0x18, 0x18, 0x08, 0x18, 0x18, 0x08, 0x00,
+      0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+      0x00, 0x00, 0x00, 0x00, 0x13, 0x14, 0x44, 0x12,
+      0x00, 0x00, 0x00, 0x00, 0x00, 0x00 };
+
+/* Object: PROFILE
+
+   Named full update waveform, see epd_set_profile(). Pixels respond
+   slower in the cold, a profile is only chosen automatically at
+   min_celsius or above. */
+struct PROFILE {
+    const char *name;
+    byte       *lut;
+    int         min_celsius;
+    unsigned    ms;		/* Refresh time */
+};
+
+static const struct PROFILE profiles[] =
+    { { "quality",    lut_full_update,       INT_MIN, 2000 },
+      { "fast",       lut_fast_update,       10,      1000 },
+      { "ultra-fast", lut_ultra_fast_update, 20,      500 } };
+
+/* Object: SHADOW
+
+   Value last written to a controller register. */
+#define SHADOW_REGS 16		/* Registers shadowed */
+#define SHADOW_LEN  30		/* Longest value (B), the LUT */
+
+struct SHADOW {
+    enum COMMAND command;
+    members      len;
+    byte         data[SHADOW_LEN];
+};
+
+/* Object: EPD_STATE
+
+   Copy of the frame held in device RAM, valid once a whole frame has
+   been written since the device was last reset or put to sleep. */
+struct EPD_STATE {
+    byte *last;			/* Frame in device RAM */
+    int   valid;		/* Non-zero if last is trustworthy */
+    DIFF *diff;			/* Changes between frames */
+    byte *staging;		/* Inverted rows on their way to RAM */
+    /* Registers as written since the last reset or deep sleep */
+    struct SHADOW shadow[SHADOW_REGS];
+    members       shadows;	/* Registers in shadow */
+    /* Rectangle in staging, bytes xmin to xmax of rows ymin to ymax */
+    resolution ymin, ymax;
+    members    xmin, xmax;
+    /* Refresh in progress */
+    int        pending;		/* Non-zero until BUSY falls */
+    double     started;		/* When it was started (s) */
+    unsigned   hang;		/* BUSY time taken as a hang (ms) */
+    EPD_DONE   done;		/* Called on completion, or NULL */
+    void      *ctx;		/* Passed to done */
+    int        asleep;		/* Non-zero in deep sleep */
+    /* Waveform of full updates */
+    const struct PROFILE *profile; /* Chosen profile, NULL for auto */
+    int        celsius;		/* Ambient temperature */
+    int        celsius_known;	/* Non-zero once celsius is set */
+};
 
 /************************/
 /* Forward Declarations */
 /************************/
 
 static members calculate_pitch(resolution width);
+static byte *full_lut(struct EPD_STATE *st);
+static double seconds(void);
+static int refresh_start(EPD *epd, byte *bitmap, byte *lut,
+			 resolution ymin, resolution ymax,
+			 members xmin, members xmax);
+static int refresh_finish(EPD *epd, int err);
+static unsigned hang_ms(EPD *epd, byte *lut);
+static int recover(EPD *epd);
+static int soft_reset(struct EPD_STATE *st, unsigned timeout);
 
 /* Communication with device */
 static int init_gpio(void);
@@ -139,15 +231,21 @@ static int wait_while_busy(unsigned int busy_delay);
 /* Write to device  */
 static int write_command(enum COMMAND command);
 static int write_data(byte *data, members len);
-static int push_shift_register(void) ;
-static int push_lut(byte *lut);
+static int write_register(struct EPD_STATE *st, enum COMMAND command,
+			  byte *data, members len);
+static int push_shift_register(struct EPD_STATE *st);
+static int push_lut(struct EPD_STATE *st, byte *lut);
 
 /* Device RAM operations */
-static int ram_set_window(coordinate xmin, coordinate xmax,
+static int ram_set_window(struct EPD_STATE *st,
+			  coordinate xmin, coordinate xmax,
 			  coordinate ymin, coordinate ymax);
 static int ram_set_cursor(coordinate x, coordinate y);
-static int ram_write(byte *bitmap, coordinate width, coordinate height);
-static int ram_load(unsigned int busy_delay);
+static void ram_stage(struct EPD_STATE *st, byte *bitmap, members pitch,
+		      resolution ymin, resolution ymax,
+		      members xmin, members xmax);
+static int ram_send(struct EPD_STATE *st);
+static int ram_load(struct EPD_STATE *st);
 
 /***********************/
 /* Interface Functions */
@@ -175,6 +273,14 @@ epd_create(void)
     /* Stream handle unused in this implementation of epd.h */
     epd->stream = NULL;
 
+    /* Frame in device RAM */
+    members pitch = calculate_pitch(WIDTH);
+    epd->state = oku_alloc(sizeof *epd->state);
+    epd->state->last = oku_arrayalloc(pitch * HEIGHT, sizeof(byte));
+    epd->state->diff = diff_create(pitch, HEIGHT);
+    epd->state->staging = oku_arrayalloc(pitch * HEIGHT, sizeof(byte));
+    epd->state->profile = &profiles[0];
+
     return epd;
 }
 
@@ -196,14 +302,14 @@ epd_on(EPD *epd)
     if (err > 0) goto out; 
     err = epd_reset(epd);	/* Wipes device display screen */
     if (err > 0) goto out;
-    err = push_shift_register(); /* Startup commands */
+    err = push_shift_register(epd->state); /* Startup commands */
     if (err > 0) goto out;
-    err = push_lut(lut_full_update); /* Sends device lut */
+    err = push_lut(epd->state, full_lut(epd->state)); /* Sends device lut */
     if (err > 0) goto out;
 
     /* RAM to hold full bitmap, representing pixels from origin to
        maximum dimensions */
-    ram_set_window(0, epd->width, 0, epd->height);
+    ram_set_window(epd->state, 0, epd->width - 1, 0, epd->height - 1);
 
  out:
     return err;
@@ -211,38 +317,179 @@ epd_on(EPD *epd)
 
 /* Function: epd_display()
 
-   Displays provided bitmap on epaper device display. Bitmap length
-   must equal that of the display. */
+   Displays provided bitmap on epaper device display, returning once
+   the refresh is complete. See epd_display_async(). */
 int
 epd_display(EPD *epd, byte *bitmap, members len)
 {
+    int err = epd_display_async(epd, bitmap, len, NULL, NULL);
+
+    return err == WARN_PENDING ? epd_wait(epd) : err;
+}
+
+/* Function: epd_display_async()
+
+   Displays provided bitmap on epaper device display. Bitmap length
+   must equal that of the display.
+
+   Device RAM keeps the last frame written, so once it is known only
+   the band of rows that changed, and only the bytes of those rows
+   within the changed columns, are written. An unchanged frame is not
+   refreshed at all.
+
+   The bytes are sent and the refresh started before returning, the
+   device raises BUSY until the refresh is over. The bitmap is free
+   to be reused straight away. */
+int
+epd_display_async(EPD *epd, byte *bitmap, members len, EPD_DONE done,
+		  void *ctx)
+{
+    struct EPD_STATE *st = epd->state;
     members pitch = calculate_pitch(epd->width);
+    DIFF full = { .first_row = 0, .last_row = epd->height - 1,
+		  .first_byte = 0, .last_byte = pitch - 1 };
+    DIFF *d = &full;
 
-    if (len != pitch * epd->height)
+    if (len != pitch * epd->height || bitmap == NULL)
 	goto fail1;
 
-    if (ram_write(bitmap, epd->width, epd->height))
+    /* Reported to the previous callback. */
+    epd_wait(epd);
+    if (st->asleep && epd_wake(epd) > 0)
 	goto fail2;
-    if (ram_load(epd->busy_delay))
+
+    if (st->valid) {
+	diff_frames(st->diff, st->last, bitmap);
+	if (st->diff->identical) {
+	    if (done)
+		done(epd, OK, ctx);
+	    return OK;
+	}
+	d = st->diff;
+    }
+
+    if (refresh_start(epd, bitmap, full_lut(st), d->first_row,
+		      d->last_row, d->first_byte, d->last_byte))
 	goto fail2;
 
-    return OK;
+    st->valid = 1;
+    st->done  = done;
+    st->ctx   = ctx;
+
+    return WARN_PENDING;
  fail1:
     return ERR_INPUT;
  fail2:
     return ERR_COMMS;
 }
 
+/* Function: epd_poll()
+
+   Reads the BUSY pin once. A refresh that has kept BUSY high past its
+   hang time, see hang_ms(), has hung the controller. Recovery blocks
+   for seconds, so ERR_BUSY is returned and the refresh left pending
+   for epd_wait() to recover. */
+int
+epd_poll(EPD *epd)
+{
+    struct EPD_STATE *st = epd->state;
+
+    if (!st->pending)
+	return OK;
+
+    if (spi_gpio_read(PIN_BUSY) == GPIO_LEVEL_HIGH) {
+	if (seconds() - st->started < st->hang / 1e3)
+	    return WARN_PENDING;
+	return ERR_BUSY;
+    }
+
+    return refresh_finish(epd, OK);
+}
+
+/* Function: epd_wait()
+
+   Waits for BUSY to fall on its edge. If it has not within the hang
+   time of the refresh, see hang_ms(), counted from its start, the
+   controller has hung and is recovered, see recover(), the frame being
+   shown when the refresh completes. */
+int
+epd_wait(EPD *epd)
+{
+    struct EPD_STATE *st = epd->state;
+
+    if (!st->pending)
+	return OK;
+
+    double left = st->hang - (seconds() - st->started) * 1e3;
+    int err = spi_gpio_wait(PIN_BUSY, GPIO_LEVEL_LOW,
+			    left > 0 ? (unsigned)left : 0);
+    if (err == ERR_BUSY)
+	err = recover(epd);
+
+    return refresh_finish(epd, err);
+}
+
+/* Function: epd_display_region()
+
+   Refreshes the rectangle with the partial update LUT. The rectangle
+   is widened to whole bytes and clipped to the display.
+
+   Until a whole frame has been displayed the rest of device RAM is
+   unknown and a partial refresh would show it, so the whole frame is
+   displayed instead. An unchanged rectangle is not refreshed. */
+int
+epd_display_region(EPD *epd, byte *bitmap, members len, coordinate x,
+		   coordinate y, resolution width, resolution height)
+{
+    struct EPD_STATE *st = epd->state;
+    members pitch = calculate_pitch(epd->width);
+
+    if (len != pitch * epd->height || bitmap == NULL)
+	return ERR_INPUT;
+
+    epd_wait(epd);
+    if (!st->valid)
+	return epd_display(epd, bitmap, len);
+    if (x >= epd->width || y >= epd->height || width == 0 || height == 0)
+	return OK;
+
+    resolution ymax = y + height > epd->height ? epd->height - 1
+	: y + height - 1;
+    members xmin = x / 8;
+    members xmax = (x + width > epd->width ? epd->width - 1
+		    : x + width - 1) / 8;
+
+    for (resolution row = y; row <= ymax; ++row) {
+	members at = row * pitch + xmin;
+	if (memcmp(st->last + at, bitmap + at, xmax - xmin + 1) == 0)
+	    continue;
+
+	if (refresh_start(epd, bitmap, lut_partial_update, y, ymax,
+			  xmin, xmax))
+	    return ERR_COMMS;
+	return epd_wait(epd);
+    }
+
+    return OK;
+}
+
 /* Function: epd_reset()
 
    Resets the epaper display screen using the GPIO reset pin, holding
-   them at the required level for the device delay time.
+   them at the required level for the device delay time. A refresh in
+   progress is abandoned.
 */
 int
 epd_reset(EPD *epd)
 {
     int err = OK;
 
+    if (epd->state->pending)
+	refresh_finish(epd, ERR_CANCELLED);
+    epd->state->valid = 0;	/* Screen and RAM wiped */
+    epd->state->shadows = 0;	/* Registers too */
+    epd->state->asleep = 0;	/* Leaves deep sleep */
+
     err = spi_gpio_write(PIN_RST, GPIO_LEVEL_HIGH);
     if (err > 0) goto out;
     spi_delay(epd->reset_delay);
@@ -259,32 +506,130 @@ epd_reset(EPD *epd)
     return err;
 }
 
-/* Function: epd_off()
+/* Function: epd_set_profile()
+
+   Selects the LUT sent before the next full update. */
+int
+epd_set_profile(EPD *epd, const char *name)
+{
+    if (name == NULL)
+	return ERR_INPUT;
+
+    if (strcmp(name, "auto") == 0) {
+	epd->state->profile = NULL;
+	return OK;
+    }
+
+    for (members i = 0; i < ARRSIZE(profiles); ++i)
+	if (strcmp(name, profiles[i].name) == 0) {
+	    epd->state->profile = &profiles[i];
+	    return OK;
+	}
+
+    return ERR_INPUT;
+}
+
+/* Function: epd_set_temperature()
+
+   The temperature is also written to the controller's temperature
+   register with the next refresh. */
+int
+epd_set_temperature(EPD *epd, int celsius)
+{
+    epd->state->celsius = celsius;
+    epd->state->celsius_known = 1;
+
+    return OK;
+}
+
+/* Function: epd_sleep()
 
    Put device into deep sleep. */
 int
-epd_off(EPD *epd)
+epd_sleep(EPD *epd)
 {
     int err = OK;
     byte dsm[] = { 0x01 };
 
-    err = wait_while_busy(epd->busy_delay);
+    if (epd->state->asleep)
+	return OK;
+
+    err = epd_wait(epd);
     if (err > 0) goto out;
 
+    /* RAM is not retained in deep sleep, nor registers on waking */
+    epd->state->valid = 0;
+    epd->state->shadows = 0;
+
     err = write_command(DEEP_SLEEP_MODE);
     if (err > 0) goto out;
     err = write_data(dsm, ARRSIZE(dsm));
+    if (err > 0) goto out;
+
+    epd->state->asleep = 1;
+
+ out:
+    return err;
+}
+
+/* Function: epd_wake()
+
+   Deep sleep is only left through the reset pin, which returns the
+   registers to their defaults.
+
+   [1] GPIO and SPI are still set up, so unlike epd_on() a single
+       short reset pulse is enough, the controller raising BUSY until
+       it is ready.
+
+   [2] The startup commands are sent again. The LUT is left for the
+       first refresh to send, whichever waveform it uses. */
+int
+epd_wake(EPD *epd)
+{
+    int err = OK;
+
+    if (!epd->state->asleep)
+	return OK;
+
+    /* [1] */
+    err = spi_gpio_write(PIN_RST, GPIO_LEVEL_LOW);
+    if (err > 0) goto out;
+    spi_delay(WAKE_DELAY);
+    err = spi_gpio_write(PIN_RST, GPIO_LEVEL_HIGH);
+    if (err > 0) goto out;
+    spi_delay(WAKE_DELAY);
+    err = wait_while_busy(epd->busy_delay);
+    if (err > 0) goto out;
+
+    /* [2] */
+    err = push_shift_register(epd->state);
+    if (err > 0) goto out;
+
+    epd->state->asleep = 0;
 
  out:
     return err;
 }
 
+/* Function: epd_off()
+
+   Put device into deep sleep. */
+int
+epd_off(EPD *epd)
+{
+    return epd_sleep(epd);
+}
+
 int
 epd_destroy(EPD *epd)
 {
     if (epd == NULL)
 	return ERR_UNINITIALISED;
 
+    diff_destroy(epd->state->diff);
+    oku_free(epd->state->staging);
+    oku_free(epd->state->last);
+    oku_free(epd->state);
     oku_free(epd);
 
     return OK;
@@ -357,7 +702,8 @@ write_command(enum COMMAND command)
 /* Function: write_data()
 
    Sets the GPIO pins for data transfer and transfers given
-   data to epaper device. */
+   data to epaper device. Data longer than the kernel accepts in one
+   write is sent in several, chip select staying low throughout. */
 static int
 write_data(byte *data, members len)
 {
@@ -370,8 +716,11 @@ write_data(byte *data, members len)
     if (err > 0) goto out;
 
     /* Write data */
-    err = spi_write(data, len);
-    if (err > 0) goto out;
+    for (members sent = 0; sent < len; sent += SPI_WRITE_MAX) {
+	members n = len - sent < SPI_WRITE_MAX ? len - sent : SPI_WRITE_MAX;
+	err = spi_write(data + sent, n);
+	if (err > 0) goto out;
+    }
 
     /* Reset chip select when write complete */
     err = spi_gpio_write(PIN_CS, GPIO_LEVEL_HIGH);
@@ -384,7 +733,7 @@ write_data(byte *data, members len)
 
    Write the required data to the device shift register. */
 static int
-push_shift_register(void) 
+push_shift_register(struct EPD_STATE *st)
 {
     int err = OK;
 
@@ -398,33 +747,19 @@ push_shift_register(void)
     byte bwc[]  = { 0x03 };
     byte dems[] = { 0x03 };
 
-    err = write_command(DRIVER_OUTPUT_CONTROL);
-    if (err > 0) goto out;
-    err = write_data(doc, ARRSIZE(doc));
-    if (err > 0) goto out;
-    err = write_command(BOOSTER_SOFT_START_CONTROL);
-    if (err > 0) goto out;
-    err = write_data(bssc, ARRSIZE(bssc));
-    if (err > 0) goto out;
-    err = write_command(WRITE_VCOM_REGISTER);
-    if (err > 0) goto out;
-    err = write_data(wvr, ARRSIZE(wvr));
-    if (err > 0) goto out;
-    err = write_command(SET_DUMMY_LINE_PERIOD);
+    err = write_register(st, DRIVER_OUTPUT_CONTROL, doc, ARRSIZE(doc));
     if (err > 0) goto out;
-    err = write_data(sdlp, ARRSIZE(sdlp));
+    err = write_register(st, BOOSTER_SOFT_START_CONTROL, bssc, ARRSIZE(bssc));
     if (err > 0) goto out;
-    err = write_command(SET_GATE_TIME);
+    err = write_register(st, WRITE_VCOM_REGISTER, wvr, ARRSIZE(wvr));
     if (err > 0) goto out;
-    err = write_data(sgt, ARRSIZE(sgt));
+    err = write_register(st, SET_DUMMY_LINE_PERIOD, sdlp, ARRSIZE(sdlp));
     if (err > 0) goto out;
-    err = write_command(BORDER_WAVEFORM_CONTROL);
+    err = write_register(st, SET_GATE_TIME, sgt, ARRSIZE(sgt));
     if (err > 0) goto out;
-    err = write_data(bwc, ARRSIZE(bwc));
+    err = write_register(st, BORDER_WAVEFORM_CONTROL, bwc, ARRSIZE(bwc));
     if (err > 0) goto out;
-    err = write_command(DATA_ENTRY_MODE_SETTING);
-    if (err > 0) goto out;
-    err = write_data(dems, ARRSIZE(dems));
+    err = write_register(st, DATA_ENTRY_MODE_SETTING, dems, ARRSIZE(dems));
  out:
     return err;
 }
@@ -433,37 +768,64 @@ push_shift_register(void)
 
    Send 30B look up table to device. */
 static int
-push_lut(byte *lut)
+push_lut(struct EPD_STATE *st, byte *lut)
+{
+    return write_register(st, WRITE_LUT_REGISTER, lut, 30);
+}
+
+/* Static Function: write_register()
+
+   Write data to the register set by command, unless the shadow shows
+   the controller already holds it. Registers are added to the shadow
+   as they are first written. */
+static int
+write_register(struct EPD_STATE *st, enum COMMAND command, byte *data,
+	       members len)
 {
+    struct SHADOW *reg = NULL;
     int err = OK;
 
-    err = write_command(WRITE_LUT_REGISTER);
-    if (err > 0) goto out;
-    err = write_data(lut, 30);
- out:
+    for (members i = 0; i < st->shadows; ++i)
+	if (st->shadow[i].command == command)
+	    reg = &st->shadow[i];
+
+    if (reg && reg->len == len && memcmp(reg->data, data, len) == 0)
+	return OK;
+
+    err = write_command(command);
+    if (err > 0) goto fail;
+    err = write_data(data, len);
+    if (err > 0) goto fail;
+
+    if (reg == NULL && st->shadows < SHADOW_REGS && len <= SHADOW_LEN)
+	reg = &st->shadow[st->shadows++];
+    if (reg && len <= SHADOW_LEN) {
+	reg->command = command;
+	reg->len = len;
+	memcpy(reg->data, data, len);
+    }
+
+    return OK;
+ fail:
+    /* Value held by the controller is unknown */
+    if (reg)
+	reg->len = 0;
     return err;
 }
     
 /* Static Function: wait_while_busy()
 
-   Pauses process until busy pin reads low. If the waiting time is
-   greater than 100 x busy_delay seconds, returns appropriate error
-   code.
+   Pauses process until busy pin reads low, waking on its falling
+   edge rather than sleeping a whole busy_delay between reads. If the
+   waiting time is greater than 100 x busy_delay, returns appropriate
+   error code.
 
-   busy_delay - delay time (s) */
+   busy_delay - delay time (ms) */
 
 static int
 wait_while_busy(unsigned int busy_delay)
 {
-    int t = 0;
-    while (spi_gpio_read(PIN_BUSY) == GPIO_LEVEL_HIGH) {
-	spi_delay(busy_delay);
-
-	if (++t > 100)
-	    return ERR_BUSY;
-    }
-	
-    return OK;
+    return spi_gpio_wait(PIN_BUSY, GPIO_LEVEL_LOW, 100 * busy_delay);
 }
 
 /* Static function: ram_set_window.
@@ -475,7 +837,7 @@ wait_while_busy(unsigned int busy_delay)
 
    xmin,xmax,ymin,ymax - Cartesian coordinates from origin to extrema. */
 static int
-ram_set_window(coordinate xmin, coordinate xmax,
+ram_set_window(struct EPD_STATE *st, coordinate xmin, coordinate xmax,
 	       coordinate ymin, coordinate ymax)
 {
     int err = OK;
@@ -493,13 +855,11 @@ ram_set_window(coordinate xmin, coordinate xmax,
     byte y_start_end[] = { ymin & 0xFF, (ymin >> 8) & 0xFF,
 			   ymax & 0xFF, (ymax >> 8) & 0xFF };
 
-    err = write_command(SET_RAM_X_ADDRESS_START_END_POSITION);
-    if (err > 0) goto out;
-    err = write_data(x_start_end, ARRSIZE(x_start_end));
-    if (err > 0) goto out;
-    err = write_command(SET_RAM_Y_ADDRESS_START_END_POSITION);
+    err = write_register(st, SET_RAM_X_ADDRESS_START_END_POSITION,
+			 x_start_end, ARRSIZE(x_start_end));
     if (err > 0) goto out;
-    err = write_data(y_start_end, ARRSIZE(y_start_end));
+    err = write_register(st, SET_RAM_Y_ADDRESS_START_END_POSITION,
+			 y_start_end, ARRSIZE(y_start_end));
 
  out:
     return err;
@@ -534,59 +894,302 @@ ram_set_cursor(coordinate x, coordinate y)
     return err;
 }
 
-/* Static function ram_write()
+/* Static function ram_stage()
+
+   Gather rows ymin to ymax of the provided bitmap into the staging
+   buffer, only bytes xmin to xmax of each row. Device representation
+   of black is opposite to that in bitmap.h so the bytes need to be
+   inverted bitwise. */
+static void
+ram_stage(struct EPD_STATE *st, byte *bitmap, members pitch,
+	  resolution ymin, resolution ymax, members xmin, members xmax)
+{
+    members width = xmax - xmin + 1;
+    byte *out = st->staging;
+
+    for (resolution y = ymin; y <= ymax; ++y) {
+	const byte *row = bitmap + y * pitch + xmin;
+	for (members x = 0; x < width; ++x)
+	    out[x] = ~row[x];
+	out += width;
+    }
+
+    st->ymin = ymin;
+    st->ymax = ymax;
+    st->xmin = xmin;
+    st->xmax = xmax;
+
+    return;
+}
+
+/* Static function ram_send()
 
-   Write the provided bitmap to the device RAM row by row, as is
-   required by this device. Device representation of black is opposite
-   to that in bitmap.h so the byte needs to be inverted bitwise. */
+   Write the staged rectangle to device RAM.
+
+   The RAM window is set to the rectangle being written. The address
+   counter then steps across each row and wraps to the start of the
+   next at the window edge, so a single cursor and WRITE_RAM command
+   cover every row, and the rows are sent as one transfer. */
 static int
-ram_write(byte *bitmap, coordinate width, coordinate height)
+ram_send(struct EPD_STATE *st)
 {
     int err = OK;
+    members len = (st->xmax - st->xmin + 1) * (st->ymax - st->ymin + 1);
 
-    for (coordinate y = 0; y < height; ++y) {
-	/* Set the cursor at the start of each row. */
-	err = ram_set_cursor(0, y);
-	if (err > 0) goto out;
-	err = write_command(WRITE_RAM);
-	if (err > 0) goto out;
+    err = ram_set_window(st, st->xmin * 8, st->xmax * 8, st->ymin, st->ymax);
+    if (err > 0) goto out;
+    err = ram_set_cursor(st->xmin * 8, st->ymin);
+    if (err > 0) goto out;
+    err = write_command(WRITE_RAM);
+    if (err > 0) goto out;
+    err = write_data(st->staging, len);
 
-	/* Each byte holds data for 8 pixels in a row. */
-	for (members x = 0; x < calculate_pitch(width); ++x, bitmap++) {
-	    byte inverted = ~(*bitmap);
-	    err = write_data(&inverted, 1);
-	    if (err > 0) goto out;
-	}
-    }
  out:
     return err;
 }
 
 /* Static function: ram_load.
 
-   Load the bitmap stored in the RAM window, defined by
-   ram_set_window() to the epaper device display. */
+   Start loading the bitmap stored in RAM to the epaper device
+   display. BUSY is high until it is done. */
 static int
-ram_load(unsigned int busy_delay)
+ram_load(struct EPD_STATE *st)
 {
     int err = OK;
 
     byte duc2[] = { 0xC4 };
 
-    err = write_command(DISPLAY_UPDATE_CONTROL_2);
-    if (err > 0) goto out;
-    err = write_data(duc2, ARRSIZE(duc2));
+    err = write_register(st, DISPLAY_UPDATE_CONTROL_2, duc2,
+			 ARRSIZE(duc2));
     if (err > 0) goto out;
     err = write_command(MASTER_ACTIVATION);
     if (err > 0) goto out;
     err = write_command(TERMINATE_FRAME_READ_WRITE);
+
+ out:
+    return err;
+}
+
+/* Static Function: refresh_start()
+
+   Writes rows ymin to ymax, bytes xmin to xmax, of bitmap to device
+   RAM and starts refreshing the display with lut, which is only sent
+   if it is not already loaded. The rectangle is kept in staging for
+   refresh_finish(). bitmap may be the last frame itself. */
+static int
+refresh_start(EPD *epd, byte *bitmap, byte *lut, resolution ymin,
+	      resolution ymax, members xmin, members xmax)
+{
+    struct EPD_STATE *st = epd->state;
+    members pitch = calculate_pitch(epd->width);
+    int err = OK;
+
+    err = push_lut(st, lut);
+    if (err > 0) goto out;
+
+    /* Twelve bits, sixteenths of a degree */
+    if (st->celsius_known) {
+	int t = st->celsius * 16;
+	byte tsc[] = { (t >> 4) & 0xFF, (t & 0x0F) << 4 };
+	err = write_register(st, TEMPERATURE_SENSOR_CONTROL, tsc,
+			     ARRSIZE(tsc));
+	if (err > 0) goto out;
+    }
+
+    ram_stage(st, bitmap, pitch, ymin, ymax, xmin, xmax);
+    err = ram_send(st);
     if (err > 0) goto out;
-    err = wait_while_busy(busy_delay);
+    err = ram_load(st);
+    if (err > 0) goto out;
+
+    for (resolution y = ymin; bitmap != st->last && y <= ymax; ++y)
+	memcpy(st->last + y * pitch + xmin, bitmap + y * pitch + xmin,
+	       xmax - xmin + 1);
+
+    st->pending = 1;
+    st->started = seconds();
+    st->hang    = hang_ms(epd, lut);
 
  out:
     return err;
 }
 
+/* Static Function: refresh_finish()
+
+   Completes the refresh in progress with err, reporting it to the
+   callback.
+
+   The controller holds two frames and switches the one written to
+   after each refresh, so the rectangle is written again to keep the
+   second frame the same as the display. Following a failure neither
+   frame is trusted. */
+static int
+refresh_finish(EPD *epd, int err)
+{
+    struct EPD_STATE *st = epd->state;
+    EPD_DONE done = st->done;
+
+    st->pending = 0;
+    st->done    = NULL;
+
+    if (err == OK && ram_send(st))
+	err = ERR_COMMS;
+    if (err > 0)
+	st->valid = 0;
+
+    if (done)
+	done(epd, err, st->ctx);
+
+    return err;
+}
+
+/* Static Function: hang_ms()
+
+   Time BUSY may stay high in a refresh with lut before the
+   controller is taken to have hung, HANG_FACTOR times the time the
+   refresh should take plus a busy delay. Far shorter than the bound
+   of wait_while_busy(), so a hang is found within a refresh or two. */
+static unsigned
+hang_ms(EPD *epd, byte *lut)
+{
+    unsigned ms = PARTIAL_MS;
+
+    for (members i = 0; i < ARRSIZE(profiles); ++i)
+	if (lut == profiles[i].lut)
+	    ms = profiles[i].ms;
+
+    return HANG_FACTOR * ms + epd->busy_delay;
+}
+
+/* Static Function: recover()
+
+   Bring back a controller left with BUSY stuck high by the refresh in
+   progress, then refresh the whole of the last frame so the screen
+   shows what it should. Each step is tried in turn until the frame
+   is refreshed, waiting a busy delay for the controller to reset and
+   the hang time of a full refresh for the frame:
+
+   [1] SW_RESET, keeping GPIO, SPI and the register values in the
+       shadow, which are written again.
+
+   [2] A reset through the reset pin, as epd_reset(), and the startup
+       commands.
+
+   [3] Full initialisation, as epd_on(), starting GPIO and SPI again.
+
+   [4] Only if the frame is still refreshing after the last step is
+       BUSY waited for as long as wait_while_busy() allows.
+
+   [5] The refresh is left pending for refresh_finish() to complete,
+       so the second frame in the controller is written as usual. */
+static int
+recover(EPD *epd)
+{
+    struct EPD_STATE *st = epd->state;
+    members pitch = calculate_pitch(epd->width);
+    int err = ERR_BUSY;
+
+    /* Kept from epd_reset(), which would cancel it */
+    st->pending = 0;
+
+    for (int step = 1; step <= 3 && err > 0; ++step) {
+	switch (step) {
+	case 1:			/* [1] */
+	    err = soft_reset(st, epd->busy_delay);
+	    break;
+	case 2:			/* [2] */
+	    err = epd_reset(epd);
+	    if (err == OK)
+		err = push_shift_register(st);
+	    break;
+	case 3:			/* [3] */
+	    err = epd_on(epd);
+	    break;
+	}
+	if (err > 0)
+	    continue;
+
+	st->valid = 0;
+	err = refresh_start(epd, st->last, full_lut(st), 0, epd->height - 1,
+			    0, pitch - 1);
+	st->pending = 0;
+	if (err == OK)
+	    err = spi_gpio_wait(PIN_BUSY, GPIO_LEVEL_LOW, st->hang);
+    }
+
+    /* [4] */
+    if (err == ERR_BUSY)
+	err = wait_while_busy(epd->busy_delay);
+
+    /* [5] */
+    st->pending = 1;
+    st->valid = (err == OK);
+
+    return err;
+}
+
+/* Static Function: soft_reset()
+
+   Reset the controller with SW_RESET, which returns its registers to
+   their defaults but leaves GPIO and SPI untouched, then write the
+   value of every register in the shadow again. The reset must end
+   within timeout (ms). */
+static int
+soft_reset(struct EPD_STATE *st, unsigned timeout)
+{
+    int err = OK;
+
+    err = write_command(SW_RESET);
+    if (err > 0) goto out;
+    err = spi_gpio_wait(PIN_BUSY, GPIO_LEVEL_LOW, timeout);
+    if (err > 0) goto out;
+
+    for (members i = 0; i < st->shadows; ++i) {
+	struct SHADOW *reg = &st->shadow[i];
+	if (reg->len == 0)
+	    continue;
+	err = write_command(reg->command);
+	if (err > 0) goto out;
+	err = write_data(reg->data, reg->len);
+	if (err > 0) goto out;
+    }
+
+ out:
+    if (err > 0)
+	st->shadows = 0;	/* Registers unknown */
+    return err;
+}
+
+/* Static Function: full_lut()
+
+   LUT of the chosen profile, or with auto, of the fastest profile
+   suited to the temperature. */
+static byte *
+full_lut(struct EPD_STATE *st)
+{
+    const struct PROFILE *pick = &profiles[0];
+
+    if (st->profile)
+	return st->profile->lut;
+
+    for (members i = 0; st->celsius_known && i < ARRSIZE(profiles); ++i)
+	if (st->celsius >= profiles[i].min_celsius)
+	    pick = &profiles[i];
+
+    return pick->lut;
+}
+
+/* Static Function: seconds()
+
+   Monotonic time in seconds. */
+static double
+seconds(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
 /* Static Function: calculate_pitch()
 
    Returns the number of bytes required to define each pixels across
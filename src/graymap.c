@@ -0,0 +1,254 @@
+/* graymap.c
+ *
+ * This file is part of oku.
+ *
+ * Copyright (C) 2019 Ellis Rhys Thomas
+ *
+ * oku is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * oku is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+ * License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with oku.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS OR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/***************/
+/* Description */
+/***************/
+
+/* Four level grayscale image, see graymap.h. */
+
+#include "graymap.h"
+#include "bitmap.h"
+#include "oku_mem.h"
+#include "oku_types.h"
+
+/************************/
+/* Forward Declarations */
+/************************/
+
+static resolution graymap_height(GRAYMAP *gm);
+static enum GRAY_LEVEL coverage_level(byte coverage);
+
+/************************/
+/* Interface Definition */
+/************************/
+
+/* Function: graymap_create()
+
+   The object and both planes are allocated as a single zeroed block,
+   the buffers following the object. */
+GRAYMAP *
+graymap_create(resolution width, resolution height)
+{
+    if (width == 0 || height == 0)
+	return NULL;
+
+    members pitch  = (width + 7) / 8;
+    members length = pitch * height;
+    GRAYMAP *gm = oku_alloc(sizeof *gm + GRAY_PLANES * length);
+
+    graymap_assign(pitch, width, height, (byte *)(gm + 1), gm);
+
+    return gm;
+}
+
+/* Function: graymap_assign()
+
+   Both planes are assigned with bitmap_ft(), which checks the pitch
+   is wide enough. */
+int
+graymap_assign(members pitch, resolution width, resolution height,
+	       byte *buffer, GRAYMAP *out)
+{
+    if (buffer == NULL)
+	return ERR_UNINITIALISED;
+
+    members length = pitch * height;
+    int err = bitmap_ft(length, pitch, width, buffer, &out->plane[GRAY_HI]);
+    if (err > 0)
+	return err;
+
+    return bitmap_ft(length, pitch, width, buffer + length,
+		     &out->plane[GRAY_LO]);
+}
+
+/* Function: graymap_coverage()
+
+   Each row is packed eight pixels at a time, the level of a pixel
+   contributing one bit to the byte of each plane. */
+int
+graymap_coverage(GRAYMAP *gm, const byte *coverage, int pitch)
+{
+    BITMAP *hi = &gm->plane[GRAY_HI];
+    BITMAP *lo = &gm->plane[GRAY_LO];
+
+    if (coverage == NULL || hi->buffer == NULL || hi->pitch == 0)
+	return ERR_UNINITIALISED;
+
+    resolution height = graymap_height(gm);
+
+    for (resolution y = 0; y < height; ++y) {
+	const byte *in = coverage + (long)y * pitch;
+	byte *out_hi = hi->buffer + y * hi->pitch;
+	byte *out_lo = lo->buffer + y * lo->pitch;
+
+	for (resolution x = 0; x < hi->width; x += 8) {
+	    byte h = 0, l = 0;
+	    for (unsigned i = 0; i < 8 && x + i < hi->width; ++i) {
+		enum GRAY_LEVEL level = coverage_level(in[x + i]);
+		h |= (level >> 1) << (7 - i);
+		l |= (level & 1) << (7 - i);
+	    }
+	    out_hi[x / 8] = h;
+	    out_lo[x / 8] = l;
+	}
+    }
+
+    return OK;
+}
+
+/* Function: graymap_modify_px()
+
+   Each bit of the level sets or unsets the pixel in its plane. */
+int
+graymap_modify_px(GRAYMAP *gm, coordinate x, coordinate y,
+		  enum GRAY_LEVEL level)
+{
+    if (level > GRAY_BLACK)
+	return ERR_INPUT;
+
+    int err = bitmap_modify_px(&gm->plane[GRAY_HI], x, y, level & 2
+			       ? SET_PIXEL_BLACK : SET_PIXEL_WHITE);
+    if (err > 0)
+	return err;
+
+    return bitmap_modify_px(&gm->plane[GRAY_LO], x, y, level & 1
+			    ? SET_PIXEL_BLACK : SET_PIXEL_WHITE);
+}
+
+/* Function: graymap_level()
+
+   Reads one bit from each plane. */
+int
+graymap_level(GRAYMAP *gm, coordinate x, coordinate y)
+{
+    BITMAP *hi = &gm->plane[GRAY_HI];
+    BITMAP *lo = &gm->plane[GRAY_LO];
+
+    if (x >= hi->width || y >= graymap_height(gm))
+	return -1;
+
+    byte mask = 0x80 >> (x % 8);
+    int h = !!(hi->buffer[y * hi->pitch + x / 8] & mask);
+    int l = !!(lo->buffer[y * lo->pitch + x / 8] & mask);
+
+    return h << 1 | l;
+}
+
+/* Function: graymap_clear()
+
+   Clears both planes. */
+int
+graymap_clear(GRAYMAP *gm)
+{
+    int err = bitmap_clear(&gm->plane[GRAY_HI]);
+    if (err > 0)
+	return err;
+
+    return bitmap_clear(&gm->plane[GRAY_LO]);
+}
+
+/* Function: graymap_blit()
+
+   Each plane is blitted with bitmap_blit(), which clips and works a
+   word at a time. Combining levels bit by bit, BLIT_OR never gives a
+   lighter level than either input. */
+int
+graymap_blit(GRAYMAP *gm, GRAYMAP *rectangle, int x, int y, enum BLIT_OP op)
+{
+    for (unsigned p = 0; p < GRAY_PLANES; ++p) {
+	int err = bitmap_blit(&gm->plane[p], &rectangle->plane[p], x, y, op);
+	if (err > 0)
+	    return err;
+    }
+
+    return OK;
+}
+
+/* Function: graymap_threshold()
+
+   A level is at or darker than GRAY_LIGHT if either bit is set,
+   GRAY_DARK if the high bit is set and GRAY_BLACK if both are. */
+int
+graymap_threshold(GRAYMAP *gm, enum GRAY_LEVEL level, BITMAP *bmp)
+{
+    BITMAP *hi = &gm->plane[GRAY_HI];
+    BITMAP *lo = &gm->plane[GRAY_LO];
+
+    if (bmp->width != hi->width || bmp->pitch != hi->pitch
+	|| bmp->length != hi->length || level > GRAY_BLACK)
+	return ERR_INPUT;
+
+    for (members i = 0; i < bmp->length; ++i) {
+	switch (level) {
+	case GRAY_WHITE: bmp->buffer[i] = 0xFF;                          break;
+	case GRAY_LIGHT: bmp->buffer[i] = hi->buffer[i] | lo->buffer[i]; break;
+	case GRAY_DARK:  bmp->buffer[i] = hi->buffer[i];                 break;
+	case GRAY_BLACK: bmp->buffer[i] = hi->buffer[i] & lo->buffer[i]; break;
+	}
+    }
+
+    return OK;
+}
+
+/* Function: graymap_destroy()
+
+   The planes were allocated with the object. */
+int
+graymap_destroy(GRAYMAP *gm)
+{
+    if (gm == NULL)
+	return ERR_UNINITIALISED;
+
+    oku_free(gm);
+
+    return OK;
+}
+
+/********************/
+/* Static Functions */
+/********************/
+
+/* Static Function: graymap_height()
+
+   Number of rows in each plane. */
+static resolution
+graymap_height(GRAYMAP *gm)
+{
+    return gm->plane[GRAY_HI].length / gm->plane[GRAY_HI].pitch;
+}
+
+/* Static Function: coverage_level()
+
+   Nearest level to an 8 bit coverage, 0 being none and 255 full. */
+static enum GRAY_LEVEL
+coverage_level(byte coverage)
+{
+    return (coverage * 3 + 127) / 255;
+}
@@ -0,0 +1,137 @@
+/* graymap.h
+ *
+ * This file is part of oku.
+ *
+ * Copyright (C) 2019 Ellis Rhys Thomas
+ *
+ * oku is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * oku is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+ * License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with oku.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS OR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/***************/
+/* Description */
+/***************/
+
+/* Four level grayscale image for panels with a 2 bit per pixel
+   waveform.
+
+   A grayscale panel holds the two bits of each pixel's level in two
+   separate RAM banks, each laid out exactly as a 1 bit per pixel
+   frame. A GRAYMAP is kept the same way: two planes, each a BITMAP as
+   described in bitmap.h, so either can be sent to the device or
+   written out as PBM unchanged. Plane GRAY_HI holds the high bit of
+   every level and plane GRAY_LO the low bit. Level 0 is white and
+   level 3 black, as a set bit is black in a BITMAP.
+
+   Operations mirror those on a BITMAP and are applied to both planes
+   in turn, so a raster operation works on whole bytes of eight
+   pixels at once rather than on levels. */
+
+#ifndef GRAYMAP_H
+#define GRAYMAP_H
+
+#include "oku_types.h"
+#include "bitmap.h"
+
+#define GRAY_PLANES 2		/* Bits per pixel */
+#define GRAY_HI 0		/* Plane holding the high bit of a level */
+#define GRAY_LO 1		/* Plane holding the low bit */
+
+/***********/
+/* Objects */
+/***********/
+
+/* Gray levels, from paper to full ink. */
+enum GRAY_LEVEL { GRAY_WHITE, GRAY_LIGHT, GRAY_DARK, GRAY_BLACK };
+
+/* Object: GRAYMAP
+
+   Two equally sized bit planes. The buffers of both planes are
+   allocated together, GRAY_LO directly following GRAY_HI. */
+typedef struct GRAYMAP {
+    BITMAP plane[GRAY_PLANES];
+} GRAYMAP;
+
+/**************************/
+/* Interface Deceleration */
+/**************************/
+
+/* Function: graymap_create()
+
+   Allocate a white graymap of width x height pixels. Returns NULL
+   with invalid arguments. Exits on memory error. */
+GRAYMAP *graymap_create(resolution width, resolution height);
+
+/* Function: graymap_assign()
+
+   Define a graymap over the existing buffer, which must hold both
+   planes of pitch x height bytes one after the other. Memory is
+   controlled by the caller, used for cached glyph images. */
+int graymap_assign(members pitch, resolution width, resolution height,
+		   byte *buffer, GRAYMAP *out);
+
+/* Function: graymap_coverage()
+
+   Fill gm from an 8 bit coverage image of the same size, such as a
+   FreeType anti-aliased glyph, rows pitch bytes apart. Coverage is
+   divided evenly between the four levels. */
+int graymap_coverage(GRAYMAP *gm, const byte *coverage, int pitch);
+
+/* Function: graymap_modify_px()
+
+   Set the pixel at (x,y) to level. */
+int graymap_modify_px(GRAYMAP *gm, coordinate x, coordinate y,
+		      enum GRAY_LEVEL level);
+
+/* Function: graymap_level()
+
+   Returns the level of the pixel at (x,y), or -1 if it lies outside
+   gm. */
+int graymap_level(GRAYMAP *gm, coordinate x, coordinate y);
+
+/* Function: graymap_clear()
+
+   Set every pixel to white. */
+int graymap_clear(GRAYMAP *gm);
+
+/* Function: graymap_blit()
+
+   Combine rectangle into gm at (x,y) using the raster operation op on
+   each plane, clipped to the edges of gm. With BLIT_OR overlapping
+   pixels take at least the darker of the two levels, so glyphs that
+   touch keep their ink. */
+int graymap_blit(GRAYMAP *gm, GRAYMAP *rectangle, int x, int y,
+		 enum BLIT_OP op);
+
+/* Function: graymap_threshold()
+
+   Write the pixels of gm at or darker than level as black into bmp,
+   which must have the same dimensions, for a 1 bit per pixel refresh
+   of a grayscale page. */
+int graymap_threshold(GRAYMAP *gm, enum GRAY_LEVEL level, BITMAP *bmp);
+
+/* Function: graymap_destroy()
+
+   Free all memory allocated for a graymap made by graymap_create(). */
+int graymap_destroy(GRAYMAP *gm);
+
+#endif	/* GRAYMAP_H */
@@ -0,0 +1,626 @@
+/* image.c
+ *
+ * This file is part of oku.
+ *
+ * Copyright (C) 2019 Ellis Rhys Thomas
+ *
+ * oku is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * oku is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+ * License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with oku.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS OR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+/***************/
+/* Description */
+/***************/
+
+/* Illustrations, see image.h. */
+
+#include <ctype.h>		/* isspace(), isdigit() */
+#include <stdint.h>		/* uint64_t */
+#include <stdio.h>		/* FILE* */
+#include <string.h>		/* memcpy(), strcmp(), strlen() */
+#include <sys/stat.h>		/* stat() */
+
+#ifdef OKU_PNG
+#include <png.h>
+#endif
+
+#include "image.h"
+#include "oku_mem.h"
+#include "oku_types.h"
+
+#define PNM_MAX 65535		/* Largest maxval of a PGM */
+#define THRESHOLD 128		/* Gray below which a pixel is black */
+
+/* Formats recognised by their signature. */
+enum FORMAT { FORMAT_PBM, FORMAT_PGM, FORMAT_PNG };
+
+/* Object: DECODER
+
+   Open image and the buffer one row of it is read into. */
+typedef struct DECODER {
+    FILE       *file;
+    enum FORMAT format;
+    resolution  width;		/* Source dimensions (px) */
+    resolution  height;
+    unsigned    maxval;		/* Gray of white, PGM only */
+    byte       *raw;		/* One row as stored */
+    members     raw_len;	/* Length of raw (B) */
+#ifdef OKU_PNG
+    png_structp png;
+    png_infop   info;
+#endif
+} DECODER;
+
+/* Object: SCALER
+
+   Box filter and error diffusion state. Output column x is the mean
+   of source columns start[x] to start[x + 1] - 1, or of start[x]
+   alone when enlarging. */
+typedef struct SCALER {
+    resolution  src_height;
+    resolution  width;		/* Output dimensions (px) */
+    resolution  height;
+    resolution *start;		/* First source column of each box */
+    uint64_t   *sum;		/* Sum of each box so far */
+    members     rows;		/* Source rows in sum */
+    coordinate  y;		/* Next output row */
+    int        *err;		/* Error carried to this row */
+    int        *next;		/* Error carried to the next row */
+} SCALER;
+
+/************************/
+/* Forward Declarations */
+/************************/
+
+static int decoder_open(const char *path, DECODER *dec);
+static int decoder_row(DECODER *dec, byte *gray);
+static void decoder_close(DECODER *dec);
+static int pnm_number(FILE *f, unsigned *out);
+#ifdef OKU_PNG
+static int png_open(DECODER *dec);
+static int png_row(DECODER *dec, byte *gray);
+#endif
+
+static void fit(resolution src_w, resolution src_h, resolution *width,
+		resolution *height);
+static void scaler_init(SCALER *sc, resolution src_w, resolution src_h,
+			resolution width, resolution height);
+static void scaler_row(SCALER *sc, const byte *gray, coordinate src_y,
+		       BITMAP *bmp);
+static void dither_row(SCALER *sc, BITMAP *bmp);
+static void scaler_free(SCALER *sc);
+
+static int image_current(IMAGE *image, const char *path, time_t mtime,
+			 resolution width, resolution height);
+
+/************************/
+/* Interface Definition */
+/************************/
+
+/* Function: image_decode()
+
+   [1] The image header gives its size, and so the output size,
+       before any pixels are read.
+
+   [2] Each source row is converted to 8 bit gray, 0 black, and passed
+       to the scaler, which dithers output rows into bmp as their
+       boxes are completed. */
+int
+image_decode(const char *path, resolution width, resolution height,
+	     BITMAP **out)
+{
+    DECODER dec = { 0 };
+    SCALER sc = { 0 };
+    BITMAP *bmp = NULL;
+    byte *gray = NULL;
+
+    if (path == NULL || out == NULL || width == 0 || height == 0)
+	return ERR_INPUT;
+
+    /* [1] */
+    int err = decoder_open(path, &dec);
+    if (err > 0)
+	return err;
+
+    fit(dec.width, dec.height, &width, &height);
+    bmp = bitmap_create(width, height);
+    if (bmp == NULL) {
+	err = ERR_INPUT;
+	goto out;
+    }
+    scaler_init(&sc, dec.width, dec.height, width, height);
+    gray = oku_alloc(dec.width); /* exits on failure */
+
+    /* [2] */
+    for (coordinate y = 0; y < dec.height; ++y) {
+	err = decoder_row(&dec, gray);
+	if (err > 0)
+	    goto out;
+	scaler_row(&sc, gray, y, bmp);
+    }
+
+ out:
+    oku_free(gray);
+    scaler_free(&sc);
+    decoder_close(&dec);
+
+    if (err > 0) {
+	if (bmp)
+	    bitmap_destroy(bmp);
+	return err;
+    }
+
+    *out = bmp;
+    return OK;
+}
+
+/* Function: images_create()
+
+   Allocates a cache with every entry free. */
+IMAGES *
+images_create(void)
+{
+    return oku_alloc(sizeof(IMAGES)); /* exits on failure */
+}
+
+/* Function: images_get()
+
+   [1] A hit must match the file as it is now, a changed file is
+       decoded again.
+
+   [2] On a miss the image is decoded into a free entry or, failing
+       that, the least recently used one. */
+int
+images_get(IMAGES *cache, const char *path, resolution width,
+	   resolution height, BITMAP **out)
+{
+    struct stat st;
+    IMAGE *victim = NULL;
+
+    if (cache == NULL)
+	return ERR_UNINITIALISED;
+    if (path == NULL || out == NULL)
+	return ERR_INPUT;
+    if (stat(path, &st))
+	return ERR_IO;
+
+    /* [1] */
+    ++cache->clock;
+    for (members i = 0; i < IMAGE_CACHE_SIZE; ++i) {
+	IMAGE *image = &cache->entry[i];
+	if (image_current(image, path, st.st_mtime, width, height)) {
+	    image->used = cache->clock;
+	    *out = image->bmp;
+	    return OK;
+	}
+	if (victim == NULL || image->bmp == NULL
+	    || (victim->bmp && image->used < victim->used))
+	    victim = image;
+    }
+
+    /* [2] */
+    BITMAP *bmp = NULL;
+    int err = image_decode(path, width, height, &bmp);
+    if (err > 0)
+	return err;
+
+    if (victim->bmp) {
+	bitmap_destroy(victim->bmp);
+	oku_free(victim->path);
+    }
+
+    members len = strlen(path) + 1;
+    victim->path   = oku_alloc(len); /* exits on failure */
+    memcpy(victim->path, path, len);
+    victim->mtime  = st.st_mtime;
+    victim->width  = width;
+    victim->height = height;
+    victim->bmp    = bmp;
+    victim->used   = cache->clock;
+
+    *out = bmp;
+    return OK;
+}
+
+/* Function: images_destroy()
+
+   Frees all memory associated with the cache. */
+int
+images_destroy(IMAGES *cache)
+{
+    if (cache == NULL)
+	return ERR_UNINITIALISED;
+
+    for (members i = 0; i < IMAGE_CACHE_SIZE; ++i)
+	if (cache->entry[i].bmp) {
+	    bitmap_destroy(cache->entry[i].bmp);
+	    oku_free(cache->entry[i].path);
+	}
+
+    oku_free(cache);
+    return OK;
+}
+
+/********************/
+/* Static Functions */
+/********************/
+
+/* Static Function: decoder_open()
+
+   [1] The format is recognised by its signature. PBM and PGM headers
+       are the magic number then whitespace separated decimal width,
+       height and, for PGM, maxval. A single whitespace character
+       separates the header from the raster.
+
+   [2] Only the binary variants are read, as written by pbm.h. */
+static int
+decoder_open(const char *path, DECODER *dec)
+{
+    byte sig[8] = { 0 };
+    unsigned w = 0, h = 0, maxval = 1;
+    int err = ERR_INPUT;
+
+    dec->file = fopen(path, "rb");
+    if (dec->file == NULL)
+	return ERR_IO;
+
+    /* [1] */
+    if (fread(sig, 1, 2, dec->file) != 2)
+	goto fail;
+
+    if (sig[0] == 'P' && (sig[1] == '4' || sig[1] == '5')) { /* [2] */
+	dec->format = sig[1] == '4' ? FORMAT_PBM : FORMAT_PGM;
+	if (pnm_number(dec->file, &w) || pnm_number(dec->file, &h)
+	    || (dec->format == FORMAT_PGM && pnm_number(dec->file, &maxval))
+	    || !isspace(fgetc(dec->file)))
+	    goto fail;
+	if (w == 0 || h == 0 || w > UINT16_MAX || h > UINT16_MAX
+	    || maxval == 0 || maxval > PNM_MAX)
+	    goto fail;
+
+	dec->width   = w;
+	dec->height  = h;
+	dec->maxval  = maxval;
+	dec->raw_len = dec->format == FORMAT_PBM ? (w + 7) / 8
+	    : maxval > 255 ? 2 * w : w;
+	dec->raw     = oku_alloc(dec->raw_len); /* exits on failure */
+	return OK;
+    }
+
+#ifdef OKU_PNG
+    if (fread(sig + 2, 1, 6, dec->file) == 6 && !png_sig_cmp(sig, 0, 8)) {
+	dec->format = FORMAT_PNG;
+	err = png_open(dec);
+	if (err > 0)
+	    goto fail;
+	return OK;
+    }
+#endif
+
+ fail:
+    decoder_close(dec);
+    return err;
+}
+
+/* Static Function: decoder_row()
+
+   Reads the next row of the image as 8 bit gray into gray. In PBM 1
+   is black, in PGM 0 is black and maxval white. */
+static int
+decoder_row(DECODER *dec, byte *gray)
+{
+#ifdef OKU_PNG
+    if (dec->format == FORMAT_PNG)
+	return png_row(dec, gray);
+#endif
+
+    if (fread(dec->raw, 1, dec->raw_len, dec->file) != dec->raw_len)
+	return ERR_IO;
+
+    const byte *raw = dec->raw;
+    unsigned max = dec->maxval;
+
+    if (dec->format == FORMAT_PBM)
+	for (resolution x = 0; x < dec->width; ++x)
+	    gray[x] = raw[x / 8] & (0x80 >> x % 8) ? 0 : 255;
+    else if (max > 255)
+	for (resolution x = 0; x < dec->width; ++x) {
+	    unsigned v = raw[2 * x] << 8 | raw[2 * x + 1];
+	    gray[x] = (v > max ? max : v) * 255 / max;
+	}
+    else if (max != 255)
+	for (resolution x = 0; x < dec->width; ++x)
+	    gray[x] = (raw[x] > max ? max : raw[x]) * 255 / max;
+    else
+	memcpy(gray, raw, dec->width);
+
+    return OK;
+}
+
+/* Static Function: decoder_close()
+
+   Releases the file and buffers of dec. */
+static void
+decoder_close(DECODER *dec)
+{
+#ifdef OKU_PNG
+    if (dec->png)
+	png_destroy_read_struct(&dec->png, &dec->info, NULL);
+#endif
+    if (dec->file)
+	fclose(dec->file);
+    if (dec->raw)
+	oku_free(dec->raw);
+
+    *dec = (DECODER){ 0 };
+    return;
+}
+
+/* Static Function: pnm_number()
+
+   Reads a decimal header field, skipping whitespace and comments
+   before it. Returns non-zero if there is none. */
+static int
+pnm_number(FILE *f, unsigned *out)
+{
+    int c = fgetc(f);
+
+    while (isspace(c) || c == '#') {
+	if (c == '#')
+	    while (c != '\n' && c != EOF)
+		c = fgetc(f);
+	c = fgetc(f);
+    }
+
+    if (!isdigit(c))
+	return 1;
+
+    unsigned long n = 0;
+    for (; isdigit(c); c = fgetc(f))
+	if ((n = n * 10 + (c - '0')) > PNM_MAX)
+	    return 1;
+    ungetc(c, f);
+
+    *out = n;
+    return 0;
+}
+
+#ifdef OKU_PNG
+/* Static Function: png_open()
+
+   [1] libpng reports errors by longjmp() to the last setjmp().
+
+   [2] libpng is asked to deliver every image as 8 bit gray, alpha
+       composited over white. Interlaced images can only be decoded
+       whole, so are not supported. */
+static int
+png_open(DECODER *dec)
+{
+    dec->png = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL,
+				      NULL);
+    if (dec->png == NULL)
+	return ERR_MEM;
+    dec->info = png_create_info_struct(dec->png);
+    if (dec->info == NULL)
+	return ERR_MEM;
+
+    /* [1] */
+    if (setjmp(png_jmpbuf(dec->png)))
+	return ERR_INPUT;
+
+    png_init_io(dec->png, dec->file);
+    png_set_sig_bytes(dec->png, 8);
+    png_read_info(dec->png, dec->info);
+
+    /* [2] */
+    png_uint_32 w = png_get_image_width(dec->png, dec->info);
+    png_uint_32 h = png_get_image_height(dec->png, dec->info);
+    if (w == 0 || h == 0 || w > UINT16_MAX || h > UINT16_MAX
+	|| png_get_interlace_type(dec->png, dec->info) != PNG_INTERLACE_NONE)
+	return ERR_INPUT;
+
+    png_color_16 white = { 0, 255, 255, 255, 255 };
+    png_set_expand(dec->png);
+    png_set_strip_16(dec->png);
+    png_set_rgb_to_gray_fixed(dec->png, 1, -1, -1);
+    png_set_background(dec->png, &white, PNG_BACKGROUND_GAMMA_SCREEN, 0, 1.0);
+    png_read_update_info(dec->png, dec->info);
+
+    if (png_get_rowbytes(dec->png, dec->info) != w)
+	return ERR_INPUT;
+
+    dec->width  = w;
+    dec->height = h;
+    return OK;
+}
+
+/* Static Function: png_row()
+
+   Reads the next row, already transformed to 8 bit gray. */
+static int
+png_row(DECODER *dec, byte *gray)
+{
+    if (setjmp(png_jmpbuf(dec->png)))
+	return ERR_INPUT;
+
+    png_read_row(dec->png, gray, NULL);
+    return OK;
+}
+#endif
+
+/* Static Function: fit()
+
+   Reduces the box *width x *height to the largest size with the
+   aspect ratio of a src_w x src_h image, at least one pixel each
+   way. */
+static void
+fit(resolution src_w, resolution src_h, resolution *width,
+    resolution *height)
+{
+    uint64_t h = (uint64_t)src_h * *width / src_w;
+
+    if (h <= *height) {
+	*height = h ? h : 1;
+	return;
+    }
+
+    uint64_t w = (uint64_t)src_w * *height / src_h;
+    *width = w ? w : 1;
+    return;
+}
+
+/* Static Function: scaler_init()
+
+   Works out the source columns of every output column once. Error
+   rows have a column of padding either side so diffusion needs no
+   edge tests. */
+static void
+scaler_init(SCALER *sc, resolution src_w, resolution src_h,
+	    resolution width, resolution height)
+{
+    sc->src_height = src_h;
+    sc->width      = width;
+    sc->height     = height;
+    sc->start      = oku_arrayalloc(width + 1, sizeof *sc->start);
+    sc->sum        = oku_arrayalloc(width, sizeof *sc->sum);
+    sc->err        = oku_arrayalloc(width + 2, sizeof *sc->err);
+    sc->next       = oku_arrayalloc(width + 2, sizeof *sc->next);
+
+    for (members x = 0; x <= width; ++x)
+	sc->start[x] = (uint64_t)x * src_w / width;
+
+    return;
+}
+
+/* Static Function: scaler_row()
+
+   [1] Source row src_y is added to the sum of every box.
+
+   [2] Output row y is the mean of source rows y * src_height /
+       height up to, but not including, the first row of the next
+       output row. When enlarging that range is a single row, shared
+       by every output row starting within it, so the sums are kept
+       until the next output row starts on a later source row. */
+static void
+scaler_row(SCALER *sc, const byte *gray, coordinate src_y, BITMAP *bmp)
+{
+    /* [1] */
+    for (resolution x = 0; x < sc->width; ++x) {
+	resolution end = sc->start[x + 1] > sc->start[x]
+	    ? sc->start[x + 1] : sc->start[x] + 1;
+	uint64_t sum = 0;
+	for (resolution c = sc->start[x]; c < end; ++c)
+	    sum += gray[c];
+	sc->sum[x] += sum;
+    }
+    ++sc->rows;
+
+    /* [2] */
+    while (sc->y < sc->height) {
+	uint64_t first = (uint64_t)sc->y * sc->src_height / sc->height;
+	uint64_t next = (uint64_t)(sc->y + 1) * sc->src_height / sc->height;
+	if ((next > first ? next : first + 1) > (uint64_t)src_y + 1)
+	    break;
+
+	dither_row(sc, bmp);
+	++sc->y;
+
+	if (next > src_y) {
+	    memset(sc->sum, 0, sc->width * sizeof *sc->sum);
+	    sc->rows = 0;
+	}
+    }
+
+    return;
+}
+
+/* Static Function: dither_row()
+
+   Floyd-Steinberg error diffusion of the mean of each box, left to
+   right. The error of each pixel is passed on 7/16 to the right and
+   3/16, 5/16 and 1/16 to the pixels below left, below and below
+   right. Black pixels are set in output row y of bmp, which is
+   clear. */
+static void
+dither_row(SCALER *sc, BITMAP *bmp)
+{
+    byte *row = bmp->buffer + (members)sc->y * bmp->pitch;
+    int *err = sc->err + 1, *next = sc->next + 1;
+
+    for (resolution x = 0; x < sc->width; ++x) {
+	resolution end = sc->start[x + 1] > sc->start[x]
+	    ? sc->start[x + 1] : sc->start[x] + 1;
+	uint64_t area = (uint64_t)(end - sc->start[x]) * sc->rows;
+	int v = sc->sum[x] / area + err[x] / 16;
+	int out = v < THRESHOLD ? 0 : 255;
+	int e = v - out;
+
+	if (out == 0)
+	    row[x / 8] |= 0x80 >> x % 8;
+
+	err[x + 1]  += 7 * e;
+	next[x - 1] += 3 * e;
+	next[x]     += 5 * e;
+	next[x + 1] += 1 * e;
+    }
+
+    /* The next row's error becomes this row's, cleared for the one
+       after. */
+    int *t = sc->err;
+    sc->err  = sc->next;
+    sc->next = t;
+    memset(sc->next, 0, (sc->width + 2) * sizeof *sc->next);
+
+    return;
+}
+
+/* Static Function: scaler_free()
+
+   Releases the buffers of sc. */
+static void
+scaler_free(SCALER *sc)
+{
+    if (sc->start) {
+	oku_free(sc->start);
+	oku_free(sc->sum);
+	oku_free(sc->err);
+	oku_free(sc->next);
+    }
+
+    return;
+}
+
+/* Static Function: image_current()
+
+   Non-zero if image holds path, unchanged since mtime, fitted to
+   width x height. */
+static int
+image_current(IMAGE *image, const char *path, time_t mtime,
+	      resolution width, resolution height)
+{
+    return image->bmp
+	&& image->width  == width
+	&& image->height == height
+	&& image->mtime  == mtime
+	&& !strcmp(image->path, path);
+}
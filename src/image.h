@@ -0,0 +1,113 @@
+/* image.h
+ *
+ * This file is part of oku.
+ *
+ * Copyright (C) 2019 Ellis Rhys Thomas
+ *
+ * oku is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * oku is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+ * License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with oku.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS OR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+/***************/
+/* Description */
+/***************/
+
+/* Illustrations.
+
+   Binary PBM (P4) and PGM (P5) images, and PNG images when built with
+   OKU_PNG, are decoded a row at a time and reduced to fit a box with
+   their aspect ratio kept. Each output pixel is the mean of the box
+   of source pixels it covers, and each output row is dithered with
+   Floyd-Steinberg error diffusion into a 1 bpp bitmap as soon as it
+   is complete. Only a row of the source, a row of sums and two rows
+   of error are held, never the whole grayscale image.
+
+   Decoded images are kept in a small cache keyed by path, box size
+   and modification time, so showing an image again does not decode
+   it again. */
+
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <time.h>		/* time_t */
+
+#include "oku_types.h"
+#include "bitmap.h"
+
+#define IMAGE_CACHE_SIZE 8	/* Images kept decoded */
+
+/***********/
+/* Objects */
+/***********/
+
+/* Object: IMAGE
+
+   Cached image, an entry is free while bmp is NULL. */
+typedef struct IMAGE {
+    char         *path;		/* Image file */
+    time_t        mtime;	/* Modification time when decoded */
+    resolution    width;	/* Box the image was fitted to (px) */
+    resolution    height;
+    BITMAP       *bmp;		/* Dithered image */
+    unsigned long used;		/* Clock at last use */
+} IMAGE;
+
+/* Object: IMAGES
+
+   Least recently used cache of decoded images. */
+typedef struct IMAGES {
+    IMAGE         entry[IMAGE_CACHE_SIZE];
+    unsigned long clock;	/* Incremented on every lookup */
+} IMAGES;
+
+/**************************/
+/* Interface Deceleration */
+/**************************/
+
+/* Function: image_decode()
+
+   Decode the image at path, scaled to the largest size that fits
+   within width x height, into a new bitmap stored in *out. Returns
+   ERR_INPUT if the format is not supported. */
+int image_decode(const char *path, resolution width, resolution height,
+		 BITMAP **out);
+
+/* Function: images_create()
+
+   Allocate an empty image cache. Exits on memory error. */
+IMAGES *images_create(void);
+
+/* Function: images_get()
+
+   As image_decode(), returning the cached bitmap when the same image
+   has been decoded for the same box. The bitmap belongs to the cache
+   and remains valid until IMAGE_CACHE_SIZE other images are got. */
+int images_get(IMAGES *cache, const char *path, resolution width,
+	       resolution height, BITMAP **out);
+
+/* Function: images_destroy()
+
+   Free the cache and every image held in it. */
+int images_destroy(IMAGES *cache);
+
+#endif	/* IMAGE_H */
@@ -0,0 +1,334 @@
+/* mempool.c
+ *
+ * This file is part of oku.
+ *
+ * Copyright (C) 2019 Ellis Rhys Thomas
+ *
+ * oku is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * oku is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+ * License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with oku.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS OR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/***************/
+/* Description */
+/***************/
+
+/* Arena and size class pool allocators, see mempool.h. */
+
+#include <stdint.h>		/* uintptr_t */
+#include <pthread.h>
+
+#include "mempool.h"
+#include "oku_mem.h"
+#include "oku_types.h"
+
+/* Round n up to a multiple of MEMPOOL_ALIGN. */
+#define ALIGN_UP(n) (((n) + MEMPOOL_ALIGN - 1) & ~(size_t)(MEMPOOL_ALIGN - 1))
+
+/* Object: CHUNK
+
+   Block of memory obtained from malloc() and carved up by an
+   arena. */
+typedef struct CHUNK {
+    struct CHUNK *next;		/* Following chunk, or NULL */
+    size_t        size;		/* Usable bytes from data */
+    byte         *data;		/* First aligned byte */
+} CHUNK;
+
+/************************/
+/* Forward Declarations */
+/************************/
+
+static CHUNK *chunk_create(size_t size);
+static unsigned size_class(size_t bytes);
+static size_t class_bytes(unsigned c);
+static void *large_alloc(size_t bytes);
+static void large_free(void *mem);
+
+/************************/
+/* Interface Definition */
+/************************/
+
+/* Function: arena_init()
+
+   The arena starts without chunks. */
+void
+arena_init(ARENA *arena, size_t chunk_size)
+{
+    arena->first      = NULL;
+    arena->current    = NULL;
+    arena->chunk_size = chunk_size ? ALIGN_UP(chunk_size) : ARENA_CHUNK;
+    arena->used       = 0;
+    arena->chunks     = 0;
+
+    return;
+}
+
+/* Function: arena_alloc()
+
+   [1] Chunks too small for the request are passed over, their unused
+       tail is reclaimed by the next reset.
+
+   [2] Only once every chunk has been passed is a new one made, large
+       enough for the request if that exceeds the chunk size. */
+void *
+arena_alloc(ARENA *arena, size_t bytes)
+{
+    bytes = bytes ? ALIGN_UP(bytes) : MEMPOOL_ALIGN;
+
+    while (arena->current			/* [1] */
+	   && arena->used + bytes > arena->current->size) {
+	arena->current = arena->current->next;
+	arena->used = 0;
+    }
+
+    if (arena->current == NULL) {		/* [2] */
+	CHUNK *c = chunk_create(bytes > arena->chunk_size
+				? bytes : arena->chunk_size);
+	CHUNK **tail = &arena->first;
+	while (*tail)
+	    tail = &(*tail)->next;
+	*tail = c;
+	arena->current = c;
+	arena->used = 0;
+	++arena->chunks;
+    }
+
+    void *mem = arena->current->data + arena->used;
+    arena->used += bytes;
+
+    return mem;
+}
+
+/* Function: arena_reset()
+
+   Allocation starts again from the first chunk. */
+void
+arena_reset(ARENA *arena)
+{
+    arena->current = arena->first;
+    arena->used = 0;
+
+    return;
+}
+
+/* Function: arena_destroy()
+
+   Frees every chunk, leaving the arena empty but usable. */
+void
+arena_destroy(ARENA *arena)
+{
+    CHUNK *c = arena->first;
+
+    while (c) {
+	CHUNK *next = c->next;
+	oku_free(c);
+	c = next;
+    }
+    arena->first = arena->current = NULL;
+    arena->used = 0;
+
+    return;
+}
+
+/* Function: mempool_create()
+
+   Returns NULL if the lock cannot be initialised. */
+MEMPOOL *
+mempool_create(size_t chunk_size)
+{
+    MEMPOOL *pool = oku_alloc(sizeof *pool); /* zeroed, exits on failure */
+
+    arena_init(&pool->arena, chunk_size);
+    if (pthread_mutex_init(&pool->lock, NULL)) {
+	oku_free(pool);
+	return NULL;
+    }
+
+    return pool;
+}
+
+/* Function: mempool_alloc()
+
+   A free block is linked through its first bytes, every block being
+   at least a cache line long. */
+void *
+mempool_alloc(MEMPOOL *pool, size_t bytes)
+{
+    unsigned c = size_class(bytes);
+    void *mem;
+
+    if (c == MEMPOOL_CLASSES)
+	return large_alloc(bytes);
+
+    pthread_mutex_lock(&pool->lock);
+    mem = pool->free[c];
+    if (mem)
+	pool->free[c] = *(void **)mem;
+    else
+	mem = arena_alloc(&pool->arena, class_bytes(c));
+    pthread_mutex_unlock(&pool->lock);
+
+    return mem;
+}
+
+/* Function: mempool_free()
+
+   Pushes the block onto the free list of its class. */
+void
+mempool_free(MEMPOOL *pool, void *mem, size_t bytes)
+{
+    if (mem == NULL)
+	return;
+
+    unsigned c = size_class(bytes);
+    if (c == MEMPOOL_CLASSES) {
+	large_free(mem);
+	return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    *(void **)mem = pool->free[c];
+    pool->free[c] = mem;
+    pthread_mutex_unlock(&pool->lock);
+
+    return;
+}
+
+/* Function: mempool_reset()
+
+   Empties the free lists and resets the arena beneath them. */
+void
+mempool_reset(MEMPOOL *pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    for (unsigned c = 0; c < MEMPOOL_CLASSES; ++c)
+	pool->free[c] = NULL;
+    arena_reset(&pool->arena);
+    pthread_mutex_unlock(&pool->lock);
+
+    return;
+}
+
+/* Function: mempool_destroy()
+
+   Frees the chunks, then the pool itself. */
+int
+mempool_destroy(MEMPOOL *pool)
+{
+    if (pool == NULL)
+	return ERR_UNINITIALISED;
+
+    arena_destroy(&pool->arena);
+    pthread_mutex_destroy(&pool->lock);
+    oku_free(pool);
+
+    return OK;
+}
+
+/********************/
+/* Static Functions */
+/********************/
+
+/* Static Function: chunk_create()
+
+   Allocate a chunk with size usable bytes, its data aligned to
+   MEMPOOL_ALIGN. Exits on memory error. */
+static CHUNK *
+chunk_create(size_t size)
+{
+    CHUNK *c = oku_alloc(sizeof *c + MEMPOOL_ALIGN - 1 + size);
+    uintptr_t data = (uintptr_t)(c + 1);
+
+    c->next = NULL;
+    c->size = size;
+    c->data = (byte *)ALIGN_UP(data);
+
+    return c;
+}
+
+/* Static Function: size_class()
+
+   Returns the smallest class of blocks holding bytes, see
+   class_bytes(), or MEMPOOL_CLASSES if bytes exceeds the largest.
+
+   [1] Requests are counted in cache lines, n. From four lines on, n
+       lies in [4 << k, 8 << k) for step k, which is split into four
+       classes of 1 << k lines each. */
+static unsigned
+size_class(size_t bytes)
+{
+    size_t n = bytes ? (bytes + MEMPOOL_ALIGN - 1) / MEMPOOL_ALIGN : 1;
+    unsigned c;
+
+    if (n <= 4) {
+	c = n - 1;
+    } else {			/* [1] */
+	unsigned k = 8 * sizeof n - 1 - __builtin_clzl(n) - 2;
+	size_t s = ((n + ((size_t)1 << k) - 1) >> k) - 4;
+	c = 3 + 4 * k + s;	/* s of 4 is the next step's first */
+    }
+
+    return c < MEMPOOL_CLASSES ? c : MEMPOOL_CLASSES;
+}
+
+/* Static Function: class_bytes()
+
+   Size of the blocks of class c. Classes 0 to 3 are one to four
+   cache lines, each class after is 4 + s lines shifted left by k,
+   where c = 3 + 4k + s. */
+static size_t
+class_bytes(unsigned c)
+{
+    if (c < 3)
+	return (size_t)MEMPOOL_ALIGN * (c + 1);
+
+    c -= 3;
+
+    return (size_t)MEMPOOL_ALIGN * ((4 + c % 4) << c / 4);
+}
+
+/* Static Function: large_alloc()
+
+   Allocate a block too large for any class on its own, aligned to
+   MEMPOOL_ALIGN. The allocation itself is recorded just before the
+   block for large_free(). Exits on memory error. */
+static void *
+large_alloc(size_t bytes)
+{
+    byte *raw = oku_alloc(bytes + MEMPOOL_ALIGN + sizeof(void *));
+    byte *mem = (byte *)ALIGN_UP((uintptr_t)(raw + sizeof(void *)));
+
+    ((void **)mem)[-1] = raw;
+
+    return mem;
+}
+
+/* Static Function: large_free()
+
+   Free a block from large_alloc(). */
+static void
+large_free(void *mem)
+{
+    oku_free(((void **)mem)[-1]);
+
+    return;
+}
@@ -0,0 +1,147 @@
+/* mempool.h
+ *
+ * This file is part of oku.
+ *
+ * Copyright (C) 2019 Ellis Rhys Thomas
+ *
+ * oku is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * oku is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+ * License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with oku.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS OR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/***************/
+/* Description */
+/***************/
+
+/* Arena and size class pool allocators for buffers that are made and
+   discarded while reading, such as glyph images and page bitmaps.
+
+   An arena hands out memory from large chunks by advancing a pointer
+   and releases everything at once when it is reset. Chunks are kept
+   across a reset, so an arena that has reached its working size makes
+   no further calls to malloc(). Every allocation is aligned to a
+   cache line.
+
+   A pool adds free lists to an arena so blocks may be returned one at
+   a time. Requests are rounded up to a size class and a returned
+   block is reused by the next request of the same class. Classes are
+   one to four cache lines, then four to each doubling, so a block is
+   at most a quarter larger than the request above 256 B. A page
+   bitmap of the 2.9" panel, 4800 B with its header, takes a 5120 B
+   block. Requests above the largest class, 2 MiB, bypass the pool
+   and are allocated and freed one at a time, which the size given
+   when freeing identifies. A pool is guarded by a mutex so blocks
+   may be returned by a thread other than the one that took them. */
+
+#ifndef MEMPOOL_H
+#define MEMPOOL_H
+
+#include <stddef.h>		/* size_t */
+#include <pthread.h>
+
+#include "oku_types.h"
+
+#define MEMPOOL_ALIGN 64	/* Alignment of every block (B) */
+#define MEMPOOL_CLASSES 56	/* Size classes, 64 B to 2 MiB */
+#define ARENA_CHUNK 65536	/* Default chunk size (B) */
+
+/***********/
+/* Objects */
+/***********/
+
+/* Object: ARENA
+
+   Chunks of memory allocated in turn. Chunks are linked in the order
+   they were made, current is the one being allocated from. */
+typedef struct ARENA {
+    struct CHUNK *first;	/* Oldest chunk */
+    struct CHUNK *current;	/* Chunk allocated from */
+    size_t        chunk_size;	/* Usable size of new chunks (B) */
+    size_t        used;		/* Bytes allocated from current */
+    members       chunks;	/* Chunks made, i.e. calls to malloc() */
+} ARENA;
+
+/* Object: MEMPOOL
+
+   Arena with a free list for each size class. */
+typedef struct MEMPOOL {
+    ARENA           arena;
+    void           *free[MEMPOOL_CLASSES]; /* Returned blocks by class */
+    pthread_mutex_t lock;
+} MEMPOOL;
+
+/**************************/
+/* Interface Deceleration */
+/**************************/
+
+/* Function: arena_init()
+
+   Prepare an empty arena allocating chunks of chunk_size bytes, or
+   ARENA_CHUNK if zero. No memory is allocated until it is needed. */
+void arena_init(ARENA *arena, size_t chunk_size);
+
+/* Function: arena_alloc()
+
+   Returns bytes of uninitialised memory aligned to MEMPOOL_ALIGN,
+   valid until the arena is reset. Exits on memory error. */
+void *arena_alloc(ARENA *arena, size_t bytes);
+
+/* Function: arena_reset()
+
+   Release everything allocated from the arena at once, keeping the
+   chunks for reuse. */
+void arena_reset(ARENA *arena);
+
+/* Function: arena_destroy()
+
+   Free every chunk of the arena. */
+void arena_destroy(ARENA *arena);
+
+/* Function: mempool_create()
+
+   Allocate an empty pool drawing on chunks of chunk_size bytes, or
+   ARENA_CHUNK if zero. Exits on memory error. */
+MEMPOOL *mempool_create(size_t chunk_size);
+
+/* Function: mempool_alloc()
+
+   Returns a block of at least bytes of uninitialised memory aligned
+   to MEMPOOL_ALIGN. Blocks larger than the largest size class are
+   allocated alone. Exits on memory error. */
+void *mempool_alloc(MEMPOOL *pool, size_t bytes);
+
+/* Function: mempool_free()
+
+   Return a block obtained from mempool_alloc() with the same bytes,
+   a block larger than the largest size class is freed at once. */
+void mempool_free(MEMPOOL *pool, void *mem, size_t bytes);
+
+/* Function: mempool_reset()
+
+   Return every block allocated from the pool at once. */
+void mempool_reset(MEMPOOL *pool);
+
+/* Function: mempool_destroy()
+
+   Free the pool and all memory allocated from it. */
+int mempool_destroy(MEMPOOL *pool);
+
+#endif	/* MEMPOOL_H */
@@ -45,6 +45,20 @@ void *oku_alloc(size_t bytes)
     return oku_arrayalloc(1, bytes);
 }
 
+/* Resize array at mem to n members, contents beyond the original
+   length are uninitialised. */
+void *oku_arrayrealloc(void *mem, members n, size_t bytes_per_member)
+{
+    if (bytes_per_member && n > (size_t)-1 / bytes_per_member)
+	exit(ERR_MEM);
+
+    mem = realloc(mem, n * bytes_per_member);
+    if (mem == NULL)
+	exit(ERR_MEM);
+
+    return mem;
+}
+
 void oku_free(void *mem)
 {
     free(mem);
@@ -34,6 +34,7 @@
 
 void *oku_arrayalloc(members n, size_t bytes_per_member);
 void *oku_alloc(size_t bytes);
+void *oku_arrayrealloc(void *mem, members n, size_t bytes_per_member);
 void oku_free(void *mem);
 
 #endif	/* OKU_MEM_H */
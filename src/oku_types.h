@@ -80,11 +80,13 @@ enum OKU_ERRNO
      ERR_NOT_FOUND                 = 0x08,
      ERR_RENDER                    = 0x09,
      ERR_INITIALISED               = 0x0A,
+     ERR_CANCELLED                 = 0x0B,
      /* Warnings (Negative) */
      WARN_ROOT                     = -0x01,
      WARN_REPLACEMENT_CHAR         = -0x02,
      WARN_MTBUFFER                 = -0x03,
-     WARN_EOF                      = -0x04
+     WARN_EOF                      = -0x04,
+     WARN_PENDING                  = -0x05
     };
 
 #endif	/* OKU_TYPES_H */
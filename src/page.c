@@ -0,0 +1,738 @@
+/* page.c
+ *
+ * This file is part of oku.
+ *
+ * Copyright (C) 2019 Ellis Rhys Thomas
+ *
+ * oku is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * oku is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+ * License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with oku.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS OR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/***************/
+/* Description */
+/***************/
+
+/* Page layout and pagination index, see page.h. */
+
+#include <stdio.h>		/* FILE*, fseek(), ftell() */
+
+#include "page.h"
+#include "text.h"
+#include "bitmap.h"
+#include "utf8.h"
+#include "oku_mem.h"
+#include "oku_types.h"
+
+#define RUN_MIN 64		/* Initial page run allocation */
+
+/* Result of trying to place the pending word on a page. */
+enum PLACE { PLACE_OK, PLACE_FULL };
+
+/* Pen position on the baseline of the current line. */
+typedef struct PEN {
+    coordinate x;
+    coordinate y;
+} PEN;
+
+/************************/
+/* Forward Declarations */
+/************************/
+
+/* Layout */
+static enum PLACE word_place(LAYOUT *lo, PEN *pen, PAGE *page);
+static int word_append(LAYOUT *lo, PEN *pen, PAGE *page,
+		       codepoint cp, long offset, enum PLACE *place);
+static void pen_newline(LAYOUT *lo, PEN *pen);
+static int next_codepoint(LAYOUT *lo, CP_SOURCE source, void *ctx,
+			  codepoint *cp, long *offset);
+static void end_page(LAYOUT *lo, PAGE *page, codepoint cp, long offset);
+
+/* Pagination index */
+static int run_step(PAGE_RUN *run, LAYOUT *lo, FILE *src, long limit);
+static void run_push(PAGE_RUN *run, long start);
+static void run_reset(PAGE_RUN *run, long next);
+static int run_find(PAGE_RUN *run, long offset, members *index);
+static int run_save(PAGE_RUN *run, FILE *out);
+static int run_load(PAGE_RUN *run, FILE *in);
+static long bytes_left(FILE *in);
+
+/************************/
+/* Interface Definition */
+/************************/
+
+/* Function: layout_reset()
+
+   Forget any word or codepoint carried over from the previous
+   page. */
+void
+layout_reset(LAYOUT *lo)
+{
+    lo->word_len   = 0;
+    lo->word_width = 0;
+    lo->word_start = -1;
+    lo->pushback   = 0;
+
+    return;
+}
+
+/* Function: page_layout()
+
+   Greedy word wrap of codepoints from source into page.
+
+   [1] The word carried from the previous page is placed first.
+
+   [2] Words are collected until a separator. Spaces advance the pen,
+       newlines start a new line. Words too wide for a line are broken
+       at the margin.
+
+   [3] When a word does not fit the page ends at the start of that
+       word, the word and the codepoint that completed it are carried
+       to the next page.
+
+   Returns OK when a page has been filled, WARN_EOF when the source is
+   exhausted or an error code. */
+int
+page_layout(LAYOUT *lo, CP_SOURCE source, void *ctx, PAGE *page)
+{
+    int err = OK;
+    TEXT *text = lo->text;
+    PEN pen = { lo->margins.left, lo->margins.top + text->ascender };
+    enum PLACE place = PLACE_OK;
+
+    /* A page must hold at least one line. */
+    if (pen.y + text->descender > lo->height - lo->margins.bottom)
+	return ERR_INPUT;
+
+    page->count = 0;
+    page->start = lo->word_len ? lo->word_start : -1;
+    page->end   = -1;
+
+    if (word_place(lo, &pen, page) == PLACE_FULL) /* [1] */
+	return ERR_INPUT;
+
+    for (;;) {
+	codepoint cp = 0;
+	long offset = 0;
+
+	err = next_codepoint(lo, source, ctx, &cp, &offset);
+	if (err > 0)
+	    return err;
+	if (page->start < 0)
+	    page->start = offset;
+
+	/* End of text, or of the region being laid out. */
+	if (err == WARN_EOF || (lo->limit >= 0 && offset >= lo->limit)) {
+	    if (word_place(lo, &pen, page) == PLACE_FULL) {
+		page->end = lo->word_start;
+		return OK;
+	    }
+	    page->end = offset;
+	    return err == WARN_EOF ? WARN_EOF : OK;
+	}
+
+	switch (cp) {		/* [2] */
+	case '\r':
+	    break;
+	case '\n':
+	    place = word_place(lo, &pen, page);
+	    if (place == PLACE_OK)
+		pen_newline(lo, &pen);
+	    break;
+	case ' ':
+	case '\t':
+	    place = word_place(lo, &pen, page);
+	    if (place == PLACE_OK && pen.x > lo->margins.left) {
+		GLYPH *space = NULL;
+		err = text_glyph(text, ' ', &space);
+		if (err > 0)
+		    return err;
+		pen.x += space->advance;
+	    }
+	    break;
+	default:
+	    err = word_append(lo, &pen, page, cp, offset, &place);
+	    if (err > 0)
+		return err;
+	}
+
+	if (place == PLACE_FULL) { /* [3] */
+	    end_page(lo, page, cp, offset);
+	    return OK;
+	}
+    }
+}
+
+/* Function: page_at()
+
+   Seek to start and lay out one page from a clean layout state. A
+   negative limit lays out a full page. */
+int
+page_at(LAYOUT *lo, FILE *src, long start, long limit, PAGE *page)
+{
+    if (fseek(src, start, SEEK_SET))
+	return ERR_IO;
+
+    layout_reset(lo);
+    lo->limit = limit;
+
+    int err = page_layout(lo, page_file_source, src, page);
+
+    lo->limit = -1;
+    layout_reset(lo);
+
+    return err;
+}
+
+/* Function: page_file_source()
+
+   Reads the next codepoint from the UTF-8 file ctx. Invalid sequences
+   have already been replaced by utf8_ftocp(), so only EOF and read
+   errors are passed on. */
+int
+page_file_source(void *ctx, codepoint *cp, long *offset)
+{
+    FILE *src = ctx;
+
+    *offset = ftell(src);
+    if (*offset < 0)
+	return ERR_IO;
+
+    *cp = 0;
+    int err = utf8_ftocp(src, cp);
+
+    return (err < 0 && err != WARN_EOF) ? OK : err;
+}
+
+/* Function: page_render()
+
+   Clears bmp and draws each glyph image at its position relative to
+   the pen with a single OR blit, so the ink of overlapping glyphs is
+   kept. Glyphs overhanging any edge are clipped. */
+int
+page_render(PAGE *page, TEXT *text, BITMAP *bmp)
+{
+    int err = bitmap_clear(bmp);
+    if (err > 0)
+	return err;
+
+    for (members i = 0; i < page->count; ++i) {
+	PLACED *p = &page->glyph[i];
+	GLYPH *g = NULL;
+
+	err = text_glyph(text, p->cp, &g);
+	if (err > 0)
+	    return err;
+	if (g->bmp.buffer == NULL)
+	    continue;
+
+	err = bitmap_blit(bmp, &g->bmp, p->x + g->left, p->y - g->top,
+			  BLIT_OR);
+	if (err > 0)
+	    return err;
+    }
+
+    return OK;
+}
+
+/* Function: page_render_gray()
+
+   As page_render(), the gray images being combined plane by plane
+   with BLIT_OR so overlapping glyphs keep the darker level. Pen
+   positions are those of the monochrome layout. */
+int
+page_render_gray(PAGE *page, TEXT *text, GRAYMAP *gm)
+{
+    int err = graymap_clear(gm);
+    if (err > 0)
+	return err;
+
+    for (members i = 0; i < page->count; ++i) {
+	PLACED *p = &page->glyph[i];
+	GLYPH *g = NULL;
+
+	err = text_glyph_gray(text, p->cp, &g);
+	if (err > 0)
+	    return err;
+	if (g->gray.plane[GRAY_HI].buffer == NULL)
+	    continue;
+
+	err = graymap_blit(gm, &g->gray, p->x + g->gray_left,
+			   p->y - g->gray_top, BLIT_OR);
+	if (err > 0)
+	    return err;
+    }
+
+    return OK;
+}
+
+/* Function: pages_create()
+
+   Allocates an index with no pages, anchored at the start of the
+   text. */
+PAGES *
+pages_create(void)
+{
+    PAGES *pages = oku_alloc(sizeof *pages); /* exits on failure */
+
+    pages_reflow(pages, 0);
+
+    return pages;
+}
+
+/* Function: pages_reflow()
+
+   Discards every recorded page. The head is rebuilt from the start of
+   the text and stops at the anchor, the tail is rebuilt from the
+   anchor, so the reader keeps their place whatever the new page
+   boundaries before it. */
+int
+pages_reflow(PAGES *pages, long anchor)
+{
+    if (pages == NULL)
+	return ERR_UNINITIALISED;
+    if (anchor < 0)
+	return ERR_INPUT;
+
+    pages->anchor = anchor;
+    run_reset(&pages->head, 0);
+    run_reset(&pages->tail, anchor);
+
+    /* Nothing precedes the start of the text. */
+    if (anchor == 0)
+	pages->head.done = 1;
+
+    return OK;
+}
+
+/* Function: pages_step()
+
+   Lays out up to budget pages, alternating between the tail, where
+   the reader is likely heading, and the head, which is needed to
+   number pages. A budget of one lays out the tail first. Only pages
+   actually laid out are taken from the budget. */
+int
+pages_step(PAGES *pages, LAYOUT *lo, FILE *src, unsigned budget)
+{
+    int err = OK;
+
+    while (budget > 0) {
+	if (!pages->tail.done) {
+	    --budget;
+	    err = run_step(&pages->tail, lo, src, -1);
+	    if (err > 0) return err;
+	}
+	if (!pages->head.done && budget > 0) {
+	    --budget;
+	    err = run_step(&pages->head, lo, src, pages->anchor);
+	    if (err > 0) return err;
+	}
+	if (pages->head.done && pages->tail.done)
+	    return WARN_EOF;
+    }
+
+    return OK;
+}
+
+/* Function: pages_find()
+
+   Page numbers are only known once the head is complete. Extends the
+   head, and the tail if offset lies beyond the anchor, until the page
+   holding offset has been recorded. */
+int
+pages_find(PAGES *pages, LAYOUT *lo, FILE *src, long offset, members *page)
+{
+    int err = OK;
+    members index = 0;
+
+    while (!pages->head.done) {
+	err = run_step(&pages->head, lo, src, pages->anchor);
+	if (err > 0) return err;
+    }
+
+    if (offset < pages->anchor) {
+	err = run_find(&pages->head, offset, &index);
+	*page = index;
+	return err;
+    }
+
+    while (!pages->tail.done && pages->tail.next <= offset) {
+	err = run_step(&pages->tail, lo, src, -1);
+	if (err > 0) return err;
+    }
+
+    err = run_find(&pages->tail, offset, &index);
+    *page = pages->head.count + index;
+
+    return err;
+}
+
+/* Function: pages_offset()
+
+   Page numbers beyond the head are only valid once it is complete. */
+int
+pages_offset(PAGES *pages, members page, long *offset)
+{
+    if (page < pages->head.count) {
+	*offset = pages->head.start[page];
+	return OK;
+    }
+
+    page -= pages->head.count;
+    if (!pages->head.done || page >= pages->tail.count)
+	return ERR_NOT_FOUND;
+
+    *offset = pages->tail.start[page];
+
+    return OK;
+}
+
+/* Function: pages_save()
+
+   The anchor is followed by the head and tail runs. Only valid on
+   the machine that wrote it, offsets are written as native longs. */
+int
+pages_save(PAGES *pages, FILE *out)
+{
+    if (fwrite(&pages->anchor, sizeof pages->anchor, 1, out) != 1)
+	return ERR_PARTIAL_WRITE;
+
+    int err = run_save(&pages->head, out);
+    if (err > 0)
+	return err;
+
+    return run_save(&pages->tail, out);
+}
+
+/* Function: pages_load()
+
+   On failure the index is left empty, anchored at the start of the
+   text. */
+int
+pages_load(PAGES *pages, FILE *in)
+{
+    int err = OK;
+
+    if (fread(&pages->anchor, sizeof pages->anchor, 1, in) != 1
+	|| pages->anchor < 0)
+	goto fail;
+    err = run_load(&pages->head, in);
+    if (err > 0)
+	goto fail;
+    err = run_load(&pages->tail, in);
+    if (err > 0)
+	goto fail;
+
+    return OK;
+ fail:
+    pages_reflow(pages, 0);
+    return ERR_IO;
+}
+
+/* Function: pages_destroy()
+
+   Frees index and both page runs. */
+int
+pages_destroy(PAGES *pages)
+{
+    if (pages == NULL)
+	return ERR_UNINITIALISED;
+
+    oku_free(pages->head.start);
+    oku_free(pages->tail.start);
+    oku_free(pages);
+
+    return OK;
+}
+
+/********************/
+/* Static Functions */
+/********************/
+
+/* Static Function: word_place()
+
+   Moves the pending word onto the page, starting a new line if it
+   does not fit on the current one. Returns PLACE_FULL, leaving the
+   word pending, if there is no room on the page. */
+static enum PLACE
+word_place(LAYOUT *lo, PEN *pen, PAGE *page)
+{
+    coordinate right  = lo->width  - lo->margins.right;
+    coordinate bottom = lo->height - lo->margins.bottom;
+
+    if (lo->word_len == 0)
+	return PLACE_OK;
+
+    if (pen->x + lo->word_width > right && pen->x > lo->margins.left)
+	pen_newline(lo, pen);
+
+    if (pen->y + lo->text->descender > bottom
+	|| page->count + lo->word_len > PAGE_GLYPHS)
+	return PLACE_FULL;
+
+    for (members i = 0; i < lo->word_len; ++i) {
+	PLACED *p = &page->glyph[page->count++];
+	p->cp = lo->word[i].cp;
+	p->x  = pen->x + lo->word[i].x;
+	p->y  = pen->y;
+    }
+
+    pen->x += lo->word_width;
+    lo->word_len   = 0;
+    lo->word_width = 0;
+    lo->word_start = -1;
+
+    return PLACE_OK;
+}
+
+/* Static Function: word_append()
+
+   Adds a codepoint to the pending word. A word that would become
+   wider than the line, or longer than WORD_GLYPHS, is placed as it
+   stands first and cp begins a new word. */
+static int
+word_append(LAYOUT *lo, PEN *pen, PAGE *page,
+	    codepoint cp, long offset, enum PLACE *place)
+{
+    GLYPH *g = NULL;
+    resolution line = lo->width - lo->margins.left - lo->margins.right;
+
+    int err = text_glyph(lo->text, cp, &g);
+    if (err > 0)
+	return err;
+
+    *place = PLACE_OK;
+    if (lo->word_len == WORD_GLYPHS
+	|| (lo->word_len > 0 && lo->word_width + g->advance > line)) {
+	*place = word_place(lo, pen, page);
+	if (*place == PLACE_FULL)
+	    return OK;
+    }
+
+    if (lo->word_len == 0)
+	lo->word_start = offset;
+
+    lo->word[lo->word_len].cp = cp;
+    lo->word[lo->word_len].x  = lo->word_width;
+    lo->word[lo->word_len].y  = 0;
+    lo->word_len++;
+    lo->word_width += g->advance;
+
+    return OK;
+}
+
+/* Static Function: pen_newline()
+
+   Return the pen to the left margin of the next line. */
+static void
+pen_newline(LAYOUT *lo, PEN *pen)
+{
+    pen->x  = lo->margins.left;
+    pen->y += lo->text->line_height;
+
+    return;
+}
+
+/* Static Function: next_codepoint()
+
+   Returns a codepoint pushed back by the previous page before reading
+   from the source. */
+static int
+next_codepoint(LAYOUT *lo, CP_SOURCE source, void *ctx,
+	       codepoint *cp, long *offset)
+{
+    if (lo->pushback) {
+	lo->pushback = 0;
+	*cp = lo->pushback_cp;
+	*offset = lo->pushback_offset;
+	return OK;
+    }
+
+    return source(ctx, cp, offset);
+}
+
+/* Static Function: end_page()
+
+   The page ends at the pending word if there is one, otherwise at the
+   codepoint that did not fit. That codepoint is pushed back so that
+   the next page begins with it. */
+static void
+end_page(LAYOUT *lo, PAGE *page, codepoint cp, long offset)
+{
+    page->end = lo->word_len ? lo->word_start : offset;
+
+    lo->pushback        = 1;
+    lo->pushback_cp     = cp;
+    lo->pushback_offset = offset;
+
+    return;
+}
+
+/* Static Function: run_step()
+
+   Lays out the next page of a run from a clean state and records its
+   start. The run is complete when the text, or the limit, is
+   reached. */
+static int
+run_step(PAGE_RUN *run, LAYOUT *lo, FILE *src, long limit)
+{
+    static PAGE page;		/* Too large for the stack */
+
+    int err = page_at(lo, src, run->next, limit, &page);
+    if (err > 0)
+	return err;
+
+    run_push(run, run->next);
+    run->next = page.end;
+
+    if (err == WARN_EOF || page.end <= page.start
+	|| (limit >= 0 && page.end >= limit))
+	run->done = 1;
+
+    return OK;
+}
+
+/* Static Function: run_push()
+
+   Appends a page start offset, doubling the allocation when full. */
+static void
+run_push(PAGE_RUN *run, long start)
+{
+    if (run->count == run->capacity) {
+	members capacity = run->capacity ? run->capacity * 2 : RUN_MIN;
+	run->start = oku_arrayrealloc(run->start, capacity, sizeof *run->start);
+	run->capacity = capacity;
+    }
+
+    run->start[run->count++] = start;
+
+    return;
+}
+
+/* Static Function: run_reset()
+
+   Empties a run, keeping its allocation, to lay out from next. */
+static void
+run_reset(PAGE_RUN *run, long next)
+{
+    run->count = 0;
+    run->next  = next;
+    run->done  = 0;
+
+    return;
+}
+
+/* Static Function: run_find()
+
+   Binary search for the last page starting at or before offset. */
+static int
+run_find(PAGE_RUN *run, long offset, members *index)
+{
+    if (run->count == 0 || offset < run->start[0])
+	return ERR_NOT_FOUND;
+
+    members lo = 0, hi = run->count;
+    while (hi - lo > 1) {
+	members mid = lo + (hi - lo) / 2;
+	if (run->start[mid] <= offset)
+	    lo = mid;
+	else
+	    hi = mid;
+    }
+
+    *index = lo;
+
+    return OK;
+}
+
+/* Static Function: run_save()
+
+   Writes the run length, progress and page start offsets. An empty
+   run has no offsets to write. */
+static int
+run_save(PAGE_RUN *run, FILE *out)
+{
+    if (fwrite(&run->count, sizeof run->count, 1, out) != 1
+	|| fwrite(&run->next, sizeof run->next, 1, out) != 1
+	|| fwrite(&run->done, sizeof run->done, 1, out) != 1
+	|| (run->count > 0
+	    && fwrite(run->start, sizeof *run->start, run->count, out)
+	       != run->count))
+	return ERR_PARTIAL_WRITE;
+
+    return OK;
+}
+
+/* Static Function: run_load()
+
+   Reads a run written by run_save(), growing the allocation to fit
+   and checking that page starts ascend. A count larger than the rest
+   of the file could hold is rejected before allocating. */
+static int
+run_load(PAGE_RUN *run, FILE *in)
+{
+    members count = 0;
+
+    if (fread(&count, sizeof count, 1, in) != 1
+	|| fread(&run->next, sizeof run->next, 1, in) != 1
+	|| fread(&run->done, sizeof run->done, 1, in) != 1)
+	return ERR_IO;
+
+    long left = bytes_left(in);
+    if (left < 0 || count > (size_t)left / sizeof *run->start)
+	return ERR_IO;
+
+    if (count > run->capacity) {
+	run->start = oku_arrayrealloc(run->start, count, sizeof *run->start);
+	run->capacity = count;
+    }
+
+    run->count = 0;
+    if (count > 0
+	&& fread(run->start, sizeof *run->start, count, in) != count)
+	return ERR_IO;
+
+    for (members i = 1; i < count; ++i)
+	if (run->start[i] <= run->start[i - 1])
+	    return ERR_IO;
+
+    run->count = count;
+
+    return OK;
+}
+
+/* Static Function: bytes_left()
+
+   Returns the number of bytes between the position of in and its
+   end, or -1 if the stream cannot seek. */
+static long
+bytes_left(FILE *in)
+{
+    long here = ftell(in);
+    if (here < 0 || fseek(in, 0, SEEK_END))
+	return -1;
+
+    long end = ftell(in);
+    if (fseek(in, here, SEEK_SET) || end < here)
+	return -1;
+
+    return end - here;
+}
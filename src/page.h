@@ -0,0 +1,227 @@
+/* page.h
+ *
+ * This file is part of oku.
+ *
+ * Copyright (C) 2019 Ellis Rhys Thomas
+ *
+ * oku is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * oku is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+ * License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with oku.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS OR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/***************/
+/* Description */
+/***************/
+
+/* Page layout and pagination.
+
+   Codepoints are word wrapped into lines and lines stacked into
+   pages. A page is described by the byte offsets of the text it
+   holds and the pen position of every glyph, so it can be rendered
+   into a bitmap at any time.
+
+   The pagination index records the byte offset at which every page
+   starts. After the font size or margins change the index is rebuilt
+   around an anchor, the current reading position, so that the page
+   being read can be laid out immediately and the rest of the index
+   built a few pages at a time when the reader is idle. */
+
+#ifndef PAGE_H
+#define PAGE_H
+
+#include <stdio.h>		/* FILE* */
+
+#include "oku_types.h"
+#include "bitmap.h"
+#include "graymap.h"
+#include "text.h"
+
+#define PAGE_GLYPHS 4096	/* Maximum glyphs laid out on one page */
+#define WORD_GLYPHS 64		/* Longest run kept together on a line */
+
+/***********/
+/* Objects */
+/***********/
+
+/* Object: MARGINS
+
+   Blank border between the edge of the display and the text (px). */
+typedef struct MARGINS {
+    resolution top;
+    resolution right;
+    resolution bottom;
+    resolution left;
+} MARGINS;
+
+/* Object: PLACED
+
+   Glyph positioned on a page, coordinates are the pen position on
+   the baseline. */
+typedef struct PLACED {
+    codepoint  cp;
+    coordinate x;
+    coordinate y;
+} PLACED;
+
+/* Object: PAGE
+
+   Result of laying out one page of text. */
+typedef struct PAGE {
+    long    start;		/* Byte offset of first codepoint */
+    long    end;		/* Byte offset following page */
+    members count;		/* Number of glyphs placed */
+    PLACED  glyph[PAGE_GLYPHS];	/* Glyphs in reading order */
+} PAGE;
+
+/* Callback: CP_SOURCE
+
+   Supplies the next codepoint in *cp and the byte offset of its first
+   octet in *offset. Returns WARN_EOF with *offset set to the length
+   of the text once exhausted. */
+typedef int (*CP_SOURCE)(void *ctx, codepoint *cp, long *offset);
+
+/* Object: LAYOUT
+
+   Layout parameters and the state carried between consecutive
+   pages. A word that did not fit on the previous page, and the
+   codepoint that ended it, start the next. */
+typedef struct LAYOUT {
+    TEXT      *text;		/* Font used for glyph metrics */
+    resolution width;		/* Page width (px) */
+    resolution height;		/* Page height (px) */
+    MARGINS    margins;		/* Page margins (px) */
+    long       limit;		/* Offset ending page early, or -1 */
+    /* Carried between pages */
+    PLACED     word[WORD_GLYPHS]; /* Word awaiting placement */
+    members    word_len;	/* Codepoints in word */
+    resolution word_width;	/* Width of word (px) */
+    long       word_start;	/* Offset of first codepoint in word */
+    int        pushback;	/* Codepoint returned to stream */
+    codepoint  pushback_cp;
+    long       pushback_offset;
+} LAYOUT;
+
+/* Object: PAGE_RUN
+
+   Ascending page start offsets laid out from a single origin. */
+typedef struct PAGE_RUN {
+    long   *start;		/* Page start offsets */
+    members count;		/* Pages recorded */
+    members capacity;		/* Allocated length of start */
+    long    next;		/* Start of next page to lay out */
+    int     done;		/* Non-zero once run is complete */
+} PAGE_RUN;
+
+/* Object: PAGES
+
+   Pagination index. The head covers the text from the beginning up
+   to the anchor, the tail from the anchor to the end of the text. */
+typedef struct PAGES {
+    long     anchor;		/* Reading position at last reflow */
+    PAGE_RUN head;		/* Pages before anchor */
+    PAGE_RUN tail;		/* Pages from anchor */
+} PAGES;
+
+/**************************/
+/* Interface Deceleration */
+/**************************/
+
+/* Function: layout_reset()
+
+   Discard any state carried from a previous page, required before
+   laying out from an arbitrary offset. */
+void layout_reset(LAYOUT *lo);
+
+/* Function: page_layout()
+
+   Lay out the next page of codepoints supplied by source into
+   page. Returns WARN_EOF when the text is exhausted. */
+int page_layout(LAYOUT *lo, CP_SOURCE source, void *ctx, PAGE *page);
+
+/* Function: page_at()
+
+   Lay out the page starting at byte offset start of the UTF-8 file
+   src, stopping early at byte offset limit unless it is negative. */
+int page_at(LAYOUT *lo, FILE *src, long start, long limit, PAGE *page);
+
+/* Function: page_file_source()
+
+   CP_SOURCE reading UTF-8 from a FILE* passed as ctx. */
+int page_file_source(void *ctx, codepoint *cp, long *offset);
+
+/* Function: page_render()
+
+   Clear bmp and draw every glyph placed on page. */
+int page_render(PAGE *page, TEXT *text, BITMAP *bmp);
+
+/* Function: page_render_gray()
+
+   Clear gm and draw every glyph placed on page with four levels of
+   gray. */
+int page_render_gray(PAGE *page, TEXT *text, GRAYMAP *gm);
+
+/* Function: pages_create()
+
+   Allocate an empty pagination index anchored at the start of the
+   text. Exits on memory error. */
+PAGES *pages_create(void);
+
+/* Function: pages_reflow()
+
+   Invalidate the index after a change in layout parameters. The page
+   starting at anchor is kept as a page boundary. */
+int pages_reflow(PAGES *pages, long anchor);
+
+/* Function: pages_step()
+
+   Extend the index by laying out up to budget pages. Returns WARN_EOF
+   once the index is complete. */
+int pages_step(PAGES *pages, LAYOUT *lo, FILE *src, unsigned budget);
+
+/* Function: pages_find()
+
+   Store the number of the page containing byte offset in *page,
+   extending the index as far as required. */
+int pages_find(PAGES *pages, LAYOUT *lo, FILE *src,
+	       long offset, members *page);
+
+/* Function: pages_offset()
+
+   Store the start offset of page number page in *offset. Returns
+   ERR_NOT_FOUND if the page has not been indexed. */
+int pages_offset(PAGES *pages, members page, long *offset);
+
+/* Function: pages_save()
+
+   Write the pagination index to the binary stream out. */
+int pages_save(PAGES *pages, FILE *out);
+
+/* Function: pages_load()
+
+   Replace the pagination index with one written by pages_save(). */
+int pages_load(PAGES *pages, FILE *in);
+
+/* Function: pages_destroy()
+
+   Free all memory associated with the pagination index. */
+int pages_destroy(PAGES *pages);
+
+#endif	/* PAGE_H */
@@ -0,0 +1,128 @@
+/* pbm.c
+ *
+ * This file is part of oku.
+ *
+ * Copyright (C) 2019 Ellis Rhys Thomas
+ *
+ * oku is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * oku is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+ * License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with oku.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS OR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/***************/
+/* Description */
+/***************/
+
+/* Portable bitmap (PBM) output, see pbm.h. */
+
+#include <stdio.h>		/* FILE*, fprintf(), fwrite() */
+
+#include "pbm.h"
+#include "graymap.h"
+#include "oku_types.h"
+
+/************************/
+/* Interface Definition */
+/************************/
+
+/* Function: pbm_write_headers()
+
+   PBM starts with the two characters "P4", followed by whitespace
+   (blanks, TABs, CRs, LFs).
+
+   The width in pixels of the image, formatted as ASCII characters
+   in decimal, followed by whitespace.
+      
+   The height in pixels of the image, again in ASCII decimal, followed
+   by whitespace character (usually a newline). */
+int
+pbm_write_headers(FILE *pbm, resolution width, resolution height)
+{
+    if (pbm == NULL)
+	return ERR_UNINITIALISED;
+
+    return fprintf(pbm, "P4 %u %u\n", width, height) < 0
+	? ERR_PARTIAL_WRITE : OK;
+}
+
+/* Function: pbm_write_bitmap()
+
+   Writes binary bitmap in format required by PBM files:
+
+   A raster of Height rows, in order from top to bottom.
+
+   Each row is Width bits, packed 8 to a byte, with don't care bits to
+   fill out the last byte in the row.
+
+   Each bit represents a pixel: 1 is black, 0 is white.
+
+   The order of the pixels is left to right. The order of their
+   storage within each file byte is most significant bit to least
+   significant bit. The order of the file bytes is from the beginning
+   of the file toward the end of the file. */
+int
+pbm_write_bitmap(FILE *pbm, byte *bitmap, members len)
+{
+    if (pbm == NULL)
+	return ERR_UNINITIALISED;
+
+    return fwrite(bitmap, sizeof *bitmap, len, pbm) < len
+	? ERR_PARTIAL_WRITE : OK;
+}
+
+/* Function: pbm_write()
+
+   Header and raster of a single image. */
+int
+pbm_write(FILE *pbm, byte *bitmap, members len,
+	  resolution width, resolution height)
+{
+    int err = pbm_write_headers(pbm, width, height);
+    if (err > 0)
+	return err;
+
+    return pbm_write_bitmap(pbm, bitmap, len);
+}
+
+/* Function: pgm_write()
+
+   PGM starts with "P5", the width and height as for PBM and the
+   maximum gray value, 3. The raster holds one byte per pixel, 0 is
+   black, so each value is the level subtracted from 3. */
+int
+pgm_write(FILE *pgm, GRAYMAP *gm)
+{
+    BITMAP *hi = &gm->plane[GRAY_HI];
+
+    if (pgm == NULL || hi->buffer == NULL)
+	return ERR_UNINITIALISED;
+
+    resolution height = hi->length / hi->pitch;
+    if (fprintf(pgm, "P5 %u %u 3\n", hi->width, height) < 0)
+	return ERR_PARTIAL_WRITE;
+
+    for (coordinate y = 0; y < height; ++y)
+	for (coordinate x = 0; x < hi->width; ++x)
+	    if (putc(GRAY_BLACK - graymap_level(gm, x, y), pgm) == EOF)
+		return ERR_PARTIAL_WRITE;
+
+    return OK;
+}
@@ -0,0 +1,71 @@
+/* pbm.h
+ *
+ * This file is part of oku.
+ *
+ * Copyright (C) 2019 Ellis Rhys Thomas
+ *
+ * oku is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * oku is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+ * License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with oku.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS OR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/***************/
+/* Description */
+/***************/
+
+/* Portable bitmap (PBM) output. The raw PBM raster has the same
+   layout as the bitmap buffer described in bitmap.h, so a buffer is
+   written unchanged after a short text header. Several images may be
+   written to one stream one after another.
+
+   Grayscale images are written as portable graymaps (PGM) of four
+   levels. */
+
+#ifndef PBM_H
+#define PBM_H
+
+#include <stdio.h>		/* FILE* */
+
+#include "oku_types.h"
+#include "graymap.h"
+
+/* Function: pbm_write_headers()
+
+   Write the PBM header for an image of width x height pixels. */
+int pbm_write_headers(FILE *pbm, resolution width, resolution height);
+
+/* Function: pbm_write_bitmap()
+
+   Write len bytes of packed bitmap data following the header. */
+int pbm_write_bitmap(FILE *pbm, byte *bitmap, members len);
+
+/* Function: pbm_write()
+
+   Write a complete PBM image, header followed by bitmap. */
+int pbm_write(FILE *pbm, byte *bitmap, members len,
+	      resolution width, resolution height);
+
+/* Function: pgm_write()
+
+   Write a complete PGM image of the four level graymap gm. */
+int pgm_write(FILE *pgm, GRAYMAP *gm);
+
+#endif	/* PBM_H */
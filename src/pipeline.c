@@ -0,0 +1,502 @@
+/* pipeline.c
+ *
+ * This file is part of oku.
+ *
+ * Copyright (C) 2019 Ellis Rhys Thomas
+ *
+ * oku is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * oku is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+ * License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with oku.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS OR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/***************/
+/* Description */
+/***************/
+
+/* Threaded read ahead page pipeline, see pipeline.h. */
+
+#include <stdio.h>		/* FILE*, fopen(), fseek() */
+#include <pthread.h>
+
+#include "pipeline.h"
+#include "page.h"
+#include "ring.h"
+#include "text.h"
+#include "bitmap.h"
+#include "oku_mem.h"
+#include "oku_types.h"
+
+/* Object: BLOCK_READER
+
+   Layout stage's position within the current decoded block. */
+typedef struct BLOCK_READER {
+    PIPELINE *pipe;
+    CP_BLOCK *block;		/* Current block, or NULL */
+    members   next;		/* Index of next codepoint */
+} BLOCK_READER;
+
+/************************/
+/* Forward Declarations */
+/************************/
+
+/* Stages */
+static void *decode_stage(void *arg);
+static void *layout_stage(void *arg);
+static void *raster_stage(void *arg);
+static int block_source(void *ctx, codepoint *cp, long *offset);
+static void stage_fail(PIPELINE *pipe, RING *out, int err);
+
+/* Rings */
+static void rings_init(PIPELINE *pipe);
+static void rings_close(PIPELINE *pipe);
+static void rings_destroy(PIPELINE *pipe);
+
+/************************/
+/* Interface Definition */
+/************************/
+
+/* Function: pipeline_create()
+
+   Frames are page sized bitmaps allocated once, unless the page size
+   changes. Page buffers are allocated for the life of the
+   pipeline. */
+PIPELINE *
+pipeline_create(const char *textpath, const char *fontpath,
+		unsigned size, resolution width, resolution height)
+{
+    PIPELINE *pipe = oku_alloc(sizeof *pipe); /* exits on failure */
+
+    pipe->textpath = textpath;
+    pipe->layout.text   = text_start((char *)fontpath, size);
+    pipe->raster_text   = text_start((char *)fontpath, size);
+    pipe->layout.width  = width;
+    pipe->layout.height = height;
+    pipe->layout.limit  = -1;
+
+    if (pipe->layout.text == NULL || pipe->raster_text == NULL) {
+	text_stop(pipe->layout.text);
+	text_stop(pipe->raster_text);
+	oku_free(pipe);
+	return NULL;
+    }
+
+    for (members i = 0; i < PIPE_PAGES; ++i)
+	pipe->page[i] = oku_alloc(sizeof *pipe->page[i]);
+    for (members i = 0; i < PIPE_FRAMES; ++i)
+	pipe->frame[i].bmp = bitmap_create(width, height);
+
+    return pipe;
+}
+
+/* Function: pipeline_start()
+
+   [1] With the threads stopped the FreeType handles may be changed
+       safely.
+
+   [2] Rings start empty, with every buffer on its free ring. */
+int
+pipeline_start(PIPELINE *pipe, long start, unsigned size, MARGINS margins)
+{
+    int err = pipeline_stop(pipe);
+    if (err > 0)
+	return err;
+
+    if (pipe->layout.text->size != size) { /* [1] */
+	err = text_set_size(pipe->layout.text, size);
+	if (err > 0)
+	    return err;
+	err = text_set_size(pipe->raster_text, size);
+	if (err > 0)
+	    return err;
+    }
+    pipe->layout.margins = margins;
+    pipe->start = start;
+    pipe->err   = OK;
+    pipe->ended = 0;
+
+    rings_init(pipe);		/* [2] */
+
+    if (pthread_create(&pipe->decode_tid, NULL, decode_stage, pipe))
+	goto fail1;
+    if (pthread_create(&pipe->layout_tid, NULL, layout_stage, pipe))
+	goto fail2;
+    if (pthread_create(&pipe->raster_tid, NULL, raster_stage, pipe))
+	goto fail3;
+
+    pipe->running = 1;
+
+    return OK;
+ fail3:
+    rings_close(pipe);
+    pthread_join(pipe->layout_tid, NULL);
+ fail2:
+    rings_close(pipe);
+    pthread_join(pipe->decode_tid, NULL);
+ fail1:
+    rings_destroy(pipe);
+    return ERR_MEM;
+}
+
+/* Function: pipeline_resize()
+
+   Frames are only reallocated if the page size has changed. */
+int
+pipeline_resize(PIPELINE *pipe, resolution width, resolution height)
+{
+    int err = pipeline_stop(pipe);
+    if (err > 0)
+	return err;
+
+    if (pipe->layout.width == width && pipe->layout.height == height)
+	return OK;
+
+    for (members i = 0; i < PIPE_FRAMES; ++i) {
+	bitmap_destroy(pipe->frame[i].bmp);
+	pipe->frame[i].bmp = bitmap_create(width, height);
+    }
+    pipe->layout.width  = width;
+    pipe->layout.height = height;
+
+    return OK;
+}
+
+/* Function: pipeline_next()
+
+   A NULL frame marks the end of the stream, which is either the end
+   of the book or a stage failing. */
+int
+pipeline_next(PIPELINE *pipe, FRAME **frame)
+{
+    void *item = NULL;
+
+    if (!pipe->running)
+	return ERR_UNINITIALISED;
+    if (pipe->ended)
+	return pipe->err ? pipe->err : WARN_EOF;
+
+    int err = ring_pop(&pipe->frames, &item);
+    if (err)
+	return err;
+
+    if (item == NULL)
+	pipe->ended = 1;
+    if (pipe->ended)
+	return pipe->err ? pipe->err : WARN_EOF;
+
+    *frame = item;
+
+    return OK;
+}
+
+/* Function: pipeline_release()
+
+   Hand a displayed frame back to the raster stage. */
+int
+pipeline_release(PIPELINE *pipe, FRAME *frame)
+{
+    if (!pipe->running)
+	return ERR_UNINITIALISED;
+
+    return ring_push(&pipe->frames_free, frame);
+}
+
+/* Function: pipeline_stop()
+
+   Closing the rings wakes any stage waiting on one, each then
+   exits. */
+int
+pipeline_stop(PIPELINE *pipe)
+{
+    if (!pipe->running)
+	return OK;
+
+    rings_close(pipe);
+    pthread_join(pipe->decode_tid, NULL);
+    pthread_join(pipe->layout_tid, NULL);
+    pthread_join(pipe->raster_tid, NULL);
+    rings_destroy(pipe);
+
+    pipe->running = 0;
+
+    return OK;
+}
+
+/* Function: pipeline_destroy()
+
+   Stops threads and frees buffers and FreeType handles. */
+int
+pipeline_destroy(PIPELINE *pipe)
+{
+    if (pipe == NULL)
+	return ERR_UNINITIALISED;
+
+    pipeline_stop(pipe);
+
+    for (members i = 0; i < PIPE_PAGES; ++i)
+	oku_free(pipe->page[i]);
+    for (members i = 0; i < PIPE_FRAMES; ++i)
+	bitmap_destroy(pipe->frame[i].bmp);
+
+    text_stop(pipe->layout.text);
+    text_stop(pipe->raster_text);
+    oku_free(pipe);
+
+    return OK;
+}
+
+/********************/
+/* Static Functions */
+/********************/
+
+/* Static Function: decode_stage()
+
+   Reads codepoints from the book into blocks until the end of the
+   book, recording each codepoint's offset for the layout stage. */
+static void *
+decode_stage(void *arg)
+{
+    PIPELINE *pipe = arg;
+    void *item = NULL;
+    int err = OK;
+
+    FILE *book = fopen(pipe->textpath, "r");
+    if (book == NULL || fseek(book, pipe->start, SEEK_SET)) {
+	err = ERR_IO;
+	goto out;
+    }
+
+    while ((err = ring_pop(&pipe->blocks_free, &item)) == OK) {
+	CP_BLOCK *b = item;
+	b->count = 0;
+	b->eof   = 0;
+
+	while (b->count < PIPE_BLOCK_CPS) {
+	    err = page_file_source(book, &b->cp[b->count],
+				   &b->offset[b->count]);
+	    if (err > 0)
+		goto out;
+	    if (err == WARN_EOF) {
+		b->eof = 1;
+		b->end = b->offset[b->count];
+		break;
+	    }
+	    b->count++;
+	}
+
+	if (ring_push(&pipe->blocks, b) || b->eof)
+	    break;
+    }
+    err = OK;
+ out:
+    if (book)
+	fclose(book);
+    if (err > 0)
+	stage_fail(pipe, &pipe->blocks, err);
+    return NULL;
+}
+
+/* Static Function: layout_stage()
+
+   Lays out consecutive pages, carrying words between them, until the
+   end of the book or cancellation. */
+static void *
+layout_stage(void *arg)
+{
+    PIPELINE *pipe = arg;
+    BLOCK_READER reader = { pipe, NULL, 0 };
+    void *item = NULL;
+    int err = OK;
+
+    layout_reset(&pipe->layout);
+
+    while (ring_pop(&pipe->pages_free, &item) == OK) {
+	PAGE *page = item;
+
+	err = page_layout(&pipe->layout, block_source, &reader, page);
+	if (err > 0)
+	    break;
+	/* A book ending on a page boundary leaves an empty last page,
+	   it is dropped, the pools are refilled on restart. */
+	if (!(err == WARN_EOF && page->end <= page->start)
+	    && ring_push(&pipe->pages, page))
+	    return NULL;
+	if (err == WARN_EOF) {
+	    err = OK;
+	    break;
+	}
+    }
+
+    if (err == ERR_CANCELLED)
+	return NULL;
+    if (err > 0)
+	stage_fail(pipe, &pipe->pages, err);
+    else
+	ring_push(&pipe->pages, NULL);
+
+    return NULL;
+}
+
+/* Static Function: raster_stage()
+
+   Renders each laid out page into a free frame. */
+static void *
+raster_stage(void *arg)
+{
+    PIPELINE *pipe = arg;
+    void *item = NULL;
+
+    while (ring_pop(&pipe->pages, &item) == OK) {
+	PAGE *page = item;
+
+	if (page == NULL) {
+	    ring_push(&pipe->frames, NULL);
+	    return NULL;
+	}
+	if (ring_pop(&pipe->frames_free, &item))
+	    return NULL;
+
+	FRAME *frame = item;
+	int err = page_render(page, pipe->raster_text, frame->bmp);
+	frame->start = page->start;
+	frame->end   = page->end;
+
+	if (ring_push(&pipe->pages_free, page))
+	    return NULL;
+	if (err > 0) {
+	    stage_fail(pipe, &pipe->frames, err);
+	    return NULL;
+	}
+	if (ring_push(&pipe->frames, frame))
+	    return NULL;
+    }
+
+    return NULL;
+}
+
+/* Static Function: block_source()
+
+   CP_SOURCE over the blocks produced by the decode stage. Finished
+   blocks are returned to the decode stage. The last block is kept so
+   the end of the book can be reported repeatedly. */
+static int
+block_source(void *ctx, codepoint *cp, long *offset)
+{
+    BLOCK_READER *r = ctx;
+    void *item = NULL;
+
+    while (r->block == NULL || r->next == r->block->count) {
+	if (r->block && r->block->eof) {
+	    *offset = r->block->end;
+	    return WARN_EOF;
+	}
+	if (r->block && ring_push(&r->pipe->blocks_free, r->block))
+	    return ERR_CANCELLED;
+	r->block = NULL;
+
+	if (ring_pop(&r->pipe->blocks, &item))
+	    return ERR_CANCELLED;
+	if (item == NULL)	/* Decode stage failed */
+	    return r->pipe->err;
+
+	r->block = item;
+	r->next  = 0;
+    }
+
+    *cp     = r->block->cp[r->next];
+    *offset = r->block->offset[r->next];
+    r->next++;
+
+    return OK;
+}
+
+/* Static Function: stage_fail()
+
+   Record the first error and push the end marker to the failed
+   stage's output ring, out. Later stages pass it on, so the caller
+   sees the stream end. The error is stored before the marker is
+   pushed, so it is visible to whichever stage pops the marker. */
+static void
+stage_fail(PIPELINE *pipe, RING *out, int err)
+{
+    int expected = OK;
+
+    atomic_compare_exchange_strong(&pipe->err, &expected, err);
+    ring_push(out, NULL);
+
+    return;
+}
+
+/* Static Function: rings_init()
+
+   Empty rings, with all buffers available to the producing stage. */
+static void
+rings_init(PIPELINE *pipe)
+{
+    /* Capacities are a power of two, ring_init() cannot fail. An end
+       marker needs a slot beyond the buffers in flight. */
+    ring_init(&pipe->blocks,      PIPE_BLOCKS * 2);
+    ring_init(&pipe->blocks_free, PIPE_BLOCKS * 2);
+    ring_init(&pipe->pages,       PIPE_PAGES * 2);
+    ring_init(&pipe->pages_free,  PIPE_PAGES * 2);
+    ring_init(&pipe->frames,      PIPE_FRAMES * 2);
+    ring_init(&pipe->frames_free, PIPE_FRAMES * 2);
+
+    for (members i = 0; i < PIPE_BLOCKS; ++i)
+	ring_push(&pipe->blocks_free, &pipe->block[i]);
+    for (members i = 0; i < PIPE_PAGES; ++i)
+	ring_push(&pipe->pages_free, pipe->page[i]);
+    for (members i = 0; i < PIPE_FRAMES; ++i)
+	ring_push(&pipe->frames_free, &pipe->frame[i]);
+
+    return;
+}
+
+/* Static Function: rings_close()
+
+   Wake and cancel every stage. */
+static void
+rings_close(PIPELINE *pipe)
+{
+    ring_close(&pipe->blocks);
+    ring_close(&pipe->blocks_free);
+    ring_close(&pipe->pages);
+    ring_close(&pipe->pages_free);
+    ring_close(&pipe->frames);
+    ring_close(&pipe->frames_free);
+
+    return;
+}
+
+/* Static Function: rings_destroy()
+
+   Release every ring once all stages have exited. */
+static void
+rings_destroy(PIPELINE *pipe)
+{
+    ring_destroy(&pipe->blocks);
+    ring_destroy(&pipe->blocks_free);
+    ring_destroy(&pipe->pages);
+    ring_destroy(&pipe->pages_free);
+    ring_destroy(&pipe->frames);
+    ring_destroy(&pipe->frames_free);
+
+    return;
+}
@@ -0,0 +1,165 @@
+/* pipeline.h
+ *
+ * This file is part of oku.
+ *
+ * Copyright (C) 2019 Ellis Rhys Thomas
+ *
+ * oku is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * oku is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+ * License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with oku.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS OR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/***************/
+/* Description */
+/***************/
+
+/* Read ahead page pipeline.
+
+   Pages following the one on display are prepared by three threads,
+   each a stage connected to the next by a bounded single producer,
+   single consumer ring (see ring.h):
+
+   decode -> layout -> raster -> display
+
+   Decode reads UTF-8 from the book into blocks of codepoints, layout
+   word wraps them into pages and raster draws the pages into
+   frames. The display stage is the caller, which takes finished
+   frames in order with pipeline_next(). While the caller waits for
+   the panel to refresh, the next pages are being prepared.
+
+   Every buffer passed between stages comes from a fixed pool and is
+   returned through a matching ring, so nothing is allocated while
+   the pipeline runs and at most a few pages are prepared ahead. A
+   NULL item marks the end of the book, or of the stream after an
+   error. */
+
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "oku_types.h"
+#include "bitmap.h"
+#include "page.h"
+#include "ring.h"
+#include "text.h"
+
+#define PIPE_BLOCK_CPS 1024	/* Codepoints per decoded block */
+#define PIPE_BLOCKS 4		/* Decoded blocks in flight */
+#define PIPE_PAGES 2		/* Laid out pages in flight */
+#define PIPE_FRAMES 2		/* Rendered frames in flight */
+
+/***********/
+/* Objects */
+/***********/
+
+/* Object: CP_BLOCK
+
+   Run of decoded codepoints and the byte offset of each. */
+typedef struct CP_BLOCK {
+    codepoint cp[PIPE_BLOCK_CPS];
+    long      offset[PIPE_BLOCK_CPS];
+    members   count;		/* Codepoints held */
+    int       eof;		/* Non-zero if last block of book */
+    long      end;		/* Book length, when eof is set */
+} CP_BLOCK;
+
+/* Object: FRAME
+
+   Rendered page ready for display. */
+typedef struct FRAME {
+    BITMAP *bmp;		/* Device sized bitmap */
+    long    start;		/* Byte offset of first codepoint */
+    long    end;		/* Byte offset following page */
+} FRAME;
+
+/* Object: PIPELINE
+
+   Stage threads, the rings between them and their buffer pools. The
+   layout and raster stages each have their own FreeType handle. */
+typedef struct PIPELINE {
+    const char *textpath;	/* Book, opened by decode stage */
+    LAYOUT      layout;		/* Layout stage state */
+    TEXT       *raster_text;	/* Raster stage glyphs */
+    int         running;	/* Non-zero while threads exist */
+    long        start;		/* Offset of first page prepared */
+    atomic_int  err;		/* First error from any stage */
+    int         ended;		/* Non-zero once end marker taken */
+    pthread_t   decode_tid, layout_tid, raster_tid;
+    /* Rings, each paired with the ring returning its buffers */
+    RING        blocks, blocks_free;
+    RING        pages, pages_free;
+    RING        frames, frames_free;
+    /* Buffer pools */
+    CP_BLOCK    block[PIPE_BLOCKS];
+    PAGE       *page[PIPE_PAGES];
+    FRAME       frame[PIPE_FRAMES];
+} PIPELINE;
+
+/**************************/
+/* Interface Deceleration */
+/**************************/
+
+/* Function: pipeline_create()
+
+   Allocate a stopped pipeline for the book at textpath, laying out
+   pages of width x height pixels with the font at fontpath, in size
+   points. Returns NULL if the font cannot be loaded. Exits on memory
+   error. */
+PIPELINE *pipeline_create(const char *textpath, const char *fontpath,
+			  unsigned size, resolution width, resolution height);
+
+/* Function: pipeline_start()
+
+   Stop the pipeline if running, apply font size and margins, then
+   start preparing pages from byte offset start. */
+int pipeline_start(PIPELINE *pipe, long start, unsigned size,
+		   MARGINS margins);
+
+/* Function: pipeline_resize()
+
+   Stop the pipeline if running and lay out pages of width x height
+   pixels once it is next started. Exits on memory error. */
+int pipeline_resize(PIPELINE *pipe, resolution width, resolution height);
+
+/* Function: pipeline_next()
+
+   Wait for the next frame. Returns WARN_EOF after the last page. The
+   frame must be handed back with pipeline_release(). */
+int pipeline_next(PIPELINE *pipe, FRAME **frame);
+
+/* Function: pipeline_release()
+
+   Return a frame obtained from pipeline_next() for reuse. */
+int pipeline_release(PIPELINE *pipe, FRAME *frame);
+
+/* Function: pipeline_stop()
+
+   Cancel and join the stage threads, discarding prepared pages. */
+int pipeline_stop(PIPELINE *pipe);
+
+/* Function: pipeline_destroy()
+
+   Stop the pipeline and free all memory associated with it. */
+int pipeline_destroy(PIPELINE *pipe);
+
+#endif	/* PIPELINE_H */
@@ -0,0 +1,308 @@
+/* raster.c
+ *
+ * This file is part of oku.
+ *
+ * Copyright (C) 2019 Ellis Rhys Thomas
+ *
+ * oku is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * oku is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+ * License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with oku.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS OR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+/***************/
+/* Description */
+/***************/
+
+/* Band parallel page rendering, see raster.h. */
+
+#include <pthread.h>
+
+#include "raster.h"
+#include "oku_mem.h"
+#include "oku_types.h"
+
+/************************/
+/* Forward Declarations */
+/************************/
+
+static void *band_worker(void *arg);
+static int band_render(BAND *band);
+static void stop_workers(RASTER *raster, unsigned started);
+
+/************************/
+/* Interface Definition */
+/************************/
+
+/* Function: raster_create()
+
+   [1] Every band, including the caller's, has its own TEXT so that a
+   glyph missing from the caller's cache can be rendered without
+   writing to it.
+
+   [2] With a single band there is nothing to start, raster_render()
+   falls back to page_render(). */
+RASTER *
+raster_create(char *font, unsigned size, unsigned threads)
+{
+    if (threads == 0 || threads > RASTER_THREADS)
+	return NULL;
+
+    RASTER *raster = oku_alloc(sizeof *raster); /* exits on failure */
+    unsigned started = 0;
+
+    raster->threads = threads;
+    if (pthread_mutex_init(&raster->lock, NULL))
+	goto fail0;
+    if (pthread_cond_init(&raster->start, NULL))
+	goto fail1;
+    if (pthread_cond_init(&raster->done, NULL))
+	goto fail2;
+
+    /* [1] */
+    for (unsigned i = 0; i < threads; ++i) {
+	BAND *band = &raster->band[i];
+	band->raster = raster;
+	band->index  = i;
+	band->text   = threads > 1 ? text_start(font, size) : NULL;
+	if (threads > 1 && band->text == NULL)
+	    goto fail3;
+    }
+
+    /* [2] */
+    for (started = 1; started < threads; ++started)
+	if (pthread_create(&raster->band[started].thread, NULL,
+			   band_worker, &raster->band[started]))
+	    goto fail3;
+
+    return raster;
+
+ fail3:
+    stop_workers(raster, started);
+    for (unsigned i = 0; i < threads; ++i)
+	if (raster->band[i].text)
+	    text_stop(raster->band[i].text);
+    pthread_cond_destroy(&raster->done);
+ fail2:
+    pthread_cond_destroy(&raster->start);
+ fail1:
+    pthread_mutex_destroy(&raster->lock);
+ fail0:
+    oku_free(raster);
+    return NULL;
+}
+
+/* Function: raster_render()
+
+   [1] Looking up every glyph of the page fills the caller's cache, so
+   the bands find them there. Glyphs that share a cache slot with a
+   later glyph on the page are evicted again, those are rendered into
+   the cache of each band that needs them.
+
+   [2] The band caches must be at the caller's size. Changing the size
+   empties them, which only happens after a reflow.
+
+   [3] The whole bitmap is cleared once here, as page_render() does,
+   so each band only draws its glyphs.
+
+   [4] The workers are woken, the caller draws the first band and
+   waits for the others. */
+int
+raster_render(RASTER *raster, PAGE *page, TEXT *text, BITMAP *bmp)
+{
+    int err = OK;
+
+    if (raster == NULL || text == NULL)
+	return ERR_UNINITIALISED;
+    if (raster->threads == 1)
+	return page_render(page, text, bmp);
+
+    /* [1] */
+    for (members i = 0; i < page->count; ++i) {
+	GLYPH *g = NULL;
+	err = text_glyph(text, page->glyph[i].cp, &g);
+	if (err > 0)
+	    return err;
+    }
+
+    /* [2] */
+    for (unsigned i = 0; i < raster->threads; ++i) {
+	BAND *band = &raster->band[i];
+	band->text->shared = text;
+	if (band->text->size != text->size) {
+	    err = text_set_size(band->text, text->size);
+	    if (err > 0)
+		return err;
+	}
+    }
+
+    /* [3] */
+    err = bitmap_clear(bmp);
+    if (err > 0)
+	return err;
+
+    /* [4] */
+    pthread_mutex_lock(&raster->lock);
+    raster->page    = page;
+    raster->bmp     = bmp;
+    raster->pending = raster->threads - 1;
+    raster->generation++;
+    pthread_cond_broadcast(&raster->start);
+    pthread_mutex_unlock(&raster->lock);
+
+    err = band_render(&raster->band[0]);
+
+    pthread_mutex_lock(&raster->lock);
+    while (raster->pending)
+	pthread_cond_wait(&raster->done, &raster->lock);
+    pthread_mutex_unlock(&raster->lock);
+
+    for (unsigned i = 1; i < raster->threads && err <= 0; ++i)
+	err = raster->band[i].err;
+
+    return err;
+}
+
+/* Function: raster_destroy()
+
+   Frees all memory associated with the raster handle. */
+int
+raster_destroy(RASTER *raster)
+{
+    if (raster == NULL)
+	return ERR_UNINITIALISED;
+
+    stop_workers(raster, raster->threads);
+
+    for (unsigned i = 0; i < raster->threads; ++i)
+	if (raster->band[i].text)
+	    text_stop(raster->band[i].text);
+
+    pthread_cond_destroy(&raster->done);
+    pthread_cond_destroy(&raster->start);
+    pthread_mutex_destroy(&raster->lock);
+    oku_free(raster);
+
+    return OK;
+}
+
+/********************/
+/* Static Functions */
+/********************/
+
+/* Static Function: band_worker()
+
+   Draws its band of each page started by raster_render() until the
+   raster is destroyed. */
+static void *
+band_worker(void *arg)
+{
+    BAND *band = arg;
+    RASTER *raster = band->raster;
+    unsigned seen = 0;
+
+    pthread_mutex_lock(&raster->lock);
+    for (;;) {
+	while (raster->generation == seen && !raster->quit)
+	    pthread_cond_wait(&raster->start, &raster->lock);
+	if (raster->quit)
+	    break;
+	seen = raster->generation;
+	pthread_mutex_unlock(&raster->lock);
+
+	band->err = band_render(band);
+
+	pthread_mutex_lock(&raster->lock);
+	if (--raster->pending == 0)
+	    pthread_cond_signal(&raster->done);
+    }
+    pthread_mutex_unlock(&raster->lock);
+
+    return NULL;
+}
+
+/* Static Function: band_render()
+
+   [1] The band is a bitmap of its own over rows top to bottom of the
+   page bitmap, so bitmap_blit() clips glyphs at the band edges as it
+   does at the page edges.
+
+   [2] Glyphs entirely above or below the band are skipped, the rest
+   are drawn as page_render() draws them, moved up by top. */
+static int
+band_render(BAND *band)
+{
+    RASTER *raster = band->raster;
+    BITMAP *bmp = raster->bmp;
+    PAGE *page = raster->page;
+    int err = OK;
+
+    /* [1] */
+    coordinate height = bmp->length / bmp->pitch;
+    coordinate top    = height * band->index / raster->threads;
+    coordinate bottom = height * (band->index + 1) / raster->threads;
+    BITMAP view = { .buffer = bmp->buffer + (members)top * bmp->pitch,
+		    .length = (members)(bottom - top) * bmp->pitch,
+		    .pitch  = bmp->pitch,
+		    .width  = bmp->width };
+
+    if (bottom == top)
+	return OK;
+
+    /* [2] */
+    for (members i = 0; i < page->count; ++i) {
+	PLACED *p = &page->glyph[i];
+	GLYPH *g = NULL;
+
+	err = text_glyph(band->text, p->cp, &g);
+	if (err > 0)
+	    return err;
+	if (g->bmp.buffer == NULL)
+	    continue;
+
+	int y = p->y - g->top;
+	if (y >= bottom || y + (int)(g->bmp.length / g->bmp.pitch) <= top)
+	    continue;
+
+	err = bitmap_blit(&view, &g->bmp, p->x + g->left, y - top, BLIT_OR);
+	if (err > 0)
+	    return err;
+    }
+
+    return OK;
+}
+
+/* Static Function: stop_workers()
+
+   Stops and joins workers 1 to started - 1. */
+static void
+stop_workers(RASTER *raster, unsigned started)
+{
+    pthread_mutex_lock(&raster->lock);
+    raster->quit = 1;
+    pthread_cond_broadcast(&raster->start);
+    pthread_mutex_unlock(&raster->lock);
+
+    for (unsigned i = 1; i < started; ++i)
+	pthread_join(raster->band[i].thread, NULL);
+
+    return;
+}
@@ -0,0 +1,112 @@
+/* raster.h
+ *
+ * This file is part of oku.
+ *
+ * Copyright (C) 2019 Ellis Rhys Thomas
+ *
+ * oku is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * oku is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+ * License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with oku.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS OR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+/***************/
+/* Description */
+/***************/
+
+/* Band parallel page rendering.
+
+   The bitmap is split into horizontal bands of whole rows, one per
+   thread. Every thread draws the glyphs of the page that reach into
+   its band, clipped to the band, so no two threads write the same
+   byte and the result is identical to page_render().
+
+   Glyphs are looked up in the caller's TEXT before the bands are
+   drawn, so the threads find them in a warm cache they only read.
+   Each thread has its own TEXT of the same font for glyphs that are
+   not there. The caller draws the first band itself. */
+
+#ifndef RASTER_H
+#define RASTER_H
+
+#include <pthread.h>
+
+#include "oku_types.h"
+#include "bitmap.h"
+#include "text.h"
+#include "page.h"
+
+#define RASTER_THREADS 4	/* Most bands per page */
+
+/***********/
+/* Objects */
+/***********/
+
+/* Object: BAND
+
+   A thread and the glyph cache it draws one band with. */
+typedef struct BAND {
+    struct RASTER *raster;	/* Owner */
+    unsigned       index;	/* Band number, 0 is the top */
+    TEXT          *text;	/* Fallback for glyphs not shared */
+    pthread_t      thread;	/* Worker, unused for band 0 */
+    int            err;		/* Result of last band drawn */
+} BAND;
+
+/* Object: RASTER
+
+   Worker threads and the page they are drawing. */
+typedef struct RASTER {
+    unsigned        threads;	/* Bands per page */
+    BAND            band[RASTER_THREADS];
+    pthread_mutex_t lock;	/* Guards the fields below */
+    pthread_cond_t  start;	/* Signalled when generation advances */
+    pthread_cond_t  done;	/* Signalled when pending reaches 0 */
+    unsigned        generation;	/* Pages started */
+    unsigned        pending;	/* Worker bands still being drawn */
+    int             quit;	/* Set to stop the workers */
+    PAGE           *page;	/* Page being drawn */
+    BITMAP         *bmp;	/* Bitmap being drawn into */
+} RASTER;
+
+/**************************/
+/* Interface Deceleration */
+/**************************/
+
+/* Function: raster_create()
+
+   Start threads - 1 workers, each with a face of the font at path
+   font. Returns NULL on failure. Exits on memory error. */
+RASTER *raster_create(char *font, unsigned size, unsigned threads);
+
+/* Function: raster_render()
+
+   Clear bmp and draw every glyph placed on page, as
+   page_render(). The glyph cache of text is filled first and not
+   modified while the bands are drawn. */
+int raster_render(RASTER *raster, PAGE *page, TEXT *text, BITMAP *bmp);
+
+/* Function: raster_destroy()
+
+   Stop the workers and free all memory associated with raster. */
+int raster_destroy(RASTER *raster);
+
+#endif	/* RASTER_H */
@@ -0,0 +1,266 @@
+/* refresh.c
+ *
+ * This file is part of oku.
+ *
+ * Copyright (C) 2019 Ellis Rhys Thomas
+ *
+ * oku is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * oku is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+ * License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with oku.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS OR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+/***************/
+/* Description */
+/***************/
+
+/* Refresh scheduling, see refresh.h. */
+
+#include <string.h>		/* memcpy() */
+#include <time.h>		/* clock_gettime() */
+
+#include "refresh.h"
+#include "oku_mem.h"
+#include "oku_types.h"
+
+/************************/
+/* Forward Declarations */
+/************************/
+
+static members changed_pixels(REFRESH *rf, const byte *bitmap);
+static int full_rule(REFRESH *rf, members pixels);
+static void full_done(EPD *epd, int err, void *ctx);
+static double seconds(void);
+
+/************************/
+/* Interface Definition */
+/************************/
+
+/* Function: refresh_create()
+
+   The screen is not known until the first frame, which is refreshed
+   in full. */
+REFRESH *
+refresh_create(EPD *epd, POLICY policy)
+{
+    REFRESH *rf = oku_alloc(sizeof *rf); /* zeroed, exits on failure */
+    members pitch = (epd->width + 7) / 8;
+
+    rf->epd    = epd;
+    rf->policy = policy;
+    rf->last   = oku_arrayalloc(pitch * epd->height, sizeof(byte));
+    rf->diff   = diff_create(pitch, epd->height);
+
+    return rf;
+}
+
+/* Function: refresh_display()
+
+   [1] The frame is compared with the one on screen here rather than
+       in the driver, to count the pixels changed and bound the
+       rectangle of a partial refresh.
+
+   [2] The rectangle is widened to whole bytes, as the driver would
+       widen it. */
+int
+refresh_display(REFRESH *rf, byte *bitmap, size_t len, EPD_DONE done,
+		void *ctx)
+{
+    EPD *epd = rf->epd;
+    members pitch = (epd->width + 7) / 8;
+    int err = OK;
+
+    if (bitmap == NULL || len != pitch * epd->height)
+	return ERR_INPUT;
+
+    /* Reported to the previous callback. */
+    epd_wait(epd);
+
+    /* [1] */
+    members pixels = 0;
+    if (rf->valid) {
+	diff_frames(rf->diff, rf->last, bitmap);
+	if (rf->diff->identical) {
+	    rf->stats.unchanged++;
+	    if (done)
+		done(epd, OK, ctx);
+	    return OK;
+	}
+	pixels = changed_pixels(rf, bitmap);
+    }
+
+    int rule = full_rule(rf, pixels);
+    if (rule < RULE_COUNT) {
+	rf->done    = done;
+	rf->ctx     = ctx;
+	rf->started = seconds();
+	err = epd_display_async(epd, bitmap, len, full_done, rf);
+	if (err > 0)
+	    goto fail;
+
+	rf->stats.full++;
+	rf->stats.rule[rule]++;
+	rf->partials = 0;
+	rf->pixels   = 0;
+	rf->full_at  = rf->started;
+    } else {
+	/* [2] */
+	DIFF *d = rf->diff;
+	double start = seconds();
+	err = epd_display_region(epd, bitmap, len, d->first_byte * 8,
+				 d->first_row,
+				 (d->last_byte - d->first_byte + 1) * 8,
+				 d->last_row - d->first_row + 1);
+	if (err > 0)
+	    goto fail;
+
+	rf->stats.partial++;
+	rf->stats.partial_s += seconds() - start;
+	rf->partials++;
+	rf->pixels += pixels;
+	if (done)
+	    done(epd, err, ctx);
+    }
+
+    memcpy(rf->last, bitmap, len);
+    rf->valid = 1;
+
+    return err;
+ fail:
+    /* The screen is no longer known */
+    rf->valid = 0;
+    return err;
+}
+
+/* Function: refresh_reset() */
+int
+refresh_reset(REFRESH *rf)
+{
+    if (rf == NULL)
+	return ERR_UNINITIALISED;
+
+    rf->valid = 0;
+
+    return OK;
+}
+
+/* Function: refresh_stats() */
+int
+refresh_stats(REFRESH *rf, REFRESH_STATS *stats, int reset)
+{
+    if (rf == NULL || stats == NULL)
+	return ERR_INPUT;
+
+    *stats = rf->stats;
+    if (reset)
+	rf->stats = (REFRESH_STATS){ 0 };
+
+    return OK;
+}
+
+/* Function: refresh_destroy() */
+int
+refresh_destroy(REFRESH *rf)
+{
+    if (rf == NULL)
+	return ERR_UNINITIALISED;
+
+    diff_destroy(rf->diff);
+    oku_free(rf->last);
+    oku_free(rf);
+
+    return OK;
+}
+
+/********************/
+/* Static Functions */
+/********************/
+
+/* Static Function: changed_pixels()
+
+   Count the pixels of bitmap that differ from the frame on screen,
+   within the changed bytes of each row found by diff_frames(). */
+static members
+changed_pixels(REFRESH *rf, const byte *bitmap)
+{
+    DIFF *d = rf->diff;
+    members count = 0;
+
+    for (resolution y = d->first_row; y <= d->last_row; ++y) {
+	members at = y * d->pitch;
+	for (members x = d->row[y].first; x <= d->row[y].last; ++x)
+	    count += __builtin_popcount(rf->last[at + x] ^ bitmap[at + x]);
+    }
+
+    return count;
+}
+
+/* Static Function: full_rule()
+
+   Returns the rule forcing a full refresh of a frame changing pixels,
+   or RULE_COUNT if a partial refresh will do. */
+static int
+full_rule(REFRESH *rf, members pixels)
+{
+    POLICY *p = &rf->policy;
+
+    if (!rf->valid)
+	return RULE_FIRST;
+    if (p->partials && rf->partials >= p->partials)
+	return RULE_PARTIALS;
+    if (p->pixels && rf->pixels + pixels >= p->pixels)
+	return RULE_PIXELS;
+    if (p->seconds && seconds() - rf->full_at >= p->seconds)
+	return RULE_SECONDS;
+
+    return RULE_COUNT;
+}
+
+/* Static Function: full_done()
+
+   EPD_DONE callback of a full refresh, timing it before passing the
+   result to the caller's callback. */
+static void
+full_done(EPD *epd, int err, void *ctx)
+{
+    REFRESH *rf = ctx;
+    EPD_DONE done = rf->done;
+
+    rf->stats.full_s += seconds() - rf->started;
+    rf->done = NULL;
+    if (err > 0)
+	rf->valid = 0;
+    if (done)
+	done(epd, err, rf->ctx);
+
+    return;
+}
+
+/* Static Function: seconds()
+
+   Monotonic time in seconds. */
+static double
+seconds(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
@@ -0,0 +1,145 @@
+/* refresh.h
+ *
+ * This file is part of oku.
+ *
+ * Copyright (C) 2019 Ellis Rhys Thomas
+ *
+ * oku is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * oku is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+ * License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with oku.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS OR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/***************/
+/* Description */
+/***************/
+
+/* Refresh scheduling.
+
+   A partial refresh is quick and does not flash the screen, but
+   leaves a faint ghost of the pixels it changed. Ghosting builds up
+   with each partial refresh until a full refresh clears it. The
+   scheduler sends each frame as a partial refresh of the rectangle
+   that changed, unless its policy calls for a full refresh.
+
+   A full refresh is forced after a number of partial refreshes, once
+   the partial refreshes have changed a number of pixels, or after
+   some time since the last full refresh. A limit of 0 is never
+   reached. */
+
+#ifndef REFRESH_H
+#define REFRESH_H
+
+#include "oku_types.h"
+#include "epd.h"
+#include "diff.h"
+
+/***********/
+/* Objects */
+/***********/
+
+/* Object: POLICY
+
+   Limits on ghosting, any one of which forces a full refresh. */
+typedef struct POLICY {
+    unsigned partials;		/* Partial refreshes in a row */
+    members  pixels;		/* Pixels changed by them */
+    unsigned seconds;		/* Time since last full refresh (s) */
+} POLICY;
+
+/* Enum: REFRESH_RULE
+
+   Why a frame was refreshed in full. */
+enum REFRESH_RULE
+    { RULE_FIRST,		/* Screen not known */
+      RULE_PARTIALS,		/* POLICY partials reached */
+      RULE_PIXELS,		/* POLICY pixels reached */
+      RULE_SECONDS,		/* POLICY seconds reached */
+      RULE_COUNT };
+
+/* Object: REFRESH_STATS
+
+   Refreshes made and the time from starting each to its completion. */
+typedef struct REFRESH_STATS {
+    unsigned long full;		/* Full refreshes */
+    unsigned long partial;	/* Partial refreshes */
+    unsigned long unchanged;	/* Frames needing no refresh */
+    unsigned long rule[RULE_COUNT]; /* Full refreshes by cause */
+    double        full_s;	/* Time in full refreshes (s) */
+    double        partial_s;	/* Time in partial refreshes (s) */
+} REFRESH_STATS;
+
+/* Object: REFRESH
+
+   Scheduler for one device, and the frame on its screen. */
+typedef struct REFRESH {
+    EPD          *epd;		/* Device refreshed */
+    POLICY        policy;	/* Limits on ghosting */
+    byte         *last;		/* Frame on screen */
+    int           valid;	/* Non-zero once last is known */
+    DIFF         *diff;		/* Changes from last */
+    unsigned      partials;	/* Partial refreshes since full */
+    members       pixels;	/* Pixels they changed */
+    double        full_at;	/* Time of last full refresh (s) */
+    double        started;	/* Time full refresh in progress began */
+    EPD_DONE      done;		/* Caller's callback for it */
+    void         *ctx;
+    REFRESH_STATS stats;
+} REFRESH;
+
+/**************************/
+/* Interface Deceleration */
+/**************************/
+
+/* Function: refresh_create()
+
+   Start scheduling refreshes of epd with policy. Exits on memory
+   error. */
+REFRESH *refresh_create(EPD *epd, POLICY policy);
+
+/* Function: refresh_display()
+
+   Display bitmap, a whole frame as for epd_display_async(), with a
+   full or partial refresh as the policy decides. A full refresh is
+   started and WARN_PENDING returned, done being called on completion
+   as for epd_display_async(). A partial refresh is complete on
+   return, done being called before. */
+int refresh_display(REFRESH *rf, byte *bitmap, size_t len, EPD_DONE done,
+		    void *ctx);
+
+/* Function: refresh_reset()
+
+   Refresh the next frame in full, needed once the screen has been
+   changed other than through rf, such as by epd_reset(), or the
+   device has lost the frame in its RAM, such as in epd_sleep(). */
+int refresh_reset(REFRESH *rf);
+
+/* Function: refresh_stats()
+
+   Copy the counters accumulated since refresh_create() to stats,
+   then zero them if reset is non-zero. */
+int refresh_stats(REFRESH *rf, REFRESH_STATS *stats, int reset);
+
+/* Function: refresh_destroy()
+
+   Free all memory associated with rf. The device is not touched. */
+int refresh_destroy(REFRESH *rf);
+
+#endif	/* REFRESH_H */
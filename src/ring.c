@@ -0,0 +1,166 @@
+/* ring.c
+ *
+ * This file is part of oku.
+ *
+ * Copyright (C) 2019 Ellis Rhys Thomas
+ *
+ * oku is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * oku is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+ * License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with oku.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS OR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/***************/
+/* Description */
+/***************/
+
+/* Single producer, single consumer ring buffer, see ring.h. */
+
+#include <stdatomic.h>
+#include <semaphore.h>
+#include <errno.h>		/* EINTR */
+
+#include "ring.h"
+#include "oku_mem.h"
+#include "oku_types.h"
+
+/************************/
+/* Forward Declarations */
+/************************/
+
+static int wait_for(RING *ring, sem_t *sem);
+
+/************************/
+/* Interface Definition */
+/************************/
+
+/* Function: ring_init()
+
+   Indices increase without bound and are masked into the slot array,
+   so a full ring is distinguished from an empty one. */
+int
+ring_init(RING *ring, members capacity)
+{
+    if (capacity == 0 || (capacity & (capacity - 1)))
+	return ERR_INPUT;
+
+    ring->slot     = oku_arrayalloc(capacity, sizeof *ring->slot);
+    ring->capacity = capacity;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    atomic_init(&ring->closed, 0);
+
+    if (sem_init(&ring->items, 0, 0) || sem_init(&ring->spaces, 0, capacity)) {
+	oku_free(ring->slot);
+	return ERR_MEM;
+    }
+
+    return OK;
+}
+
+/* Function: ring_push()
+
+   The slot is written before sem_post() counts it as an item, and
+   posting a semaphore orders memory for the thread that waits on it,
+   so the consumer never sees an unwritten slot. */
+int
+ring_push(RING *ring, void *item)
+{
+    int err = wait_for(ring, &ring->spaces);
+    if (err)
+	return err;
+
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    ring->slot[tail & (ring->capacity - 1)] = item;
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_relaxed);
+
+    sem_post(&ring->items);
+
+    return OK;
+}
+
+/* Function: ring_pop()
+
+   Mirror of ring_push(), the slot is counted as a space once it has
+   been read. */
+int
+ring_pop(RING *ring, void **item)
+{
+    int err = wait_for(ring, &ring->items);
+    if (err)
+	return err;
+
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    *item = ring->slot[head & (ring->capacity - 1)];
+    atomic_store_explicit(&ring->head, head + 1, memory_order_relaxed);
+
+    sem_post(&ring->spaces);
+
+    return OK;
+}
+
+/* Function: ring_close()
+
+   One post on each semaphore is enough to wake the single thread
+   that may be waiting on it. */
+void
+ring_close(RING *ring)
+{
+    atomic_store(&ring->closed, 1);
+    sem_post(&ring->items);
+    sem_post(&ring->spaces);
+
+    return;
+}
+
+/* Function: ring_destroy()
+
+   Releases semaphores and slot array. */
+void
+ring_destroy(RING *ring)
+{
+    sem_destroy(&ring->items);
+    sem_destroy(&ring->spaces);
+    oku_free(ring->slot);
+    ring->slot = NULL;
+
+    return;
+}
+
+/********************/
+/* Static Functions */
+/********************/
+
+/* Static Function: wait_for()
+
+   Wait on sem unless the ring is closed, before or during the
+   wait. */
+static int
+wait_for(RING *ring, sem_t *sem)
+{
+    if (atomic_load(&ring->closed))
+	return WARN_EOF;
+
+    while (sem_wait(sem))
+	if (errno != EINTR)
+	    return ERR_IO;
+
+    return atomic_load(&ring->closed) ? WARN_EOF : OK;
+}
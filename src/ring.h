@@ -0,0 +1,98 @@
+/* ring.h
+ *
+ * This file is part of oku.
+ *
+ * Copyright (C) 2019 Ellis Rhys Thomas
+ *
+ * oku is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * oku is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+ * License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with oku.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS OR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/***************/
+/* Description */
+/***************/
+
+/* Bounded single producer, single consumer ring buffer of pointers,
+   used to pass work between threads. Each index is only written by
+   one side, so the ring itself needs no lock. A pair of counting
+   semaphores lets either side block when the ring is full or empty.
+
+   Closing the ring wakes both sides and makes every later push or pop
+   return WARN_EOF. It is used to cancel the threads at either end. */
+
+#ifndef RING_H
+#define RING_H
+
+#include <stdatomic.h>
+#include <semaphore.h>
+
+#include "oku_types.h"
+
+/***********/
+/* Objects */
+/***********/
+
+/* Object: RING
+
+   Fixed capacity queue of pointers. */
+typedef struct RING {
+    void        **slot;		/* Queued items */
+    members       capacity;	/* Slots, a power of two */
+    atomic_size_t head;		/* Next slot to pop, consumer only */
+    atomic_size_t tail;		/* Next slot to push, producer only */
+    sem_t         items;	/* Count of queued items */
+    sem_t         spaces;	/* Count of free slots */
+    atomic_int    closed;	/* Non-zero once closed */
+} RING;
+
+/**************************/
+/* Interface Deceleration */
+/**************************/
+
+/* Function: ring_init()
+
+   Prepare an empty ring holding up to capacity items, which must be
+   a power of two. Exits on memory error. */
+int ring_init(RING *ring, members capacity);
+
+/* Function: ring_push()
+
+   Queue item, waiting while the ring is full. Producer only. */
+int ring_push(RING *ring, void *item);
+
+/* Function: ring_pop()
+
+   Remove the oldest item into *item, waiting while the ring is
+   empty. Consumer only. */
+int ring_pop(RING *ring, void **item);
+
+/* Function: ring_close()
+
+   Wake both sides and refuse further pushes and pops. */
+void ring_close(RING *ring);
+
+/* Function: ring_destroy()
+
+   Free the ring's storage. Neither side may be using the ring. */
+void ring_destroy(RING *ring);
+
+#endif	/* RING_H */
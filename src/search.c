@@ -0,0 +1,659 @@
+/* search.c
+ *
+ * This file is part of oku.
+ *
+ * Copyright (C) 2019 Ellis Rhys Thomas
+ *
+ * oku is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * oku is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+ * License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with oku.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS OR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/***************/
+/* Description */
+/***************/
+
+/* Positional inverted index for full text search, see search.h. */
+
+#define _POSIX_C_SOURCE 200809L	/* fmemopen(), clock_gettime() */
+
+#include <stdio.h>		/* FILE*, fmemopen(), rename() */
+#include <stdlib.h>		/* qsort() */
+#include <string.h>		/* strlen(), memcmp() */
+#include <time.h>		/* clock_gettime() */
+#include <sys/stat.h>		/* stat(), fstat() */
+
+#include "search.h"
+#include "utf8.h"
+#include "oku_mem.h"
+#include "oku_types.h"
+
+#define INDEX_SUFFIX ".idx"	/* Appended to book path */
+#define INDEX_MAGIC "OKUI"	/* Index file signature */
+#define INDEX_VERSION 2		/* Increment on format change */
+#define TOKEN_MAX 32		/* Codepoints of a word compared */
+#define QUERY_WORDS 16		/* Longest phrase searched for */
+#define ENTRIES_MIN 4096	/* Initial entry allocation */
+#define VARINT_MAX 5		/* Octets of a 32 bit varint */
+#define POSTING_MIN 2		/* Octets of smallest saved posting */
+
+/* FNV-1a 32 bit hash parameters */
+#define FNV_BASIS 0x811C9DC5u
+#define FNV_PRIME 0x01000193u
+
+/* Object: HEADER
+
+   Start of a saved index, identifies the book it was built from. It
+   is followed by one record per distinct word: the hash, the number
+   of postings and then for each posting the ordinal and offset as
+   varints, both the difference from the previous posting of the
+   word. */
+typedef struct HEADER {
+    char     magic[4];
+    uint32_t version;
+    int64_t  book_size;
+    int64_t  book_mtime;
+    uint64_t count;
+    uint64_t terms;
+} HEADER;
+
+/* Object: TOKEN
+
+   Case folded word read from a UTF-8 stream. */
+typedef struct TOKEN {
+    codepoint cp[TOKEN_MAX];	/* Folded codepoints, truncated */
+    members   len;		/* Codepoints held in cp */
+    long      offset;		/* Byte offset of first codepoint */
+    uint32_t  hash;		/* Hash of cp */
+} TOKEN;
+
+/************************/
+/* Forward Declarations */
+/************************/
+
+/* Tokenisation */
+static int is_word(codepoint cp);
+static codepoint fold(codepoint cp);
+static int next_token(FILE *src, TOKEN *tok);
+
+/* Index construction and storage */
+static int index_build(FILE *book, SEARCH *index);
+static int index_save(const char *path, SEARCH *index);
+static int index_load(const char *path, SEARCH *index);
+static size_t index_write(SEARCH *index, FILE *dst, uint64_t *terms);
+static int index_read(FILE *src, SEARCH *index, uint64_t terms);
+static int compare_entries(const void *a, const void *b);
+static char *index_path(const char *path, const char *suffix);
+
+/* Varint coding */
+static size_t put_varint(FILE *dst, uint32_t value);
+static int get_varint(FILE *src, uint32_t *value);
+
+/* Lookup */
+static members lower_bound(SEARCH *index, uint32_t hash, uint32_t ordinal);
+static int has_entry(SEARCH *index, uint32_t hash, uint32_t ordinal);
+static int verify(FILE *book, long offset, TOKEN *query, members n);
+
+/************************/
+/* Interface Definition */
+/************************/
+
+/* Function: search_open()
+
+   [1] The book's size and modification time identify it. A saved
+       index is only used if both match.
+
+   [2] Otherwise the index is built from the book and saved for next
+       time. Failure to save is not an error, the index is still
+       usable. */
+int
+search_open(const char *path, FILE *book, SEARCH **out)
+{
+    struct stat st;		/* [1] */
+    if (stat(path, &st))
+	return ERR_IO;
+
+    SEARCH *index = oku_alloc(sizeof *index); /* exits on failure */
+    index->book_size  = st.st_size;
+    index->book_mtime = st.st_mtime;
+
+    char *saved = index_path(path, INDEX_SUFFIX);
+    int err = index_load(saved, index);
+
+    if (err > 0) {		/* [2] */
+	struct timespec t0, t1;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+
+	err = index_build(book, index);
+	if (err > 0) {
+	    oku_free(saved);
+	    search_destroy(index);
+	    return err;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	index->build_time = (t1.tv_sec - t0.tv_sec)
+	    + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+	index_save(saved, index);
+    }
+
+    oku_free(saved);
+    *out = index;
+
+    return OK;
+}
+
+/* Function: search_find()
+
+   [1] The query is split into words exactly as the book was.
+
+   [2] Postings of the first word are in book order, the first at or
+       after from is found by binary search.
+
+   [3] A posting is a hit if every following query word occurs at the
+       following ordinal. As words are identified by hash the text at
+       the hit is read back and compared. */
+int
+search_find(SEARCH *index, FILE *book, const char *query,
+	    long from, long *hit)
+{
+    TOKEN words[QUERY_WORDS];
+    members n = 0;
+
+    /* [1] */
+    FILE *q = fmemopen((void *)query, strlen(query), "r");
+    if (q == NULL)
+	return ERR_INPUT;
+    while (n < QUERY_WORDS && next_token(q, &words[n]) == OK)
+	++n;
+    fclose(q);
+
+    if (n == 0)
+	return ERR_INPUT;
+
+    /* [2] */
+    members i   = lower_bound(index, words[0].hash, 0);
+    members end = lower_bound(index, words[0].hash + 1, 0);
+    if (words[0].hash == UINT32_MAX)
+	end = index->count;
+
+    members lo = i, hi = end;
+    while (lo < hi) {
+	members mid = lo + (hi - lo) / 2;
+	if ((long)index->entry[mid].offset < from)
+	    lo = mid + 1;
+	else
+	    hi = mid;
+    }
+
+    /* [3] */
+    for (i = lo; i < end; ++i) {
+	SEARCH_ENTRY *e = &index->entry[i];
+	members w = 1;
+
+	while (w < n && has_entry(index, words[w].hash, e->ordinal + w))
+	    ++w;
+	if (w < n)
+	    continue;
+
+	if (verify(book, e->offset, words, n) == OK) {
+	    *hit = e->offset;
+	    return OK;
+	}
+    }
+
+    return ERR_NOT_FOUND;
+}
+
+/* Function: search_size()
+
+   Bytes taken by the saved index, counted by encoding it without
+   writing. */
+size_t
+search_size(SEARCH *index)
+{
+    uint64_t terms = 0;
+
+    return sizeof(HEADER) + index_write(index, NULL, &terms);
+}
+
+/* Function: search_destroy()
+
+   Frees the entries and the index handle. */
+int
+search_destroy(SEARCH *index)
+{
+    if (index == NULL)
+	return ERR_UNINITIALISED;
+
+    oku_free(index->entry);
+    oku_free(index);
+
+    return OK;
+}
+
+/********************/
+/* Static Functions */
+/********************/
+
+/* Static Function: is_word()
+
+   Letters and digits form words. ASCII punctuation, Latin-1 symbols,
+   general punctuation and the byte order mark separate them. */
+static int
+is_word(codepoint cp)
+{
+    if (cp < 0x80)
+	return (cp >= '0' && cp <= '9') || (cp >= 'a' && cp <= 'z')
+	    || (cp >= 'A' && cp <= 'Z');
+
+    return !(cp < 0xC0 || cp == 0xD7 || cp == 0xF7
+	     || (cp >= 0x2000 && cp <= 0x206F)
+	     || (cp >= 0x3000 && cp <= 0x303F)
+	     || cp == 0xFEFF || cp == 0xFFFD);
+}
+
+/* Static Function: fold()
+
+   Simple case folding for the Latin, Greek and Cyrillic capitals
+   that map to lower case by a fixed offset. */
+static codepoint
+fold(codepoint cp)
+{
+    if ((cp >= 'A' && cp <= 'Z')
+	|| (cp >= 0xC0 && cp <= 0xDE && cp != 0xD7)
+	|| (cp >= 0x391 && cp <= 0x3AB && cp != 0x3A2)
+	|| (cp >= 0x410 && cp <= 0x42F))
+	return cp + 0x20;
+
+    return cp;
+}
+
+/* Static Function: next_token()
+
+   Skips separators and reads the next word from src. The separator
+   ending the word is consumed. Returns WARN_EOF when no words
+   remain. */
+static int
+next_token(FILE *src, TOKEN *tok)
+{
+    codepoint cp = 0;
+    long offset = 0;
+    int err = OK;
+
+    do {
+	offset = ftell(src);
+	cp = 0;
+	err = utf8_ftocp(src, &cp);
+	if (err > 0 || err == WARN_EOF)
+	    return err;
+    } while (!is_word(cp));
+
+    tok->offset = offset;
+    tok->len    = 0;
+    tok->hash   = FNV_BASIS;
+
+    while (is_word(cp)) {
+	if (tok->len < TOKEN_MAX) {
+	    cp = fold(cp);
+	    tok->cp[tok->len++] = cp;
+	    for (unsigned b = 0; b < 4; ++b)
+		tok->hash = (tok->hash ^ ((cp >> (8 * b)) & 0xFF)) * FNV_PRIME;
+	}
+
+	cp = 0;
+	err = utf8_ftocp(src, &cp);
+	if (err > 0)
+	    return err;
+	if (err == WARN_EOF)
+	    break;
+    }
+
+    return OK;
+}
+
+/* Static Function: index_build()
+
+   Reads every word of the book into the entry array then sorts it by
+   hash and ordinal. */
+static int
+index_build(FILE *book, SEARCH *index)
+{
+    TOKEN tok;
+    members capacity = ENTRIES_MIN;
+    int err = OK;
+
+    rewind(book);
+    index->count = 0;
+    index->entry = oku_arrayalloc(capacity, sizeof *index->entry);
+
+    while ((err = next_token(book, &tok)) == OK) {
+	if (index->count == capacity) {
+	    capacity *= 2;
+	    index->entry = oku_arrayrealloc(index->entry, capacity,
+					    sizeof *index->entry);
+	}
+	SEARCH_ENTRY *e = &index->entry[index->count];
+	e->hash    = tok.hash;
+	e->ordinal = index->count;
+	e->offset  = tok.offset;
+	index->count++;
+    }
+    if (err > 0)
+	return err;
+
+    qsort(index->entry, index->count, sizeof *index->entry,
+	  compare_entries);
+
+    return OK;
+}
+
+/* Static Function: index_save()
+
+   Writes the index to a temporary file and renames it over path, so
+   a partially written index is never loaded. The header is written
+   again once the number of words is known. */
+static int
+index_save(const char *path, SEARCH *index)
+{
+    HEADER h = { INDEX_MAGIC, INDEX_VERSION, index->book_size,
+		 index->book_mtime, index->count, 0 };
+    char *tmp = index_path(path, ".tmp");
+    int err = ERR_IO;
+
+    FILE *f = fopen(tmp, "wb");
+    if (f == NULL)
+	goto out;
+
+    if (fwrite(&h, sizeof h, 1, f) == 1) {
+	index_write(index, f, &h.terms);
+	if (!ferror(f) && !fseek(f, 0, SEEK_SET)
+	    && fwrite(&h, sizeof h, 1, f) == 1)
+	    err = OK;
+    }
+
+    if (fclose(f) || err > 0 || rename(tmp, path)) {
+	remove(tmp);
+	err = ERR_IO;
+    }
+
+ out:
+    oku_free(tmp);
+    return err;
+}
+
+/* Static Function: index_load()
+
+   Reads a saved index if it was built from a book of the same size
+   and modification time. Returns ERR_NOT_FOUND otherwise, or if the
+   index is damaged, so that it is rebuilt.
+
+   [1] Every posting takes at least POSTING_MIN octets, a count the
+       file cannot hold is rejected before anything is allocated. */
+static int
+index_load(const char *path, SEARCH *index)
+{
+    HEADER h;
+    struct stat st;
+    int err = ERR_NOT_FOUND;
+
+    FILE *f = fopen(path, "rb");
+    if (f == NULL)
+	return err;
+
+    if (fstat(fileno(f), &st)
+	|| fread(&h, sizeof h, 1, f) != 1
+	|| memcmp(h.magic, INDEX_MAGIC, sizeof h.magic)
+	|| h.version    != INDEX_VERSION
+	|| h.book_size  != index->book_size
+	|| h.book_mtime != index->book_mtime)
+	goto out;
+
+    uint64_t room = (uint64_t)st.st_size - sizeof h; /* [1] */
+    if (h.count > room / POSTING_MIN || h.terms > h.count
+	|| h.count > UINT32_MAX)
+	goto out;
+
+    index->count = h.count;
+    index->entry = oku_arrayalloc(h.count ? h.count : 1,
+				  sizeof *index->entry);
+
+    if (index_read(f, index, h.terms) > 0) {
+	oku_free(index->entry);
+	index->entry = NULL;
+	index->count = 0;
+	goto out;
+    }
+
+    err = OK;
+ out:
+    fclose(f);
+    return err;
+}
+
+/* Static Function: index_write()
+
+   Encodes the entries to dst, or only counts the octets if dst is
+   NULL. The number of distinct words is stored in *terms.
+
+   [1] Entries are sorted by hash, so each run of equal hashes is one
+       word and its postings are in increasing ordinal, and so offset,
+       order. The differences are small for common words. */
+static size_t
+index_write(SEARCH *index, FILE *dst, uint64_t *terms)
+{
+    size_t bytes = 0;
+    members i = 0;
+
+    *terms = 0;
+    while (i < index->count) {
+	uint32_t hash = index->entry[i].hash;
+	members end = i;
+	while (end < index->count && index->entry[end].hash == hash)
+	    ++end;
+
+	if (dst != NULL)
+	    fwrite(&hash, sizeof hash, 1, dst);
+	bytes += sizeof hash;
+	bytes += put_varint(dst, end - i);
+
+	uint32_t ordinal = 0, offset = 0; /* [1] */
+	for (; i < end; ++i) {
+	    SEARCH_ENTRY *e = &index->entry[i];
+	    bytes += put_varint(dst, e->ordinal - ordinal);
+	    bytes += put_varint(dst, e->offset - offset);
+	    ordinal = e->ordinal;
+	    offset  = e->offset;
+	}
+	++*terms;
+    }
+
+    return bytes;
+}
+
+/* Static Function: index_read()
+
+   Decodes terms words written by index_write() into the entries.
+   Returns ERR_IO if the postings do not add up to the count in the
+   header or run past the end of the file. */
+static int
+index_read(FILE *src, SEARCH *index, uint64_t terms)
+{
+    members i = 0;
+
+    for (uint64_t t = 0; t < terms; ++t) {
+	uint32_t hash = 0, n = 0;
+	if (fread(&hash, sizeof hash, 1, src) != 1
+	    || get_varint(src, &n) > 0 || n > index->count - i)
+	    return ERR_IO;
+
+	uint32_t ordinal = 0, offset = 0;
+	for (members end = i + n; i < end; ++i) {
+	    uint32_t d_ordinal = 0, d_offset = 0;
+	    if (get_varint(src, &d_ordinal) > 0
+		|| get_varint(src, &d_offset) > 0)
+		return ERR_IO;
+
+	    ordinal += d_ordinal;
+	    offset  += d_offset;
+	    index->entry[i] = (SEARCH_ENTRY){ hash, ordinal, offset };
+	}
+    }
+
+    return i == index->count ? OK : ERR_IO;
+}
+
+/* Static Function: compare_entries()
+
+   qsort() ordering by hash, then ordinal. */
+static int
+compare_entries(const void *a, const void *b)
+{
+    const SEARCH_ENTRY *x = a, *y = b;
+
+    if (x->hash != y->hash)
+	return x->hash < y->hash ? -1 : 1;
+    if (x->ordinal != y->ordinal)
+	return x->ordinal < y->ordinal ? -1 : 1;
+
+    return 0;
+}
+
+/* Static Function: index_path()
+
+   Returns a newly allocated copy of path with suffix appended. */
+static char *
+index_path(const char *path, const char *suffix)
+{
+    size_t len = strlen(path);
+    char *out = oku_alloc(len + strlen(suffix) + 1);
+
+    memcpy(out, path, len);
+    strcpy(out + len, suffix);
+
+    return out;
+}
+
+/* Static Function: put_varint()
+
+   Writes value seven bits at a time, least significant first, with
+   the top bit of each octet set if more follow. Returns the number
+   of octets, nothing is written if dst is NULL. */
+static size_t
+put_varint(FILE *dst, uint32_t value)
+{
+    unsigned char buf[VARINT_MAX];
+    size_t n = 0;
+
+    do {
+	buf[n] = value & 0x7F;
+	value >>= 7;
+	if (value)
+	    buf[n] |= 0x80;
+	++n;
+    } while (value);
+
+    if (dst != NULL)
+	fwrite(buf, 1, n, dst);
+
+    return n;
+}
+
+/* Static Function: get_varint()
+
+   Reads a value written by put_varint(). Returns ERR_IO at the end
+   of src or if the value does not fit 32 bits. */
+static int
+get_varint(FILE *src, uint32_t *value)
+{
+    uint32_t v = 0;
+
+    for (unsigned n = 0; n < VARINT_MAX; ++n) {
+	int c = getc(src);
+	if (c == EOF)
+	    return ERR_IO;
+	if (n == VARINT_MAX - 1 && c > 0x0F)
+	    return ERR_IO;
+
+	v |= (uint32_t)(c & 0x7F) << (7 * n);
+	if (!(c & 0x80)) {
+	    *value = v;
+	    return OK;
+	}
+    }
+
+    return ERR_IO;
+}
+
+/* Static Function: lower_bound()
+
+   Index of the first entry not ordered before (hash, ordinal). */
+static members
+lower_bound(SEARCH *index, uint32_t hash, uint32_t ordinal)
+{
+    SEARCH_ENTRY key = { hash, ordinal, 0 };
+    members lo = 0, hi = index->count;
+
+    while (lo < hi) {
+	members mid = lo + (hi - lo) / 2;
+	if (compare_entries(&index->entry[mid], &key) < 0)
+	    lo = mid + 1;
+	else
+	    hi = mid;
+    }
+
+    return lo;
+}
+
+/* Static Function: has_entry()
+
+   Returns non-zero if the word with hash occurs at ordinal. */
+static int
+has_entry(SEARCH *index, uint32_t hash, uint32_t ordinal)
+{
+    members i = lower_bound(index, hash, ordinal);
+
+    return i < index->count && index->entry[i].hash == hash
+	&& index->entry[i].ordinal == ordinal;
+}
+
+/* Static Function: verify()
+
+   Re-reads n words of the book at offset and compares them with the
+   query, ruling out hash collisions. */
+static int
+verify(FILE *book, long offset, TOKEN *query, members n)
+{
+    TOKEN tok;
+
+    if (fseek(book, offset, SEEK_SET))
+	return ERR_IO;
+
+    for (members i = 0; i < n; ++i) {
+	if (next_token(book, &tok) != OK
+	    || tok.len != query[i].len
+	    || memcmp(tok.cp, query[i].cp, tok.len * sizeof *tok.cp))
+	    return ERR_NOT_FOUND;
+    }
+
+    return OK;
+}
@@ -0,0 +1,109 @@
+/* search.h
+ *
+ * This file is part of oku.
+ *
+ * Copyright (C) 2019 Ellis Rhys Thomas
+ *
+ * oku is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * oku is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+ * License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with oku.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS OR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/***************/
+/* Description */
+/***************/
+
+/* Full text search over a UTF-8 book.
+
+   The book is split into words of case folded codepoints. Each word
+   is recorded in a positional inverted index as the hash of the word,
+   its ordinal position in the book and the byte offset of its first
+   octet. Entries are sorted by hash then ordinal, so the postings of
+   a word are contiguous and a phrase is found by checking that each
+   following word of the query occurs at the following ordinal.
+
+   Hits are byte offsets into the book, which is how the pagination
+   index in page.h identifies pages. The index is saved next to the
+   book, each word's hash once followed by its postings as varint
+   deltas, and reused while the book is unchanged. */
+
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include <stdio.h>		/* FILE* */
+#include <stdint.h>		/* uint32_t */
+
+#include "oku_types.h"
+
+/***********/
+/* Objects */
+/***********/
+
+/* Object: SEARCH_ENTRY
+
+   One occurrence of a word. */
+typedef struct SEARCH_ENTRY {
+    uint32_t hash;		/* Hash of case folded word */
+    uint32_t ordinal;		/* Word number within book */
+    uint32_t offset;		/* Byte offset of word in book */
+} SEARCH_ENTRY;
+
+/* Object: SEARCH
+
+   Index over a single book and the cost of obtaining it. */
+typedef struct SEARCH {
+    SEARCH_ENTRY *entry;	/* Sorted by hash, then ordinal */
+    members       count;	/* Number of entries */
+    long          book_size;	/* Length of indexed book (B) */
+    long          book_mtime;	/* Modification time of book */
+    double        build_time;	/* Seconds taken to build, or 0 */
+} SEARCH;
+
+/**************************/
+/* Interface Deceleration */
+/**************************/
+
+/* Function: search_open()
+
+   Load the index saved alongside the book at path, building and
+   saving it if it is missing or out of date. The open book is
+   required to build the index. */
+int search_open(const char *path, FILE *book, SEARCH **out);
+
+/* Function: search_find()
+
+   Find the first occurrence of the UTF-8 phrase query starting at or
+   after byte offset from. The offset of the first word of the hit is
+   stored in *hit, ERR_NOT_FOUND is returned if there is none. */
+int search_find(SEARCH *index, FILE *book, const char *query,
+		long from, long *hit);
+
+/* Function: search_size()
+
+   Returns the size of the index in bytes, as saved on disk. */
+size_t search_size(SEARCH *index);
+
+/* Function: search_destroy()
+
+   Free all memory associated with the index. */
+int search_destroy(SEARCH *index);
+
+#endif	/* SEARCH_H */
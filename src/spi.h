@@ -39,6 +39,10 @@
 
 #include "oku_types.h"
 
+/* Largest write accepted by the kernel in one call, the spidev bufsiz
+   module parameter defaults to 4096 bytes. */
+#define SPI_WRITE_MAX 4096
+
 /* Operating modes from GPIO pins. */
 enum SPI_PINMODE
     { SPI_PINMODE_INPUT, SPI_PINMODE_OUTPUT,
@@ -51,6 +55,15 @@ enum GPIO_LEVEL
       GPIO_LEVEL_LOW   =  0,
       GPIO_LEVEL_HIGH  =  1 };
 
+/* Counters of traffic to the device, kept by every backend. */
+typedef struct SPI_STATS {
+    unsigned long writes;	/* Calls to spi_write() */
+    unsigned long bytes;	/* Bytes written */
+    unsigned long gpio_writes;	/* Calls to spi_gpio_write() */
+    unsigned long commands;	/* Writes of a command, mock only */
+    double        seconds;	/* Time spent in both */
+} SPI_STATS;
+
 /*************/
 /* Interface */
 /*************/
@@ -70,12 +83,32 @@ int spi_gpio_write(int pin, enum GPIO_LEVEL pin_level);
 /* Read the logic level of a given GPIO pin */
 enum GPIO_LEVEL spi_gpio_read(int pin);
 
+/* Block until a given GPIO pin reads level, waking on its edges where
+   the backend can, for at most timeout (ms). Returns ERR_BUSY if the
+   pin is still at the other level. */
+int spi_gpio_wait(int pin, enum GPIO_LEVEL level, unsigned int timeout);
+
 /* Open spi interface. */
 int spi_open(int channel, int speed);
 
-/* Write len bytes to SPI interface. */
+/* Write len bytes to SPI interface, at most SPI_WRITE_MAX. */
 int spi_write(byte *data, int len);
 
+/* Copy the counters accumulated since spi_open() to stats, then zero
+   them if reset is non-zero. */
+int spi_stats(SPI_STATS *stats, int reset);
+
+/* Mock backend only, to test recovery from a hung device */
+
+/* Hang the next refresh: BUSY stays high after the next
+   MASTER_ACTIVATION until resets more resets, each an SW_RESET command
+   or a pulse of the reset pin. Zero ends any hang at once. */
+void spi_mock_hang(unsigned int resets);
+
+/* Hash of the data last written to device RAM before a refresh was
+   started, to tell which frame it showed. */
+unsigned long spi_mock_frame(void);
+
 /* Generic delay (guaranteed minimum delay time) */
 void spi_delay(unsigned int time);
 
@@ -0,0 +1,258 @@
+/* spi_mock.c
+ * 
+ * This file is part of oku.
+ *
+ * Copyright (C) 2019 Ellis Rhys Thomas
+ * 
+ * oku is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * oku is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+ * License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with oku.  If not, see <https://www.gnu.org/licenses/>.
+ * 
+ * Description:
+ *
+ * Implementation of spi.h without hardware, selected with
+ * SPI_BACKEND=mock. Nothing is sent anywhere: every call is counted
+ * and the time it would take on a Raspberry Pi is added up from the
+ * model below, so driver changes can be measured on any machine. The
+ * busy pin always reads low and delays return at once.
+ *
+ */
+
+#include <stddef.h>		/* NULL */
+#include <time.h>		/* clock_gettime(), nanosleep() */
+
+#include "spi.h"
+#include "oku_types.h"
+
+/* Cost model: a write() to spidev is a system call and a DMA set up
+   before the first bit is clocked, a GPIO write is a store to the
+   memory mapped GPIO registers. */
+#define MOCK_WRITE_S 15e-6	/* Overhead of one spi_write() (s) */
+#define MOCK_GPIO_S  0.1e-6	/* One spi_gpio_write() (s) */
+
+/* Simulated BUSY line, wired as the ws29bw: a MASTER_ACTIVATION
+   command written while DC is low raises BUSY for MOCK_REFRESH_S. A
+   hung refresh holds it high until enough SW_RESET commands or pulses
+   of the reset pin. */
+#define MOCK_PIN_RST    17
+#define MOCK_PIN_DC     25
+#define MOCK_PIN_BUSY   24
+#define MOCK_SW_RESET   0x12
+#define MOCK_ACTIVATION 0x20
+#define MOCK_WRITE_RAM  0x24
+#define MOCK_REFRESH_S  20e-3
+
+/* FNV-1a 32 bit hash of RAM data */
+#define FNV_BASIS 0x811C9DC5ul
+#define FNV_PRIME 0x01000193ul
+
+static int spi_clk_hz = 0;	/* Clock set by spi_open(), 0 if closed */
+static SPI_STATS stats;		/* Traffic since spi_open() */
+static enum GPIO_LEVEL dc;	/* Level of MOCK_PIN_DC */
+static enum GPIO_LEVEL rst = GPIO_LEVEL_HIGH; /* Level of MOCK_PIN_RST */
+static double busy_until;	/* When BUSY falls (s) */
+static unsigned hang;		/* Resets the next refresh hangs for */
+static unsigned stuck;		/* Resets until BUSY falls, 0 if not hung */
+static byte command;		/* Last command written */
+static unsigned long ram;	/* Hash of data since WRITE_RAM */
+static unsigned long frame;	/* Hash of RAM at the last activation */
+
+static double seconds(void);
+static void reset(void);
+
+/*** Interface  ***/
+
+/* No GPIO to set up. */
+int
+spi_init_gpio(void)
+{
+    return OK;
+}
+
+/* Pin modes are not modelled. */
+void
+spi_gpio_pinmode(int pin, enum SPI_PINMODE mode)
+{
+    (void)pin;
+    (void)mode;
+    return;
+}
+
+/* Records the clock speed used to model transfer time. */
+int
+spi_open(int channel, int speed)
+{
+    if (channel < 0 || channel > 1 || speed <= 0)
+	return ERR_COMMS;
+
+    spi_clk_hz = speed;
+    stats = (SPI_STATS){ 0 };
+
+    return OK;
+}
+
+/* Counts the write. */
+int
+spi_gpio_write(int pin, enum GPIO_LEVEL pin_level)
+{
+    if ( pin_level == GPIO_LEVEL_ERROR )
+	return ERR_COMMS;
+    if (pin == MOCK_PIN_DC)
+	dc = pin_level;
+    if (pin == MOCK_PIN_RST && pin_level == GPIO_LEVEL_LOW
+	&& rst == GPIO_LEVEL_HIGH)
+	reset();
+    if (pin == MOCK_PIN_RST)
+	rst = pin_level;
+
+    stats.gpio_writes++;
+    stats.seconds += MOCK_GPIO_S;
+
+    return OK;
+}
+
+/* Every pin other than BUSY reads low. */
+enum GPIO_LEVEL
+spi_gpio_read(int pin)
+{
+    if (pin == MOCK_PIN_BUSY && (stuck || seconds() < busy_until))
+	return GPIO_LEVEL_HIGH;
+
+    return GPIO_LEVEL_LOW;
+}
+
+/* Sleeps until the simulated edge, or the timeout. */
+int
+spi_gpio_wait(int pin, enum GPIO_LEVEL level, unsigned int timeout)
+{
+    double left = busy_until - seconds();
+
+    if (spi_gpio_read(pin) == level)
+	return OK;
+    /* Only BUSY reads high, until it falls. */
+    if (level == GPIO_LEVEL_HIGH || stuck || left > timeout / 1e3)
+	return ERR_BUSY;
+
+    struct timespec t = { .tv_sec  = (time_t)left,
+			  .tv_nsec = (long)(left * 1e9) % 1000000000 };
+    nanosleep(&t, NULL);
+
+    return OK;
+}
+
+/* Counts the write, which takes the call overhead plus eight clock
+   cycles a byte. Writes longer than the kernel accepts fail as they
+   would on the device.
+
+   Commands are followed to model BUSY and to hash the data written
+   to RAM, which is taken as the frame shown by the next refresh. */
+int
+spi_write(byte *data, int len)
+{
+    if (spi_clk_hz == 0)
+	return ERR_UNINITIALISED;
+    if (data == NULL || len < 0 || len > SPI_WRITE_MAX)
+	return ERR_PARTIAL_WRITE;
+
+    stats.writes++;
+    stats.bytes += len;
+    stats.seconds += MOCK_WRITE_S + 8.0 * len / spi_clk_hz;
+
+    if (dc == GPIO_LEVEL_LOW)
+	stats.commands++;
+    if (dc == GPIO_LEVEL_HIGH && command == MOCK_WRITE_RAM)
+	for (int i = 0; i < len; ++i)
+	    ram = (ram ^ data[i]) * FNV_PRIME & 0xFFFFFFFFul;
+    if (dc != GPIO_LEVEL_LOW || len != 1)
+	return OK;
+
+    command = data[0];
+    switch (command) {
+    case MOCK_WRITE_RAM:
+	ram = FNV_BASIS;
+	break;
+    case MOCK_SW_RESET:
+	reset();
+	break;
+    case MOCK_ACTIVATION:
+	frame = ram;
+	busy_until = seconds() + MOCK_REFRESH_S;
+	if (hang && !stuck)
+	    stuck = hang;
+	hang = 0;
+	break;
+    }
+
+    return OK;
+}
+
+/* Copy, and optionally reset, the traffic counters. */
+int
+spi_stats(SPI_STATS *out, int reset)
+{
+    if (out == NULL)
+	return ERR_INPUT;
+
+    *out = stats;
+    if (reset)
+	stats = (SPI_STATS){ 0 };
+
+    return OK;
+}
+
+/* Returns at once. */
+void
+spi_delay(unsigned int time)
+{
+    (void)time;
+    return;
+}
+
+/* Arms a hang of the next refresh, or ends one. */
+void
+spi_mock_hang(unsigned int resets)
+{
+    hang = resets;
+    if (resets == 0)
+	stuck = 0;
+
+    return;
+}
+
+/* Hash of RAM data at the last MASTER_ACTIVATION. */
+unsigned long
+spi_mock_frame(void)
+{
+    return frame;
+}
+
+/*** Static Functions ***/
+
+/* A reset of the controller, which brings back a hung refresh once
+   it has had the resets it was set to need. */
+static void
+reset(void)
+{
+    if (stuck && --stuck == 0)
+	busy_until = 0;
+
+    return;
+}
+
+/* Monotonic time in seconds. */
+static double
+seconds(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
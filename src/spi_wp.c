@@ -25,8 +25,14 @@
  *
  */
 
-#include <unistd.h>		/* read() */
+#include <unistd.h>		/* read(), close() */
 #include <errno.h>		/* errno */
+#include <time.h>		/* clock_gettime() */
+#include <string.h>		/* strncpy() */
+#include <fcntl.h>		/* open(), fcntl() */
+#include <poll.h>		/* poll() */
+#include <sys/ioctl.h>		/* ioctl() */
+#include <linux/gpio.h>		/* GPIO character device */
 
 #include <wiringPi.h>
 #include <wiringPiSPI.h>
@@ -38,6 +44,25 @@
    write() */
 static int spi_fid = -1;
 
+/* GPIO character device of the Broadcom GPIO, line offsets are the
+   Broadcom pin numbers. */
+#ifndef SPI_GPIO_CHIP
+#define SPI_GPIO_CHIP "/dev/gpiochip0"
+#endif
+#define GPIO_PINS 54		/* Lines on the chip */
+#define POLL_US   100		/* Fallback polling interval (us) */
+
+/* Traffic since spi_open() */
+static SPI_STATS stats;
+
+/* Edge event file descriptor of each line, requested on first wait,
+   or -1 if the character device is unavailable. */
+static struct { int requested; int fd; } line[GPIO_PINS];
+
+static double seconds(void);
+static int line_events(int pin);
+static enum GPIO_LEVEL line_read(int pin, int fd);
+
 /*** Interface  ***/
 
 /* Initialises WiringPI SPI interface with Broadcom GPIO pin
@@ -67,10 +92,17 @@ spi_gpio_pinmode(int pin, enum SPI_PINMODE mode)
 }
 
 
-/* Opens spi interface and stores the file descriptor in spi_fid. */
+/* Opens spi interface and stores the file descriptor in spi_fid. An
+   interface already open is closed first, so the device can be
+   started again. */
 int
 spi_open(int channel, int speed)
 {
+    stats = (SPI_STATS){ 0 };
+
+    if (spi_fid >= 0)
+	close(spi_fid);
+
     return (spi_fid = wiringPiSPISetup(channel, speed)) < 0
 	? ERR_COMMS : OK;
 }
@@ -82,7 +114,10 @@ spi_gpio_write(int pin, enum GPIO_LEVEL pin_level)
     if ( pin_level == GPIO_LEVEL_ERROR )
 	return ERR_COMMS;
 
+    double t0 = seconds();
     digitalWrite(pin, pin_level);
+    stats.gpio_writes++;
+    stats.seconds += seconds() - t0;
 
     return OK;
 
@@ -99,6 +134,47 @@ spi_gpio_read(int pin)
     return digitalRead(pin);
 }
 
+/* Waits on edge events from the GPIO character device.
+
+   [1] Events queued by earlier edges are discarded before the level
+       is read, so an edge after the read always wakes poll().
+
+   [2] Without the character device the level is polled every
+       POLL_US. */
+int
+spi_gpio_wait(int pin, enum GPIO_LEVEL level, unsigned int timeout)
+{
+    double end = seconds() + timeout / 1e3;
+    int fd = line_events(pin);
+    struct gpioevent_data event;
+
+    for (;;) {
+	/* [1] */
+	if (fd >= 0)
+	    while (read(fd, &event, sizeof event) == sizeof event)
+		;
+
+	enum GPIO_LEVEL now = line_read(pin, fd);
+	if (now == GPIO_LEVEL_ERROR)
+	    return ERR_COMMS;
+	if (now == level)
+	    return OK;
+
+	double left = end - seconds();
+	if (left <= 0)
+	    return ERR_BUSY;
+
+	if (fd >= 0) {
+	    struct pollfd p = { .fd = fd, .events = POLLIN };
+	    if (poll(&p, 1, left * 1e3 + 1) < 0 && errno != EINTR)
+		return ERR_COMMS;
+	} else {
+	    /* [2] */
+	    delayMicroseconds(POLL_US);
+	}
+    }
+}
+
 /* Write n bytes to SPI interface. */
 int
 spi_write(byte *data, int len)
@@ -106,7 +182,27 @@ spi_write(byte *data, int len)
     if (spi_fid < 0)
 	return ERR_UNINITIALISED;
 
-    return write(spi_fid, data, len) < len ? ERR_PARTIAL_WRITE : OK;
+    double t0 = seconds();
+    int err = write(spi_fid, data, len) < len ? ERR_PARTIAL_WRITE : OK;
+    stats.writes++;
+    stats.bytes += len;
+    stats.seconds += seconds() - t0;
+
+    return err;
+}
+
+/* Copy, and optionally reset, the traffic counters. */
+int
+spi_stats(SPI_STATS *out, int reset)
+{
+    if (out == NULL)
+	return ERR_INPUT;
+
+    *out = stats;
+    if (reset)
+	stats = (SPI_STATS){ 0 };
+
+    return OK;
 }
 
 /* Generic delay (guaranteed minimum delay time) */
@@ -115,3 +211,64 @@ spi_delay(unsigned int time)
 {
     return delay(time);
 }
+
+/*** Static Functions ***/
+
+/* Request edge events on pin from the GPIO character device, once.
+   Returns the non-blocking event file descriptor, or -1. */
+static int
+line_events(int pin)
+{
+    if (pin < 0 || pin >= GPIO_PINS)
+	return -1;
+    if (line[pin].requested)
+	return line[pin].fd;
+
+    line[pin].requested = 1;
+    line[pin].fd = -1;
+
+    int chip = open(SPI_GPIO_CHIP, O_RDONLY);
+    if (chip < 0)
+	return -1;
+
+    struct gpioevent_request req = {
+	.lineoffset  = pin,
+	.handleflags = GPIOHANDLE_REQUEST_INPUT,
+	.eventflags  = GPIOEVENT_REQUEST_BOTH_EDGES
+    };
+    strncpy(req.consumer_label, "oku", sizeof req.consumer_label - 1);
+
+    if (ioctl(chip, GPIO_GET_LINEEVENT_IOCTL, &req) == 0) {
+	if (fcntl(req.fd, F_SETFL, O_NONBLOCK) == 0)
+	    line[pin].fd = req.fd;
+	else
+	    close(req.fd);
+    }
+    close(chip);
+
+    return line[pin].fd;
+}
+
+/* Read the level of pin through its event file descriptor, which
+   holds the line, or with wiringPi if there is none. */
+static enum GPIO_LEVEL
+line_read(int pin, int fd)
+{
+    struct gpiohandle_data data;
+
+    if (fd < 0)
+	return digitalRead(pin);
+    if (ioctl(fd, GPIOHANDLE_GET_LINE_VALUES_IOCTL, &data) < 0)
+	return GPIO_LEVEL_ERROR;
+
+    return data.values[0] ? GPIO_LEVEL_HIGH : GPIO_LEVEL_LOW;
+}
+
+/* Monotonic time in seconds. */
+static double
+seconds(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
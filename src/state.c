@@ -0,0 +1,286 @@
+/* state.c
+ *
+ * This file is part of oku.
+ *
+ * Copyright (C) 2019 Ellis Rhys Thomas
+ *
+ * oku is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * oku is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+ * License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with oku.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS OR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/***************/
+/* Description */
+/***************/
+
+/* Reader state snapshot, see state.h. */
+
+#include <stdio.h>		/* FILE*, rename() */
+#include <string.h>		/* memcmp(), strlen() */
+#include <unistd.h>		/* fsync() */
+#include <sys/stat.h>		/* stat() */
+
+#include "state.h"
+#include "page.h"
+#include "oku_mem.h"
+#include "oku_types.h"
+
+#define STATE_SUFFIX ".state"	/* Snapshot file, appended to book */
+#define PAGES_SUFFIX ".pages"	/* Pagination cache, appended to book */
+#define TMP_SUFFIX ".tmp"	/* Written then renamed into place */
+#define STATE_MAGIC "OKUS"	/* File signature */
+#define STATE_VERSION 1		/* Increment on format change */
+
+/* Object: HEADER
+
+   Start of both files. The long size is included as offsets in the
+   pagination cache are native longs. */
+typedef struct HEADER {
+    char     magic[4];
+    uint16_t version;
+    uint16_t long_size;
+} HEADER;
+
+/************************/
+/* Forward Declarations */
+/************************/
+
+static char *state_path(const char *path, const char *suffix);
+static FILE *open_checked(const char *path);
+static FILE *open_atomic(const char *path);
+static int close_atomic(FILE *f, const char *path, int err);
+static int same_layout(STATE *a, STATE *b);
+
+/************************/
+/* Interface Definition */
+/************************/
+
+/* Function: state_identify()
+
+   The size and modification time of the book identify it. */
+int
+state_identify(const char *path, STATE *state)
+{
+    struct stat st;
+
+    if (stat(path, &st))
+	return ERR_IO;
+
+    state->book_size  = st.st_size;
+    state->book_mtime = st.st_mtime;
+
+    return OK;
+}
+
+/* Function: state_load()
+
+   The snapshot is only valid if the book is unchanged and the saved
+   offset lies within it. */
+int
+state_load(const char *path, STATE *state)
+{
+    STATE book, saved;
+    int err = state_identify(path, &book);
+    if (err > 0)
+	return err;
+
+    char *file = state_path(path, STATE_SUFFIX);
+    FILE *f = open_checked(file);
+    oku_free(file);
+    if (f == NULL)
+	return ERR_NOT_FOUND;
+
+    err = fread(&saved, sizeof saved, 1, f) == 1 ? OK : ERR_NOT_FOUND;
+    fclose(f);
+    if (err > 0)
+	return err;
+
+    if (saved.book_size != book.book_size
+	|| saved.book_mtime != book.book_mtime
+	|| saved.offset < 0 || saved.offset > saved.book_size)
+	return ERR_NOT_FOUND;
+
+    *state = saved;
+
+    return OK;
+}
+
+/* Function: state_save()
+
+   Writes the snapshot to a temporary file, syncs and renames it over
+   the previous snapshot. */
+int
+state_save(const char *path, STATE *state)
+{
+    char *file = state_path(path, STATE_SUFFIX);
+    FILE *f = open_atomic(file);
+    int err = ERR_IO;
+
+    if (f != NULL) {
+	err = fwrite(state, sizeof *state, 1, f) == 1 ? OK : ERR_PARTIAL_WRITE;
+	err = close_atomic(f, file, err);
+    }
+
+    oku_free(file);
+    return err;
+}
+
+/* Function: state_load_pages()
+
+   The cache begins with the state it was saved with, the index is
+   only restored if that describes the same book and layout. */
+int
+state_load_pages(const char *path, STATE *state, PAGES *pages)
+{
+    STATE key;
+    char *file = state_path(path, PAGES_SUFFIX);
+    FILE *f = open_checked(file);
+    int err = ERR_NOT_FOUND;
+
+    oku_free(file);
+    if (f == NULL)
+	return err;
+
+    if (fread(&key, sizeof key, 1, f) == 1 && same_layout(&key, state))
+	err = pages_load(pages, f);
+
+    fclose(f);
+    return err;
+}
+
+/* Function: state_save_pages()
+
+   Writes the layout key followed by the index. */
+int
+state_save_pages(const char *path, STATE *state, PAGES *pages)
+{
+    char *file = state_path(path, PAGES_SUFFIX);
+    FILE *f = open_atomic(file);
+    int err = ERR_IO;
+
+    if (f != NULL) {
+	err = fwrite(state, sizeof *state, 1, f) == 1
+	    ? pages_save(pages, f) : ERR_PARTIAL_WRITE;
+	err = close_atomic(f, file, err);
+    }
+
+    oku_free(file);
+    return err;
+}
+
+/********************/
+/* Static Functions */
+/********************/
+
+/* Static Function: state_path()
+
+   Returns a newly allocated copy of path with suffix appended. */
+static char *
+state_path(const char *path, const char *suffix)
+{
+    size_t len = strlen(path);
+    char *out = oku_alloc(len + strlen(suffix) + 1);
+
+    memcpy(out, path, len);
+    memcpy(out + len, suffix, strlen(suffix) + 1);
+
+    return out;
+}
+
+/* Static Function: open_checked()
+
+   Opens path for reading and checks its header, returns NULL if it
+   is missing or was written by another version. */
+static FILE *
+open_checked(const char *path)
+{
+    HEADER h;
+    FILE *f = fopen(path, "rb");
+    if (f == NULL)
+	return NULL;
+
+    if (fread(&h, sizeof h, 1, f) != 1
+	|| memcmp(h.magic, STATE_MAGIC, sizeof h.magic)
+	|| h.version != STATE_VERSION
+	|| h.long_size != sizeof(long)) {
+	fclose(f);
+	return NULL;
+    }
+
+    return f;
+}
+
+/* Static Function: open_atomic()
+
+   Opens the temporary file for path and writes the header. */
+static FILE *
+open_atomic(const char *path)
+{
+    HEADER h = { STATE_MAGIC, STATE_VERSION, sizeof(long) };
+    char *tmp = state_path(path, TMP_SUFFIX);
+    FILE *f = fopen(tmp, "wb");
+
+    if (f != NULL && fwrite(&h, sizeof h, 1, f) != 1) {
+	fclose(f);
+	remove(tmp);
+	f = NULL;
+    }
+
+    oku_free(tmp);
+    return f;
+}
+
+/* Static Function: close_atomic()
+
+   Flushes the temporary file to storage and, if nothing has failed,
+   renames it over path. Otherwise it is removed. */
+static int
+close_atomic(FILE *f, const char *path, int err)
+{
+    char *tmp = state_path(path, TMP_SUFFIX);
+
+    if (err == OK && (fflush(f) || fsync(fileno(f))))
+	err = ERR_IO;
+    if (fclose(f) && err == OK)
+	err = ERR_IO;
+    if (err == OK && rename(tmp, path))
+	err = ERR_IO;
+    if (err > 0)
+	remove(tmp);
+
+    oku_free(tmp);
+    return err;
+}
+
+/* Static Function: same_layout()
+
+   Pagination depends on the book, font size, page size and margins
+   but not the reading position. */
+static int
+same_layout(STATE *a, STATE *b)
+{
+    return a->book_size == b->book_size
+	&& a->book_mtime == b->book_mtime
+	&& a->fontsize   == b->fontsize
+	&& a->width      == b->width
+	&& a->height     == b->height
+	&& !memcmp(&a->margins, &b->margins, sizeof a->margins);
+}
@@ -0,0 +1,101 @@
+/* state.h
+ *
+ * This file is part of oku.
+ *
+ * Copyright (C) 2019 Ellis Rhys Thomas
+ *
+ * oku is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * oku is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+ * License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with oku.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS OR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/***************/
+/* Description */
+/***************/
+
+/* Reader state snapshot.
+
+   A small record of where the reader is in a book and how it is
+   being rendered, saved next to the book as <book>.state each time a
+   page is displayed. The pagination index is the expensive part of
+   the state to recreate, so it is cached separately in <book>.pages
+   and the snapshot records the layout key it must match. Both files
+   are replaced atomically so a crash leaves the previous copy
+   intact. */
+
+#ifndef STATE_H
+#define STATE_H
+
+#include <stdint.h>		/* int64_t */
+
+#include "oku_types.h"
+#include "page.h"
+
+/***********/
+/* Objects */
+/***********/
+
+/* Object: STATE
+
+   Book identity, reading position and render settings. */
+typedef struct STATE {
+    int64_t    book_size;	/* Identity: length of book (B) */
+    int64_t    book_mtime;	/* Identity: modification time */
+    int64_t    offset;		/* Start of page on display */
+    uint32_t   fontsize;	/* Font size (px) */
+    resolution width;		/* Page width (px) */
+    resolution height;		/* Page height (px) */
+    MARGINS    margins;		/* Page margins (px) */
+} STATE;
+
+/**************************/
+/* Interface Deceleration */
+/**************************/
+
+/* Function: state_identify()
+
+   Record the identity of the book at path in state. */
+int state_identify(const char *path, STATE *state);
+
+/* Function: state_load()
+
+   Read the snapshot saved for the book at path. Returns ERR_NOT_FOUND
+   if there is none, or the book has changed since it was saved. */
+int state_load(const char *path, STATE *state);
+
+/* Function: state_save()
+
+   Atomically replace the snapshot saved for the book at path. */
+int state_save(const char *path, STATE *state);
+
+/* Function: state_load_pages()
+
+   Restore the pagination index cached for the book at path, provided
+   it was built with the layout recorded in state. */
+int state_load_pages(const char *path, STATE *state, PAGES *pages);
+
+/* Function: state_save_pages()
+
+   Atomically replace the cached pagination index, keyed by the
+   layout recorded in state. */
+int state_save_pages(const char *path, STATE *state, PAGES *pages);
+
+#endif	/* STATE_H */
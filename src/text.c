@@ -1,4 +1,4 @@
-/* 
+/* text.c
  * 
  * This file is part of oku.
  *
@@ -33,40 +33,315 @@
 
 /* Converts a unicode codepoint into a FreeType glyph. */
 
+#include <string.h>		/* memcpy() */
+
 #include <ft2build.h>
 #include FT_FREETYPE_H
 #include FT_GLYPH_H
 
-/* #include <stdio.h>  */   // debugging to stdout
-/* #include <stdlib.h> */     
-
 #include "text.h"
 #include "bitmap.h"
 #include "oku_mem.h"
 #include "oku_types.h"
 
-/* Initialise FreeType library and return handle */
-FT *
+/* Convert FreeType 26.6 fixed point values to whole pixels. */
+#define FT_PX(X) ((X) >> 6)
+
+/************************/
+/* Forward Declarations */
+/************************/
+
+static int set_metrics(TEXT *text, unsigned size);
+static int glyph_render(TEXT *text, codepoint cp, GLYPH *node);
+static int glyph_render_gray(TEXT *text, GLYPH *node);
+static int cache_fill(TEXT *text, codepoint cp, GLYPH **node);
+static void glyph_flush(TEXT *text, GLYPH *node);
+static void cache_flush(TEXT *text);
+
+/************************/
+/* Interface Definition */
+/************************/
+
+/* Function: text_start()
+
+   Initialise FreeType library and load the font face at the requested
+   pixel size. Returns handle, or NULL if the font cannot be
+   loaded. Exits on memory error.
+
+   Glyph images are held in a pool owned by the handle, so once the
+   cache is warm a miss reuses the image memory of the glyph it
+   replaces. */
+TEXT *
 text_start(char *font, unsigned size)
 {
-    TEXT *new = oku_alloc(sizeof *new);
+    TEXT *new = oku_alloc(sizeof *new); /* zeroed, exits on failure */
+
+    new->pool = mempool_create(0);
+    if (new->pool == NULL)
+	goto fail0;
+    if (FT_Init_FreeType(&new->lib))
+	goto fail1;
+    if (FT_New_Face(new->lib, font, 0, &new->face))
+	goto fail2;
+    if (set_metrics(new, size))
+	goto fail3;
+
+    return new;
+ fail3:
+    FT_Done_Face(new->face);
+ fail2:
+    FT_Done_FreeType(new->lib);
+ fail1:
+    mempool_destroy(new->pool);
+ fail0:
+    oku_free(new);
+    return NULL;
+}
+
+/* Function: text_set_size()
+
+   Change font pixel size. All cached glyphs are rendered at the old
+   size, so the cache is emptied. */
+int
+text_set_size(TEXT *text, unsigned size)
+{
+    if (text == NULL)
+	return ERR_UNINITIALISED;
+    if (size == 0)
+	return ERR_INPUT;
+
+    cache_flush(text);
 
-    int err =
-	FT_Init_FreeType(&new->lib)             ||
-	FT_New_Face(ft->lib, font, 0 &ft->face) ||
-	FT_Set_Pixel_Sizes(ft->face, 0, size);	
+    return set_metrics(text, size);
+}
+
+/* Function: text_glyph()
 
-    
+   Returns the glyph node for codepoint cp in *out. The cache is
+   direct mapped, the node a codepoint hashes to is replaced on a
+   miss. A hit in the shared cache is returned without modifying
+   it. */
+int
+text_glyph(TEXT *text, codepoint cp, GLYPH **out)
+{
+    members slot = cp & (GLYPH_CACHE_SIZE - 1);
 
-    return err ? ERR_RENDER : OK;
+    if (text->shared) {
+	const GLYPH *hit = &text->shared->db[slot];
+	if (hit->cached && hit->unicode == cp) {
+	    *out = (GLYPH *)hit;
+	    return OK;
+	}
+    }
+
+    return cache_fill(text, cp, out);
 }
 
-void
-text_stop(FT *delete)
+/* Function: text_glyph_gray()
+
+   The gray image is held alongside the monochrome one, in the same
+   node, and is only rendered when first asked for. */
+int
+text_glyph_gray(TEXT *text, codepoint cp, GLYPH **out)
 {
-    FT_Done_Face(delete->face);
-    FT_Done_FreeType(delete->lib);
+    members slot = cp & (GLYPH_CACHE_SIZE - 1);
+
+    if (text->shared) {
+	const GLYPH *hit = &text->shared->db[slot];
+	if (hit->gray_cached && hit->unicode == cp) {
+	    *out = (GLYPH *)hit;
+	    return OK;
+	}
+    }
+
+    int err = cache_fill(text, cp, out);
+    if (err > 0 || (*out)->gray_cached)
+	return err;
+
+    return glyph_render_gray(text, *out);
+}
+
+/* Function: text_stop()
+
+   Frees all memory associated with the text handle. */
+int
+text_stop(TEXT *text)
+{
+    if (text == NULL)
+	return ERR_UNINITIALISED;
+
+    FT_Done_Face(text->face);
+    FT_Done_FreeType(text->lib);
+    mempool_destroy(text->pool);
+    oku_free(text);
+
+    return OK;
+}
+
+/********************/
+/* Static Functions */
+/********************/
+
+/* Static Function: set_metrics()
+
+   Set the face pixel size and record the line metrics used for
+   layout. */
+static int
+set_metrics(TEXT *text, unsigned size)
+{
+    if (FT_Set_Pixel_Sizes(text->face, 0, size))
+	return ERR_RENDER;
+
+    FT_Size_Metrics *m = &text->face->size->metrics;
+
+    text->size        = size;
+    text->ascender    = FT_PX(m->ascender);
+    text->descender   = FT_PX(-m->descender);
+    text->line_height = FT_PX(m->height);
+
+    return OK;
+}
+
+/* Static Function: glyph_render()
+
+   [1] Load and render the glyph in monochrome, one bit per pixel
+   packed most significant bit first, matching bitmap.h.
+
+   [2] FreeType owns the slot bitmap, so the image is copied into
+   memory from the pool held by the node. Blank glyphs such as spaces
+   have no image. */
+static int
+glyph_render(TEXT *text, codepoint cp, GLYPH *node)
+{
+    FT_UInt index = FT_Get_Char_Index(text->face, cp);
+
+    /* [1] */
+    if (FT_Load_Glyph(text->face, index, FT_LOAD_RENDER | FT_LOAD_TARGET_MONO))
+	return ERR_RENDER;
+
+    FT_GlyphSlot slot = text->face->glyph;
+    FT_Bitmap *ft = &slot->bitmap;
+
+    node->unicode = cp;
+    node->index   = index;
+    node->advance = FT_PX(slot->advance.x);
+    node->left    = slot->bitmap_left;
+    node->top     = slot->bitmap_top;
+    node->bmp     = (BITMAP){ 0 };
+
+    /* [2] */
+    if (ft->width > 0 && ft->rows > 0 && ft->pitch > 0) {
+	members length = (members)ft->pitch * ft->rows;
+	byte *buffer = mempool_alloc(text->pool, length); /* exits on failure */
+	memcpy(buffer, ft->buffer, length);
+
+	if (bitmap_ft(length, ft->pitch, ft->width, buffer, &node->bmp)) {
+	    mempool_free(text->pool, buffer, length);
+	    return ERR_RENDER;
+	}
+    }
+
+    node->cached = 1;
+
+    return OK;
+}
+
+/* Static Function: glyph_render_gray()
+
+   [1] The glyph is hinted for monochrome, as in glyph_render(), so
+   its outline and advance match the monochrome image, then rendered
+   with 8 bit anti-aliasing.
+
+   [2] The coverage is packed straight into two bit planes held in one
+   block from the pool. */
+static int
+glyph_render_gray(TEXT *text, GLYPH *node)
+{
+    /* [1] */
+    if (FT_Load_Glyph(text->face, node->index, FT_LOAD_TARGET_MONO)
+	|| FT_Render_Glyph(text->face->glyph, FT_RENDER_MODE_NORMAL))
+	return ERR_RENDER;
+
+    FT_GlyphSlot slot = text->face->glyph;
+    FT_Bitmap *ft = &slot->bitmap;
+
+    node->gray_left = slot->bitmap_left;
+    node->gray_top  = slot->bitmap_top;
+    node->gray      = (GRAYMAP){ 0 };
+
+    /* [2] */
+    if (ft->width > 0 && ft->rows > 0 && ft->pitch > 0) {
+	members pitch = (ft->width + 7) / 8;
+	members length = GRAY_PLANES * pitch * ft->rows;
+	byte *buffer = mempool_alloc(text->pool, length); /* exits on failure */
+
+	if (graymap_assign(pitch, ft->width, ft->rows, buffer, &node->gray)
+	    || graymap_coverage(&node->gray, ft->buffer, ft->pitch)) {
+	    mempool_free(text->pool, buffer, length);
+	    node->gray = (GRAYMAP){ 0 };
+	    return ERR_RENDER;
+	}
+    }
+
+    node->gray_cached = 1;
+
+    return OK;
+}
+
+/* Static Function: glyph_flush()
+
+   Return the images held by a cache node to the pool and mark it
+   empty. */
+static void
+glyph_flush(TEXT *text, GLYPH *node)
+{
+    BITMAP *gray = &node->gray.plane[GRAY_HI];
+
+    mempool_free(text->pool, node->bmp.buffer, node->bmp.length);
+    mempool_free(text->pool, gray->buffer, GRAY_PLANES * gray->length);
+    node->bmp = (BITMAP){ 0 };
+    node->gray = (GRAYMAP){ 0 };
+    node->cached = 0;
+    node->gray_cached = 0;
 
     return;
 }
 
+/* Static Function: cache_flush()
+
+   Empty every node in the glyph cache, releasing all of the images at
+   once. */
+static void
+cache_flush(TEXT *text)
+{
+    for (members i = 0; i < GLYPH_CACHE_SIZE; ++i) {
+	text->db[i].bmp = (BITMAP){ 0 };
+	text->db[i].gray = (GRAYMAP){ 0 };
+	text->db[i].cached = 0;
+	text->db[i].gray_cached = 0;
+    }
+    mempool_reset(text->pool);
+
+    return;
+}
+
+/* Static Function: cache_fill()
+
+   Store the node of this handle's cache holding codepoint cp in
+   *node, replacing its contents on a miss. */
+static int
+cache_fill(TEXT *text, codepoint cp, GLYPH **node)
+{
+    GLYPH *n = &text->db[cp & (GLYPH_CACHE_SIZE - 1)];
+
+    if (!n->cached || n->unicode != cp) {
+	glyph_flush(text, n);
+	int err = glyph_render(text, cp, n);
+	if (err > 0)
+	    return err;
+    }
+
+    *node = n;
+
+    return OK;
+}
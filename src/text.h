@@ -31,7 +31,10 @@
 /* Description */
 /***************/
 
-/* Renders text to bitmap surface using unicode codepoints. */
+/* Renders text to bitmap surface using unicode codepoints. Glyphs
+   are rasterised once by FreeType into monochrome bitmaps (see
+   bitmap.h) and kept in a small cache so that laying out and drawing
+   a page does not require the font to be consulted repeatedly. */
 
 #ifndef TEXT_H
 #define TEXT_H
@@ -41,26 +44,83 @@
 #include FT_GLYPH_H
 
 #include "oku_types.h"
+#include "bitmap.h"
+#include "graymap.h"
+#include "mempool.h"
 
-/* Node to cache a glyph  */
+/* Number of glyphs held in the cache, must be a power of two. */
+#define GLYPH_CACHE_SIZE 256
+
+/***********/
+/* Objects */
+/***********/
+
+/* Object: GLYPH
+
+   Node to cache a rendered glyph. Pen offsets are relative to the pen
+   position on the baseline. */
 typedef struct GLYPH {
-    unsigned      index;	/* FreeType glyph index */
-    unsigned long unicode;	/* Unicode codepoint */
-    FT_Glyph      glyph;	/* FreeType glyph */
-    FT_BBox       bbox;		/* Glyph bounding box */
+    codepoint  unicode;		/* Unicode codepoint (cache key) */
+    unsigned   index;		/* FreeType glyph index */
+    int        cached;		/* Non-zero once node is populated */
+    resolution advance;		/* Horizontal pen advance (px) */
+    int        left;		/* Bitmap offset right of pen (px) */
+    int        top;		/* Bitmap offset above baseline (px) */
+    BITMAP     bmp;		/* Monochrome image, zero if blank */
+    int        gray_cached;	/* Non-zero once gray is rendered */
+    int        gray_left;	/* As left, for the gray image */
+    int        gray_top;	/* As top, for the gray image */
+    GRAYMAP    gray;		/* Four level image, zero if blank */
 } GLYPH;
 
+/* Object: TEXT
+
+   FreeType handles, current font metrics and glyph cache. FreeType
+   faces may not be shared between threads, each thread requires its
+   own TEXT. Threads may instead share a warm cache by pointing shared
+   at a TEXT of the same font and size that no thread modifies. */
 typedef struct TEXT {
+    const struct TEXT *shared;	/* Read-only cache searched first */
     FT_Library lib;		/* FreeType library handle */
     FT_Face    face;		/* Font face handle */
-    GLYPH      db[STRMAX];	/* Cache for storing glyphs */
+    unsigned   size;		/* Font size in pixels */
+    resolution line_height;	/* Baseline to baseline distance (px) */
+    resolution ascender;	/* Top of line to baseline (px) */
+    resolution descender;	/* Baseline to bottom of line (px) */
+    GLYPH      db[GLYPH_CACHE_SIZE]; /* Cache for storing glyphs */
+    MEMPOOL      *pool;		/* Memory for glyph images */
 } TEXT;
 
-/* Initialise FreeType*/
-FT *text_start(char *font, unsigned size);
+/**************************/
+/* Interface Deceleration */
+/**************************/
 
+/* Function: text_start()
 
+   Initialise FreeType with the font at path font, rendering at size
+   pixels. Returns handle or NULL on failure. */
+TEXT *text_start(char *font, unsigned size);
 
+/* Function: text_set_size()
 
-#endif	/* TEXT_H */
+   Change the pixel size of the font. Cached glyphs are discarded. */
+int text_set_size(TEXT *text, unsigned size);
+
+/* Function: text_glyph()
 
+   Retrieve the cached glyph for codepoint cp, rendering it on a cache
+   miss. The glyph remains valid until the next call. */
+int text_glyph(TEXT *text, codepoint cp, GLYPH **out);
+
+/* Function: text_glyph_gray()
+
+   As text_glyph(), the four level image of the glyph being rendered
+   on first use. Advances match the monochrome glyph. */
+int text_glyph_gray(TEXT *text, codepoint cp, GLYPH **out);
+
+/* Function: text_stop()
+
+   Free glyph cache and release FreeType resources. */
+int text_stop(TEXT *text);
+
+#endif	/* TEXT_H */
@@ -80,7 +80,13 @@ utf8_ftocp(FILE *src, codepoint *out)
     unsigned length = 0;
 
     err = ftoutf8(src, utf8, &length);
-    if (err > 0)
+    if (err == ERR_INVALID_UTF8) {
+	/* Stray continuation or invalid initial byte */
+	*out = CHAR_INVALID;
+	err = WARN_REPLACEMENT_CHAR;
+	goto out;
+    }
+    if (err > 0 || err == WARN_EOF)
 	goto out;
 	
     err = utf8tocp(utf8, length, out);
@@ -140,7 +146,7 @@ static int
 file_read(FILE *src, byte *dest, unsigned n)
 {
     if (fread(dest, sizeof *dest, n, src) < n)
-	return check_eof(src) || ERR_IO;
+	return check_eof(src) ? WARN_EOF : ERR_IO;
 
     return OK;
 }
@@ -173,7 +179,7 @@ ftoutf8(FILE *src, byte *dest, unsigned *n)
     *n = seq_nbytes(*dest);	   /* [2] */
 
     if (*n > 1 && *n <= 4)	   /* [3]  */
-	err = file_read(src, dest, *n - 1);
+	err = file_read(src, dest + 1, *n - 1);
     else if (*n != 1)		   /* Invalid UTF-8 */
 	err = ERR_INVALID_UTF8;
 
@@ -32,6 +32,8 @@
 #ifndef UTF_H
 #define UTF_H
 
+#include <stdio.h>		/* FILE* */
+
 #include "oku_types.h"
 
 /***********************/